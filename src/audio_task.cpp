@@ -0,0 +1,287 @@
+//
+// Created by agent on 2026/10/19.
+//
+
+#include <Arduino.h>
+#include <FS.h>
+#include <LittleFS.h>
+#include <Audio.h>
+
+#include "config.h"
+#include "audio_task.h"
+#include "event_loop.h"
+#include "mixer.h"
+#include "profiler.h"
+#include "sound_cache.h"
+#include "status_code.h"
+#include "stream_buffer.h"
+#include "trace.h"
+
+Audio audio;
+
+QueueHandle_t AudioTask::_queue = nullptr;
+SemaphoreHandle_t AudioTask::_done = nullptr;
+volatile int AudioTask::_result = CD_SUCCESS;
+volatile uint32_t AudioTask::_resultId = 0;
+volatile bool AudioTask::_running = false;
+volatile bool AudioTask::_streaming = false;
+volatile uint32_t AudioTask::_bitRate = 0;
+bool AudioTask::_starved = false;
+bool AudioTask::_buffering = false;
+bool AudioTask::_bufferStarted = false;
+volatile bool AudioTask::_paused = false;
+uint32_t AudioTask::_loops = 0;
+uint32_t AudioTask::_lateLoops = 0;
+uint32_t AudioTask::_underruns = 0;
+uint32_t AudioTask::_maxGap = 0;
+volatile uint32_t AudioTask::_rebuffers = 0;
+
+void AudioTask::init() {
+	audio.setPinout(PIN_I2S_BCLK, PIN_I2S_LRC, PIN_I2S_DOUT);
+	audio.setVolume(21); // 0...21
+	Mixer::init();
+	Synth::init();
+	StreamBuffer::init();
+	Mixer::setVolume(21);
+	_queue = xQueueCreate(AUDIO_QUEUE_LENGTH, sizeof(AUDIO_COMMAND));
+	_done = xSemaphoreCreateBinary();
+	xTaskCreatePinnedToCore(_task, "audio", AUDIO_TASK_STACK, nullptr, AUDIO_TASK_PRIORITY, nullptr, AUDIO_TASK_CORE);
+}
+
+void AudioTask::_task(void *arg) {
+	uint32_t last = micros();
+	while (true) {
+		// 仕事がなければコマンドが来るまで長めに待つ
+		bool busy = _running || Mixer::isActive() || SoundCache::hasPending();
+		AUDIO_COMMAND cmd;
+		TickType_t wait = busy ? 1 : pdMS_TO_TICKS(AUDIO_TASK_IDLE_WAIT);
+		while (xQueueReceive(_queue, &cmd, wait) == pdTRUE) {
+			uint32_t id = 0;
+			_result = _execute(&cmd, &id);
+			_resultId = id;
+			xSemaphoreGive(_done);
+			wait = 0;
+		}
+
+		if (_buffering)
+			_bufferProcess();
+		uint32_t now = micros();
+		uint32_t gap = now - last;
+		last = now;
+		uint32_t cycles = Profiler::start();
+		audio.loop();
+		Profiler::record(PROFILE_AUDIO, cycles);
+		bool running = audio.isRunning();
+		if (_buffering && _bufferStarted && !running && !_paused)
+			_endStream();
+		// 溜めている間と一時停止中も再生中として扱う
+		bool waiting = _buffering && (_paused || !_bufferStarted);
+		if (waiting)
+			running = true;
+		if (running) {
+			// ループの間隔がDMAバッファの長さを超えると出力が途切れる
+			_loops++;
+			if (gap > _maxGap)
+				_maxGap = gap;
+			if (gap > AUDIO_DMA_BUFFER_MS * 1000)
+				_lateLoops++;
+			// ストリームの受信が追いつかず入力バッファが空になった
+			bool empty = _streaming && !waiting && audio.inBufferFilled() == 0 &&
+				(!_buffering || StreamBuffer::state() != STREAM_COMPLETE);
+			if (empty && !_starved)
+				_underruns++;
+			_starved = empty;
+			_bitRate = audio.getBitRate();
+		}
+		// 再生の終わりをメインループに知らせる
+		if (running != _running) {
+			if (!running)
+				Trace::record(TRACE_AUDIO_STOP, 1);
+			EventLoop::post(EVENT_AUDIO);
+		}
+		_running = running;
+		if (!running) {
+			Mixer::pump();
+			if (!Mixer::isActive())
+				SoundCache::process();
+		}
+	}
+}
+
+int AudioTask::_execute(const AUDIO_COMMAND *cmd, uint32_t *id) {
+	switch (cmd->type) {
+	case AUDIO_PLAY_FILE:
+	case AUDIO_PLAY_CACHE:
+	case AUDIO_PLAY_HOST:
+	case AUDIO_PLAY_STREAM:
+		audio.stopSong();
+		_endStream();
+		SoundCache::cancelDecode();
+		Mixer::pause();
+		Mixer::resetStreamTime();
+		_streaming = cmd->type == AUDIO_PLAY_HOST || cmd->type == AUDIO_PLAY_STREAM;
+		_bitRate = 0;
+		_starved = false;
+		if (cmd->type == AUDIO_PLAY_STREAM && StreamBuffer::begin(cmd->path, cmd->value != 0)) {
+			// 再生はバッファに溜まってから_bufferProcess()で始める
+			_buffering = true;
+			_bufferStarted = false;
+			_running = true;
+			Trace::record(TRACE_AUDIO_START, cmd->type, 1);
+			return CD_SUCCESS;
+		}
+		if (_streaming)
+			_running = audio.connecttohost(cmd->path);
+		else
+			_running = audio.connecttoFS(cmd->type == AUDIO_PLAY_CACHE ? SoundCache::fs() : LittleFS, cmd->path);
+		Trace::record(TRACE_AUDIO_START, cmd->type, _running);
+		return _running ? CD_SUCCESS : CD_FILE_IO_ERROR;
+	case AUDIO_STOP:
+		Trace::record(TRACE_AUDIO_STOP, 0);
+		audio.stopSong();
+		_endStream();
+		_running = false;
+		return CD_SUCCESS;
+	case AUDIO_VOLUME:
+		audio.setVolume(cmd->value);
+		Mixer::setVolume(cmd->value);
+		return CD_SUCCESS;
+	case AUDIO_MIX_PLAY:
+		return Mixer::play(cmd->path, cmd->value, id);
+	case AUDIO_MIX_CHAIN:
+		return Mixer::chain(cmd->id, cmd->path, cmd->value);
+	case AUDIO_MIX_STOP:
+		Mixer::stop(cmd->path[0] != 0 ? cmd->path : nullptr);
+		return CD_SUCCESS;
+	case AUDIO_TONE:
+		Synth::play((const SYNTH_SEQUENCE*)cmd->data);
+		return CD_SUCCESS;
+	case AUDIO_CANCEL_DECODE:
+		SoundCache::cancelDecode();
+		return CD_SUCCESS;
+	}
+	return CD_ERROR;
+}
+
+void AudioTask::_bufferProcess() {
+	StreamBufferState state = StreamBuffer::state();
+	if (!_bufferStarted) {
+		if (state == STREAM_FAILED) {
+			// 長さが分からないなどで溜められなければAudioに直接任せる
+			char url[HTTP_CACHE_URL_LENGTH];
+			strcpy(url, StreamBuffer::url());
+			_endStream();
+			_running = audio.connecttohost(url);
+			return;
+		}
+		if (StreamBuffer::ready()) {
+			_bufferStarted = true;
+			if (!audio.connecttoFS(StreamBuffer::fs(), STREAM_BUFFER_PATH)) {
+				_endStream();
+				_running = false;
+			}
+		}
+		return;
+	}
+	uint32_t buffered = audio.inBufferFilled() + StreamBuffer::ahead();
+	if (state == STREAM_FAILED) {
+		// 受信が途中で切れたら、届いた所まで再生して止める
+		if (buffered == 0 || _paused) {
+			audio.stopSong();
+			_endStream();
+			_running = false;
+		}
+		return;
+	}
+	if (!_paused) {
+		if (state == STREAM_RECEIVING && buffered < StreamBuffer::lowWater()) {
+			// 途切れる前に一時停止して溜め直す
+			if (audio.pauseResume()) {
+				_paused = true;
+				_rebuffers++;
+			}
+		}
+	} else if (state == STREAM_COMPLETE || buffered >= StreamBuffer::target()) {
+		audio.pauseResume();
+		_paused = false;
+	}
+}
+
+void AudioTask::_endStream() {
+	if (!_buffering)
+		return;
+	_buffering = false;
+	_bufferStarted = false;
+	_paused = false;
+	StreamBuffer::end();
+}
+
+int AudioTask::_request(AudioCommandType type, const char *path, uint8_t value, uint32_t id, uint32_t *resultId,
+	const void *data) {
+	AUDIO_COMMAND cmd;
+	cmd.type = type;
+	cmd.path[0] = 0;
+	if (path != nullptr) {
+		strncpy(cmd.path, path, sizeof(cmd.path));
+		cmd.path[sizeof(cmd.path)-1] = 0;
+	}
+	cmd.value = value;
+	cmd.id = id;
+	cmd.data = data;
+	// 要求を出すのはメインループだけなので、完了を待てば結果は自分のもの
+	if (xQueueSend(_queue, &cmd, portMAX_DELAY) != pdTRUE)
+		return CD_ERROR;
+	xSemaphoreTake(_done, portMAX_DELAY);
+	if (resultId != nullptr)
+		*resultId = _resultId;
+	return _result;
+}
+
+int AudioTask::playFile(const char *path, bool cached) {
+	return _request(cached ? AUDIO_PLAY_CACHE : AUDIO_PLAY_FILE, path, 0, 0, nullptr);
+}
+
+int AudioTask::playHost(const char *url) {
+	return _request(AUDIO_PLAY_HOST, url, 0, 0, nullptr);
+}
+
+int AudioTask::playStream(const char *url, bool store) {
+	return _request(AUDIO_PLAY_STREAM, url, store ? 1 : 0, 0, nullptr);
+}
+
+void AudioTask::stop() {
+	_request(AUDIO_STOP, nullptr, 0, 0, nullptr);
+}
+
+void AudioTask::setVolume(uint8_t volume) {
+	_request(AUDIO_VOLUME, nullptr, volume, 0, nullptr);
+}
+
+int AudioTask::mixPlay(const char *path, uint8_t gain, uint32_t *id) {
+	return _request(AUDIO_MIX_PLAY, path, gain, 0, id);
+}
+
+int AudioTask::mixChain(uint32_t id, const char *path, uint8_t gain) {
+	return _request(AUDIO_MIX_CHAIN, path, gain, id, nullptr);
+}
+
+void AudioTask::mixStop(const char *path) {
+	_request(AUDIO_MIX_STOP, path, 0, 0, nullptr);
+}
+
+void AudioTask::tone(const SYNTH_SEQUENCE *sequence) {
+	_request(AUDIO_TONE, nullptr, 0, 0, nullptr, sequence);
+}
+
+// 完了を待つので、戻った後はデコーダがキャッシュのデータを読んでいない
+void AudioTask::cancelDecode() {
+	_request(AUDIO_CANCEL_DECODE, nullptr, 0, 0, nullptr);
+}
+
+void AudioTask::resetStats() {
+	_loops = 0;
+	_lateLoops = 0;
+	_underruns = 0;
+	_maxGap = 0;
+	_rebuffers = 0;
+}
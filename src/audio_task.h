@@ -0,0 +1,90 @@
+//
+// Created by agent on 2026/10/19.
+//
+
+#ifndef SLAPPYBELL_FIRMWARE_AUDIO_TASK_H
+#define SLAPPYBELL_FIRMWARE_AUDIO_TASK_H
+
+#include <Arduino.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include "config.h"
+#include "synth.h"
+
+enum AudioCommandType {
+	AUDIO_PLAY_FILE,		// LittleFSのファイル
+	AUDIO_PLAY_CACHE,		// SoundCacheのファイル
+	AUDIO_PLAY_HOST,		// http://
+	AUDIO_PLAY_STREAM,		// http://をStreamBufferに溜めてから再生
+	AUDIO_STOP,
+	AUDIO_VOLUME,
+	AUDIO_MIX_PLAY,
+	AUDIO_MIX_CHAIN,
+	AUDIO_MIX_STOP,
+	AUDIO_TONE,
+	AUDIO_CANCEL_DECODE,	// SoundCacheの待機中のデコードを止める
+};
+
+typedef struct _AUDIO_COMMAND {
+	AudioCommandType	type;
+	char				path[80];
+	uint8_t				value;		// 音量またはゲイン
+	uint32_t			id;			// ミキサのボイス
+	const void*			data;		// 完了を待つ間だけ有効
+} AUDIO_COMMAND;
+
+// Audio::loop()とミキサを専用のタスクで動かす
+// 再生の操作はコマンドキューで渡し、完了を待って結果を返す
+class AudioTask {
+private:
+	static QueueHandle_t _queue;
+	static SemaphoreHandle_t _done;
+	static volatile int _result;
+	static volatile uint32_t _resultId;
+	static volatile bool _running;
+	static volatile bool _streaming;
+	static volatile uint32_t _bitRate;
+	static bool _starved;
+	static bool _buffering;
+	static bool _bufferStarted;
+	static volatile bool _paused;
+
+	static uint32_t _loops;
+	static uint32_t _lateLoops;
+	static uint32_t _underruns;
+	static uint32_t _maxGap;
+	static volatile uint32_t _rebuffers;
+
+	static void _task(void *arg);
+	static int _execute(const AUDIO_COMMAND *cmd, uint32_t *id);
+	static void _bufferProcess();
+	static void _endStream();
+	static int _request(AudioCommandType type, const char *path, uint8_t value, uint32_t id, uint32_t *resultId,
+		const void *data = nullptr);
+public:
+	static void init();
+	static bool isRunning() { return _running; }
+	static bool isStreaming() { return _running && _streaming; }
+	static bool isRebuffering() { return _paused; }
+	static uint32_t bitRate() { return _bitRate; }
+
+	static int playFile(const char *path, bool cached);
+	static int playHost(const char *url);
+	static int playStream(const char *url, bool store = false);
+	static void stop();
+	static void setVolume(uint8_t volume);
+	static int mixPlay(const char *path, uint8_t gain, uint32_t *id);
+	static int mixChain(uint32_t id, const char *path, uint8_t gain);
+	static void mixStop(const char *path = nullptr);
+	static void tone(const SYNTH_SEQUENCE *sequence);
+	static void cancelDecode();
+
+	static uint32_t loops() { return _loops; }
+	static uint32_t lateLoops() { return _lateLoops; }
+	static uint32_t underruns() { return _underruns; }
+	static uint32_t maxGap() { return _maxGap; }
+	static uint32_t rebuffers() { return _rebuffers; }
+	static void resetStats();
+};
+
+#endif //SLAPPYBELL_FIRMWARE_AUDIO_TASK_H
@@ -0,0 +1,189 @@
+//
+// Created by agent on 2026/10/19.
+//
+
+#include <Arduino.h>
+#include <esp_partition.h>
+
+#include "bundle.h"
+#include "config.h"
+#include "mp3_index.h"
+
+#define BUNDLE_MAGIC	0x314E4253	// "SBN1"
+
+const esp_partition_t *Bundle::_partition = nullptr;
+spi_flash_mmap_handle_t Bundle::_handle;
+const uint8_t *Bundle::_data = nullptr;
+bool Bundle::_mapped = false;
+bool Bundle::_valid = false;
+uint32_t Bundle::_size = 0;
+uint32_t Bundle::_written = 0;
+uint32_t Bundle::_erased = 0;
+uint32_t Bundle::_magic = 0;
+uint32_t Bundle::_duration[BUNDLE_MAX_ENTRIES];
+int Bundle::_playable = 0;
+
+void Bundle::init() {
+	_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+		(esp_partition_subtype_t)BUNDLE_PARTITION_SUBTYPE, BUNDLE_PARTITION_LABEL);
+	_map();
+}
+
+void Bundle::_map() {
+	_valid = false;
+	if (_partition == nullptr)
+		return;
+	if (!_mapped) {
+		const void *ptr;
+		if (esp_partition_mmap(_partition, 0, _partition->size, SPI_FLASH_MMAP_DATA, &ptr, &_handle) != ESP_OK)
+			return;
+		_data = (const uint8_t*)ptr;
+		_mapped = true;
+	}
+	_valid = _check();
+	_scan();
+}
+
+void Bundle::_unmap() {
+	_valid = false;
+	_playable = 0;
+	if (_mapped) {
+		spi_flash_munmap(_handle);
+		_mapped = false;
+		_data = nullptr;
+	}
+}
+
+// 壊れたバンドルを読まないよう、目次がすべてパーティションに収まるか確かめる
+bool Bundle::_check() {
+	const BUNDLE_HEADER *header = (const BUNDLE_HEADER*)_data;
+	if (header->magic != BUNDLE_MAGIC || header->count > BUNDLE_MAX_ENTRIES || header->size > _partition->size)
+		return false;
+	uint32_t dataStart = sizeof(BUNDLE_HEADER) + header->count * sizeof(BUNDLE_ENTRY);
+	if (dataStart > header->size)
+		return false;
+	const BUNDLE_ENTRY *e = (const BUNDLE_ENTRY*)(_data + sizeof(BUNDLE_HEADER));
+	for (uint32_t i = 0; i < header->count; i++, e++) {
+		if (memchr(e->name, 0, sizeof(e->name)) == nullptr || e->name[0] == 0)
+			return false;
+		if (e->offset < dataStart || e->offset > header->size || e->size > header->size - e->offset)
+			return false;
+	}
+	return true;
+}
+
+// フラッシュから直接読めるので、フレームヘッダだけを拾って再生時間を求める
+void Bundle::_scan() {
+	_playable = 0;
+	int n = count();
+	for (int i = 0; i < n; i++) {
+		const BUNDLE_ENTRY *e = entry(i);
+		Mp3Scanner scanner;
+		bool success = scanner.feed(data(e), e->size) && scanner.finish();
+		_duration[i] = success ? scanner.info().duration : 0;
+		if (_duration[i] != 0)
+			_playable++;
+	}
+}
+
+size_t Bundle::size() {
+	return _valid ? ((const BUNDLE_HEADER*)_data)->size : 0;
+}
+
+int Bundle::count() {
+	return _valid ? (int)((const BUNDLE_HEADER*)_data)->count : 0;
+}
+
+const BUNDLE_ENTRY *Bundle::entry(int index) {
+	if (index < 0 || index >= count())
+		return nullptr;
+	return (const BUNDLE_ENTRY*)(_data + sizeof(BUNDLE_HEADER)) + index;
+}
+
+uint32_t Bundle::duration(int index) {
+	if (index < 0 || index >= count())
+		return 0;
+	return _duration[index];
+}
+
+// pathは内蔵ストレージと同じく"/"で始まる名前
+// 再生できないファイルは見つからないものとする
+const BUNDLE_ENTRY *Bundle::find(const char *path) {
+	if (*path == '/')
+		path++;
+	int n = count();
+	for (int i = 0; i < n; i++) {
+		const BUNDLE_ENTRY *e = entry(i);
+		if (strcmp(e->name, path) == 0)
+			return _duration[i] != 0 ? e : nullptr;
+	}
+	return nullptr;
+}
+
+// 今のバンドルを無効にして書き込みを始める
+// 呼ぶ前にバンドルのデータを使っている再生をすべて止めておくこと
+bool Bundle::begin(size_t size) {
+	if (_partition == nullptr || size < sizeof(BUNDLE_HEADER) || size > _partition->size)
+		return false;
+	_unmap();
+	_size = size;
+	_written = 0;
+	_erased = 0;
+	_magic = 0;
+	// 先頭を消しておけば、途中で止まっても古いバンドルとして読まれない
+	if (esp_partition_erase_range(_partition, 0, BUNDLE_SECTOR_SIZE) != ESP_OK)
+		return false;
+	_erased = BUNDLE_SECTOR_SIZE;
+	return true;
+}
+
+// 受信したデータを順に書き込む
+// 消去は書き込む直前のセクタだけ行い、一度に長く止まらないようにする
+bool Bundle::write(const uint8_t *buf, size_t size) {
+	if (size > _size - _written)
+		return false;
+	// マジックは最後に書くので、ここでは覚えておくだけ
+	while (_written < sizeof(uint32_t) && size > 0) {
+		_magic |= (uint32_t)*buf++ << (_written * 8);
+		_written++;
+		size--;
+	}
+	if (size == 0)
+		return true;
+	uint32_t end = _written + size;
+	if (end > _erased) {
+		uint32_t erase = (end - _erased + BUNDLE_SECTOR_SIZE - 1) / BUNDLE_SECTOR_SIZE * BUNDLE_SECTOR_SIZE;
+		if (esp_partition_erase_range(_partition, _erased, erase) != ESP_OK)
+			return false;
+		_erased += erase;
+	}
+	if (esp_partition_write(_partition, _written, buf, size) != ESP_OK)
+		return false;
+	_written = end;
+	return true;
+}
+
+bool Bundle::commit() {
+	if (_written != _size || _magic != BUNDLE_MAGIC ||
+		esp_partition_write(_partition, 0, &_magic, sizeof(_magic)) != ESP_OK) {
+		abort();
+		return false;
+	}
+	_map();
+	// 目次が壊れていたり再生できないファイルがあれば、次の起動でも読まれないように消しておく
+	if (!_valid || size() != _size || _playable != count()) {
+		abort();
+		return false;
+	}
+	return true;
+}
+
+void Bundle::abort() {
+	_unmap();
+	if (_partition != nullptr)
+		esp_partition_erase_range(_partition, 0, BUNDLE_SECTOR_SIZE);
+	_size = 0;
+	_written = 0;
+	_erased = 0;
+	_map();
+}
@@ -0,0 +1,67 @@
+//
+// Created by agent on 2026/10/19.
+//
+
+#ifndef SLAPPYBELL_FIRMWARE_BUNDLE_H
+#define SLAPPYBELL_FIRMWARE_BUNDLE_H
+
+#include <Arduino.h>
+#include <esp_partition.h>
+#include "config.h"
+
+// バンドルの先頭
+// この後にcount個のBUNDLE_ENTRYと、各mp3ファイルのデータが続く
+typedef struct _BUNDLE_HEADER {
+	uint32_t	magic;
+	uint32_t	count;
+	uint32_t	size;			// ヘッダを含む全体のバイト数
+	uint32_t	reserved;
+} BUNDLE_HEADER;
+
+typedef struct _BUNDLE_ENTRY {
+	char		name[32];		// "sound1.mp3"
+	uint32_t	offset;			// バンドルの先頭から
+	uint32_t	size;
+} BUNDLE_ENTRY;
+
+// 専用のパーティションに書き込んだmp3ファイルの束
+// パーティションをメモリにマップし、ファイルシステムを通さずにフラッシュから直接読み出す
+// 書き込みは先頭から順に行い、最後に先頭のマジックを書いて有効にする
+// マップした時点で各ファイルをMp3Scannerで調べ、再生できないファイルは使わない
+class Bundle {
+private:
+	static const esp_partition_t *_partition;
+	static spi_flash_mmap_handle_t _handle;
+	static const uint8_t *_data;		// マップしたパーティション
+	static bool _mapped;
+	static bool _valid;
+	static uint32_t _size;				// 書き込み中のバンドルの大きさ
+	static uint32_t _written;
+	static uint32_t _erased;
+	static uint32_t _magic;
+	static uint32_t _duration[BUNDLE_MAX_ENTRIES];	// ms (再生できないファイルは0)
+	static int _playable;
+
+	static void _map();
+	static void _unmap();
+	static bool _check();
+	static void _scan();
+public:
+	static void init();
+	static bool available() { return _partition != nullptr; }
+	static size_t capacity() { return _partition != nullptr ? _partition->size : 0; }
+	static bool valid() { return _valid; }
+	static size_t size();
+	static int count();
+	static const BUNDLE_ENTRY *entry(int index);
+	static uint32_t duration(int index);
+	static const BUNDLE_ENTRY *find(const char *path);
+	static const uint8_t *data(const BUNDLE_ENTRY *entry) { return _data + entry->offset; }
+
+	static bool begin(size_t size);
+	static bool write(const uint8_t *buf, size_t size);
+	static bool commit();
+	static void abort();
+};
+
+#endif //SLAPPYBELL_FIRMWARE_BUNDLE_H
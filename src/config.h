@@ -22,6 +22,9 @@
 #define PRODUCT_VERSION "1.2.0"
 
 #define SLOT_COUNT		6
+#define MAX_SLOT_COUNT	32
+#define MAX_PIXEL_COUNT	300
+#define LED_FRAME_INTERVAL	20
 
 #define PIN_NEOPIXEL	D3
 #define PIN_I2S_BCLK	D9
@@ -35,11 +38,109 @@
 
 #define SERIAL_BUFFER_SIZE 128
 #define BLE_MTU_SIZE       (128+3)
+#define TRANSPORT_COUNT    2
+#define TRANSPORT_SIZE_BUCKETS 9	// 1回の受信サイズのヒストグラム 最後は256バイト以上
 #define RECEIVE_BUFFER_SIZE 4096
 #define RECEIVE_BUFFER_OVERFLOW_SIZE 256
 #define MESSAGE_BUFFER_SIZE 256
 #define DATA_CHUNK_TIMEOUT 2000
 
+#define MANIFEST_ENTRIES	64		// 一覧を一度に広げる数
+#define MANIFEST_BLOCK_SIZE	4096	// LittleFSのブロックサイズ
+#define MANIFEST_DIR		"/.manifest"
+#define MANIFEST_HASH_SIZE	32		// SHA-256
+
+#define UPLOAD_TEMP_DIR		"/.upload"
+#define UPLOAD_TEMP_PATH	UPLOAD_TEMP_DIR "/data"
+#define UPLOAD_EXTRA_BLOCKS	3		// インデックスと包絡線、rename時のメタデータ用
+
+#define SOUND_CACHE_ENTRIES	64
+#define SOUND_CACHE_SIZE	(4*1024*1024)
+#define SOUND_CACHE_REQUESTS	8	// 再生タスクで読み込むのを待っているファイルの数
+#define PCM_CACHE_MAX_SIZE	(1024*1024)
+
+#define BUNDLE_PARTITION_LABEL		"bundle"
+#define BUNDLE_PARTITION_SUBTYPE	0x40
+#define BUNDLE_MAX_ENTRIES			128
+#define BUNDLE_SECTOR_SIZE			4096
+#define PCM_DECODE_FRAMES	2
+
+#define AUDIO_TASK_CORE		0
+#define AUDIO_TASK_PRIORITY	19		// lwIP(18)より上、Wi-Fi(23)より下
+#define AUDIO_TASK_STACK	8192
+#define AUDIO_TASK_IDLE_WAIT 20
+#define AUDIO_QUEUE_LENGTH	4
+#define AUDIO_DMA_BUFFER_MS	46		// I2SのDMAバッファに溜まる音声の長さ(ms)
+
+#define EVENT_LOOP_ACTIVE_INTERVAL	10		// 再生中などに状態を見に行く間隔(ms)
+#define EVENT_LOOP_MAX_WAIT			1000	// イベントがなくても起きる間隔(ms)
+
+#define TIMER_WHEEL_TICK			10		// ms
+#define TIMER_WHEEL_SLOTS			256		// 2のべき乗 1周 = 2.56秒
+#define DELAYED_PLAY_ENTRIES		4
+#define TIMER_WHEEL_SYSTEM_TIMERS	5		// Wi-Fiの再接続・停止・起こして再生、アップロード、シリアルの切断
+// LEDのTTLと遅延再生で表が埋まっても、決まった用途のタイマーは必ず登録できる数にする
+#define TIMER_WHEEL_ENTRIES			(MAX_SLOT_COUNT + DELAYED_PLAY_ENTRIES + TIMER_WHEEL_SYSTEM_TIMERS)	// 255以下
+#define DELAYED_PLAY_MAX_DELAY		3600000	// ms
+#define LED_TTL_MAX					86400000	// ms
+#define WIFI_RETRY_INTERVAL			1000	// 最初の再接続までの時間(ms) 失敗するごとに倍にする
+#define WIFI_RETRY_MAX				60000	// ms
+#define WIFI_RETRY_JITTER			25		// 間隔を前後に揺らす割合(%)
+#define WIFI_IDLE_TIMEOUT			300000	// 使わなくなってからWi-Fiを止めるまでの時間(ms)
+#define WIFI_WAKE_TIMEOUT			15000	// 止めたWi-Fiを再生のために起こして待つ時間(ms)
+#define SERIAL_DISCONNECT_GRACE		1000	// ms
+
+#define PROFILE_BUCKETS				16		// 所要時間のヒストグラム 最後は16ms以上
+#define PROFILE_CLOCKS				3		// 記録を分けるCPUクロックの数(80/160/240MHz)
+#define TRACE_ENTRIES				256		// 出来事の記録の数 2の累乗にする
+
+#define CPU_GOVERNOR_INTERVAL		100		// 負荷を見直す間隔(ms)
+#define CPU_GOVERNOR_HOLD			2000	// クロックを下げるまでの時間(ms)
+#define CPU_GOVERNOR_BUSY_HIGH		60		// メインループ使用率(%)
+#define CPU_GOVERNOR_BUSY_MIDDLE	20
+#define CPU_GOVERNOR_RECEIVE_HIGH	25		// 受信バッファ使用率(%)
+#define CPU_GOVERNOR_HIGH_BITRATE	128000
+
+#define MP3_INDEX_DIR			"/.index"
+#define MP3_INDEX_SEEK_ENTRIES	32
+#define MP3_INDEX_SEEK_INTERVAL	38		// 約1秒
+#define MP3_SCAN_MAX_JUNK		4096	// 許容するフレーム以外のデータ(バイト)
+
+#define ENVELOPE_INTERVAL		20		// 包絡線の間隔(ms)
+#define ENVELOPE_MAX_POINTS		1500	// 30秒分
+#define ENVELOPE_FILE_MAX_SIZE	(1024*1024)	// キャッシュにないファイルから包絡線を作る大きさの上限
+
+#define MIXER_VOICES		4
+#define MIXER_SAMPLE_RATE	44100
+#define MIXER_BLOCK_FRAMES	256
+
+#define PLAY_QUEUE_LENGTH	8
+
+#define SYNTH_VOICES			2
+#define SYNTH_MAX_NOTES			32
+#define SYNTH_DEFAULT_NOTE_TIME	200
+#define SYNTH_MAX_NOTE_TIME		10000
+
+#define HTTP_CACHE_DIR			"/http"
+#define HTTP_CACHE_TEMP			HTTP_CACHE_DIR "/download"
+#define HTTP_CACHE_ENTRIES		16
+#define HTTP_CACHE_SIZE			(256*1024)
+#define HTTP_CACHE_MAX_FILE_SIZE	(128*1024)
+#define HTTP_CACHE_URL_LENGTH	80
+#define HTTP_CACHE_ETAG_LENGTH	64
+#define HTTP_CACHE_DATE_LENGTH	32
+#define HTTP_CACHE_TIMEOUT		5000
+
+#define STREAM_BUFFER_PATH		"/stream.mp3"
+#define STREAM_BUFFER_MAX_SIZE	(1024*1024)
+#define STREAM_PREBUFFER_MS		1000	// 再生前に溜める長さの初期値(ms)
+#define STREAM_LOW_WATER_MS		250		// これより減ったら一時停止して溜め直す(ms)
+#define STREAM_DEFAULT_BITRATE	128000	// 最初のフレームが届くまでの仮のビットレート
+#define STREAM_MEASURE_INTERVAL	250		// 受信速度を測る間隔(ms)
+#define STREAM_JITTER_DECAY_STEP	100		// 受信の途切れをこの時間ごとに1/16ずつ減らす(ms)
+
+#define PREFERENCES_NAMESPACE "slappybell"
+
 #define RESPONSE_PREFIX "[R@APM]"
 #define NOTIFY_PREFIX "[N@APM]"
 
@@ -0,0 +1,141 @@
+//
+// Created by agent on 2026/10/19.
+//
+
+#include "cpu_governor.h"
+#include "profiler.h"
+
+CpuLevel CpuGovernor::_level = CPU_LEVEL_MIDDLE;
+CpuLevel CpuGovernor::_target = CPU_LEVEL_MIDDLE;
+const char *CpuGovernor::_reason = "init";
+uint32_t CpuGovernor::_lastSample = 0;
+uint32_t CpuGovernor::_lastChange = 0;
+uint32_t CpuGovernor::_lowSince = 0;
+uint32_t CpuGovernor::_busy = 0;
+uint8_t CpuGovernor::_utilisation = 0;
+uint32_t CpuGovernor::_switches = 0;
+uint32_t CpuGovernor::_levelTime[CPU_LEVEL_COUNT];
+
+static const uint32_t levelFrequency[CPU_LEVEL_COUNT] = { 80, 160, 240 };
+
+void CpuGovernor::init(uint32_t now) {
+	_level = CPU_LEVEL_MIDDLE;
+	_target = CPU_LEVEL_MIDDLE;
+	setCpuFrequencyMhz(levelFrequency[_level]);
+	Profiler::setFrequency(levelFrequency[_level]);
+	_lastSample = now;
+	_lowSince = now;
+	resetStats(now);
+}
+
+uint32_t CpuGovernor::frequency(CpuLevel level) {
+	return levelFrequency[level];
+}
+
+void CpuGovernor::_apply(uint32_t now, CpuLevel level) {
+	if (level == _level)
+		return;
+	_levelTime[_level] += now - _lastChange;
+	_lastChange = now;
+	_level = level;
+	_switches++;
+	setCpuFrequencyMhz(levelFrequency[level]);
+	Profiler::setFrequency(levelFrequency[level]);
+}
+
+// 再生開始の直後はデコーダの準備で負荷が高いので、先に最大にしておく
+void CpuGovernor::boost(uint32_t now) {
+	_target = CPU_LEVEL_HIGH;
+	_reason = "boost";
+	_lowSince = now;
+	_apply(now, CPU_LEVEL_HIGH);
+}
+
+CpuLevel CpuGovernor::_decide(const CPU_LOAD *load) {
+	if (load->streaming) {
+		_reason = "stream";
+		return CPU_LEVEL_HIGH;
+	}
+	// mp3のデコード中はビットレートによらず下げない(160MHzでは途切れることがある)
+	// ビットレートはstatsで負荷の理由を見分けるために使う
+	if (load->decoding) {
+		_reason = load->bitRate >= CPU_GOVERNOR_HIGH_BITRATE ? "bitrate" : "decode";
+		return CPU_LEVEL_HIGH;
+	}
+	if (load->uploading) {
+		_reason = "upload";
+		return CPU_LEVEL_HIGH;
+	}
+	if (load->receiveFill >= CPU_GOVERNOR_RECEIVE_HIGH) {
+		_reason = "receive";
+		return CPU_LEVEL_HIGH;
+	}
+	if (_utilisation >= CPU_GOVERNOR_BUSY_HIGH) {
+		_reason = "busy";
+		return CPU_LEVEL_HIGH;
+	}
+	// PCMや合成音はデコードが要らないので、ミキサだけなら160MHzで足りる
+	if (load->mixing) {
+		_reason = "mix";
+		return CPU_LEVEL_MIDDLE;
+	}
+	if (load->converting) {
+		_reason = "convert";
+		return CPU_LEVEL_MIDDLE;
+	}
+	if (load->receiveFill > 0) {
+		_reason = "receive";
+		return CPU_LEVEL_MIDDLE;
+	}
+	if (_utilisation >= CPU_GOVERNOR_BUSY_MIDDLE) {
+		_reason = "busy";
+		return CPU_LEVEL_MIDDLE;
+	}
+	_reason = "idle";
+	return CPU_LEVEL_LOW;
+}
+
+void CpuGovernor::update(uint32_t now, const CPU_LOAD *load) {
+	uint32_t elapsed = now - _lastSample;
+	if (elapsed == 0)
+		return;
+	uint32_t util = _busy / 10 / elapsed;	// us / (ms * 1000) * 100
+	_utilisation = util > 100 ? 100 : (uint8_t)util;
+	_busy = 0;
+	_lastSample = now;
+
+	_target = _decide(load);
+	if (_target > _level) {
+		_lowSince = now;
+		_apply(now, _target);
+	} else if (_target == _level) {
+		_lowSince = now;
+	} else if (now - _lowSince >= CPU_GOVERNOR_HOLD) {
+		// 低い負荷が続いたので1段だけ下げる
+		_lowSince = now;
+		_apply(now, (CpuLevel)(_level - 1));
+	}
+}
+
+// 次に負荷を見直すまでの時間(ms)
+// 最低のクロックで落ち着いている間は、何か起きるまで見直さない
+uint32_t CpuGovernor::next(uint32_t now) {
+	if (_level == CPU_LEVEL_LOW && _target == CPU_LEVEL_LOW)
+		return UINT32_MAX;
+	uint32_t elapsed = now - _lastSample;
+	return elapsed < CPU_GOVERNOR_INTERVAL ? CPU_GOVERNOR_INTERVAL - elapsed : 0;
+}
+
+uint32_t CpuGovernor::levelTime(uint32_t now, CpuLevel level) {
+	uint32_t t = _levelTime[level];
+	if (level == _level)
+		t += now - _lastChange;
+	return t;
+}
+
+void CpuGovernor::resetStats(uint32_t now) {
+	for (int i = 0; i < CPU_LEVEL_COUNT; i++)
+		_levelTime[i] = 0;
+	_lastChange = now;
+	_switches = 0;
+}
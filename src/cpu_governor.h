@@ -0,0 +1,63 @@
+//
+// Created by agent on 2026/10/19.
+//
+
+#ifndef SLAPPYBELL_FIRMWARE_CPU_GOVERNOR_H
+#define SLAPPYBELL_FIRMWARE_CPU_GOVERNOR_H
+
+#include <Arduino.h>
+#include "config.h"
+
+// 周波数を決めるための負荷の情報
+typedef struct _CPU_LOAD {
+	bool		decoding;		// mp3をデコード中
+	bool		streaming;		// http://から再生中
+	uint32_t	bitRate;		// 再生中のmp3のビットレート(bps)
+	bool		mixing;			// ミキサが音を出している
+	bool		converting;		// 待機中のPCM変換や包絡線の作成が残っている
+	bool		uploading;
+	uint8_t		receiveFill;	// 受信バッファの使用率(%)
+} CPU_LOAD;
+
+enum CpuLevel {
+	CPU_LEVEL_LOW,			// 80MHz
+	CPU_LEVEL_MIDDLE,		// 160MHz
+	CPU_LEVEL_HIGH,			// 240MHz
+	CPU_LEVEL_COUNT,
+};
+
+// メインループの使用率と処理待ちの仕事からCPUクロックを選ぶ
+// 上げるときはすぐに、下げるときは一定時間低い負荷が続いてから1段ずつ下げる
+class CpuGovernor {
+private:
+	static CpuLevel _level;
+	static CpuLevel _target;
+	static const char *_reason;
+	static uint32_t _lastSample;
+	static uint32_t _lastChange;
+	static uint32_t _lowSince;
+	static uint32_t _busy;
+	static uint8_t _utilisation;
+	static uint32_t _switches;
+	static uint32_t _levelTime[CPU_LEVEL_COUNT];
+
+	static void _apply(uint32_t now, CpuLevel level);
+	static CpuLevel _decide(const CPU_LOAD *load);
+public:
+	static void init(uint32_t now);
+	static void boost(uint32_t now);
+	static void addBusy(uint32_t us) { _busy += us; }
+	static bool due(uint32_t now) { return now - _lastSample >= CPU_GOVERNOR_INTERVAL; }
+	static uint32_t next(uint32_t now);
+	static void update(uint32_t now, const CPU_LOAD *load);
+
+	static uint32_t frequency(CpuLevel level);
+	static CpuLevel level() { return _level; }
+	static const char *reason() { return _reason; }
+	static uint8_t utilisation() { return _utilisation; }
+	static uint32_t switches() { return _switches; }
+	static uint32_t levelTime(uint32_t now, CpuLevel level);
+	static void resetStats(uint32_t now);
+};
+
+#endif //SLAPPYBELL_FIRMWARE_CPU_GOVERNOR_H
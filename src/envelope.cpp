@@ -0,0 +1,133 @@
+//
+// Created by agent on 2026/10/19.
+//
+
+#include <Arduino.h>
+#include <FS.h>
+#include <LittleFS.h>
+
+#include "config.h"
+#include "envelope.h"
+#include "manifest.h"
+
+#define ENVELOPE_MAGIC	0x454E5631	// "ENV1"
+
+char Envelope::_name[80];
+uint8_t Envelope::_level[ENVELOPE_MAX_POINTS];
+uint16_t Envelope::_count = 0;
+uint16_t Envelope::_interval = ENVELOPE_INTERVAL;
+
+void EnvelopeBuilder::begin() {
+	_window = 0;
+	_sum = 0;
+	_samples = 0;
+	_count = 0;
+}
+
+void EnvelopeBuilder::add(const int16_t *samples, int count, uint32_t sampleRate) {
+	if (_window == 0)
+		_window = sampleRate * ENVELOPE_INTERVAL / 1000;
+	for (int i = 0; i < count && _count < ENVELOPE_MAX_POINTS; i++) {
+		int32_t s = samples[i];
+		_sum += s < 0 ? -s : s;
+		if (++_samples == _window) {
+			_value[_count++] = (uint16_t)(_sum / _window);
+			_sum = 0;
+			_samples = 0;
+		}
+	}
+}
+
+bool EnvelopeBuilder::save(const char *path) {
+	if (_samples > 0 && _count < ENVELOPE_MAX_POINTS)
+		_value[_count++] = (uint16_t)(_sum / _samples);
+	// 一番大きい所を255にそろえる
+	uint16_t peak = 1;
+	for (int i = 0; i < _count; i++) {
+		if (_value[i] > peak)
+			peak = _value[i];
+	}
+	uint8_t level[64];
+	char envelopePath[48];
+	Envelope::makePath(path, envelopePath, sizeof(envelopePath));
+	File file = LittleFS.open(envelopePath, "w");
+	if (!file)
+		return false;
+	ENVELOPE_HEADER header;
+	header.magic = ENVELOPE_MAGIC;
+	header.interval = ENVELOPE_INTERVAL;
+	header.count = _count;
+	bool success = file.write((const uint8_t*)&header, sizeof(header)) == sizeof(header);
+	for (int i = 0; i < _count && success; i += sizeof(level)) {
+		int n = _count - i < (int)sizeof(level) ? _count - i : (int)sizeof(level);
+		for (int j = 0; j < n; j++)
+			level[j] = (uint8_t)((uint32_t)_value[i + j] * 255 / peak);
+		success = file.write(level, n) == (size_t)n;
+	}
+	file.close();
+	if (!success)
+		LittleFS.remove(envelopePath);
+	// 一覧にないファイルなので、使用量は調べ直してもらう
+	Manifest::invalidateUsage();
+	return success;
+}
+
+void Envelope::makePath(const char *path, char *envelopePath, size_t len) {
+	snprintf(envelopePath, len, MP3_INDEX_DIR "%s.env", path);
+}
+
+bool Envelope::exists(const char *path) {
+	char envelopePath[48];
+	makePath(path, envelopePath, sizeof(envelopePath));
+	return LittleFS.exists(envelopePath);
+}
+
+void Envelope::remove(const char *path) {
+	char envelopePath[48];
+	makePath(path, envelopePath, sizeof(envelopePath));
+	if (LittleFS.exists(envelopePath)) {
+		LittleFS.remove(envelopePath);
+		Manifest::invalidateUsage();
+	}
+	if (strcmp(path, _name) == 0)
+		follow(nullptr);
+}
+
+// 新しく追いかけ始めた音の包絡線が読めなかった場合だけfalseを返す
+bool Envelope::follow(const char *path) {
+	if (path == nullptr) {
+		_name[0] = 0;
+		_count = 0;
+		return true;
+	}
+	if (strcmp(path, _name) == 0)
+		return true;
+	strncpy(_name, path, sizeof(_name));
+	_name[sizeof(_name)-1] = 0;
+	_count = 0;
+
+	char envelopePath[48];
+	makePath(path, envelopePath, sizeof(envelopePath));
+	File file = LittleFS.open(envelopePath, "r");
+	if (!file)
+		return false;
+	ENVELOPE_HEADER header;
+	if (file.read((uint8_t*)&header, sizeof(header)) == sizeof(header) && header.magic == ENVELOPE_MAGIC &&
+		header.interval > 0 && header.count <= ENVELOPE_MAX_POINTS &&
+		file.read(_level, header.count) == header.count) {
+		_interval = header.interval;
+		_count = header.count;
+	}
+	file.close();
+	return _count > 0;
+}
+
+uint8_t Envelope::level(uint32_t position) {
+	uint32_t index = position / _interval;
+	if (index >= _count)
+		return 0;
+	// 点の間は直線で補間する
+	int32_t a = _level[index];
+	int32_t b = index + 1 < _count ? _level[index + 1] : 0;
+	return (uint8_t)(a + (b - a) * (int32_t)(position % _interval) / (int32_t)_interval);
+}
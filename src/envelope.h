@@ -0,0 +1,49 @@
+//
+// Created by agent on 2026/10/19.
+//
+
+#ifndef SLAPPYBELL_FIRMWARE_ENVELOPE_H
+#define SLAPPYBELL_FIRMWARE_ENVELOPE_H
+
+#include <Arduino.h>
+#include "config.h"
+
+// /.index/<ファイル名>.env に保存する音量の包絡線
+// この後にcount個の音量(0-255)が続く
+typedef struct _ENVELOPE_HEADER {
+	uint32_t	magic;
+	uint16_t	interval;		// ms
+	uint16_t	count;
+} ENVELOPE_HEADER;
+
+// デコードしたPCMから一定間隔ごとの平均振幅を求める
+class EnvelopeBuilder {
+private:
+	uint32_t _window;
+	uint32_t _sum;
+	uint32_t _samples;
+	uint16_t _count;
+	uint16_t _value[ENVELOPE_MAX_POINTS];
+public:
+	EnvelopeBuilder() { begin(); }
+	void begin();
+	void add(const int16_t *samples, int count, uint32_t sampleRate);
+	bool save(const char *path);
+};
+
+// 再生中の音の包絡線を読み込み、再生位置に対する音量を返す
+class Envelope {
+private:
+	static char _name[80];
+	static uint8_t _level[ENVELOPE_MAX_POINTS];
+	static uint16_t _count;
+	static uint16_t _interval;
+public:
+	static void makePath(const char *path, char *envelopePath, size_t len);
+	static bool exists(const char *path);
+	static void remove(const char *path);
+	static bool follow(const char *path);
+	static uint8_t level(uint32_t position);
+};
+
+#endif //SLAPPYBELL_FIRMWARE_ENVELOPE_H
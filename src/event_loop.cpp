@@ -0,0 +1,58 @@
+//
+// Created by agent on 2026/10/19.
+//
+
+#include <Arduino.h>
+#include <freertos/event_groups.h>
+
+#include "config.h"
+#include "event_loop.h"
+
+EventGroupHandle_t EventLoop::_group = nullptr;
+uint32_t EventLoop::_wakeups = 0;
+uint32_t EventLoop::_timeouts = 0;
+uint64_t EventLoop::_idleTime = 0;
+uint32_t EventLoop::_since = 0;
+
+void EventLoop::init() {
+	_group = xEventGroupCreate();
+	resetStats(millis());
+}
+
+void EventLoop::post(uint32_t events) {
+	if (_group != nullptr)
+		xEventGroupSetBits(_group, events);
+}
+
+// timeout(ms)までイベントを待ち、届いたイベントを返す(期限が来たら0)
+uint32_t EventLoop::wait(uint32_t timeout) {
+	if (_group == nullptr || timeout == 0)
+		return 0;
+	TickType_t ticks = pdMS_TO_TICKS(timeout);
+	if (ticks == 0)
+		ticks = 1;
+	uint32_t start = micros();
+	uint32_t events = xEventGroupWaitBits(_group, EVENT_ALL, pdTRUE, pdFALSE, ticks) & EVENT_ALL;
+	_idleTime += micros() - start;
+	if (events != 0)
+		_wakeups++;
+	else
+		_timeouts++;
+	return events;
+}
+
+// 前回のリセットから、メインループが待っていた時間の割合(%)
+uint8_t EventLoop::idle(uint32_t now) {
+	uint32_t elapsed = now - _since;
+	if (elapsed == 0)
+		return 0;
+	uint64_t percent = _idleTime / 10 / elapsed;
+	return percent > 100 ? 100 : (uint8_t)percent;
+}
+
+void EventLoop::resetStats(uint32_t now) {
+	_wakeups = 0;
+	_timeouts = 0;
+	_idleTime = 0;
+	_since = now;
+}
@@ -0,0 +1,42 @@
+//
+// Created by agent on 2026/10/19.
+//
+
+#ifndef SLAPPYBELL_FIRMWARE_EVENT_LOOP_H
+#define SLAPPYBELL_FIRMWARE_EVENT_LOOP_H
+
+#include <Arduino.h>
+#include <freertos/event_groups.h>
+#include "config.h"
+
+// メインループを起こす出来事
+enum EventLoopEvent {
+	EVENT_SERIAL	= 1 << 0,	// USBシリアルの受信と接続状態の変化
+	EVENT_BLE		= 1 << 1,	// BLEの書き込みと接続状態の変化
+	EVENT_WIFI		= 1 << 2,
+	EVENT_AUDIO		= 1 << 3,	// 再生の開始と終了
+	EVENT_TASK		= 1 << 4,	// 裏で動くダウンロードの完了
+	EVENT_ALL		= 0x1F,
+};
+
+// メインループは仕事がなくなるとここで止まり、イベントが届くか次の期限が来るまでCPUを手放す
+// post()は他のタスクやコールバックから呼ぶ
+class EventLoop {
+private:
+	static EventGroupHandle_t _group;
+	static uint32_t _wakeups;
+	static uint32_t _timeouts;
+	static uint64_t _idleTime;		// us
+	static uint32_t _since;			// ms
+public:
+	static void init();
+	static void post(uint32_t events);
+	static uint32_t wait(uint32_t timeout);
+
+	static uint32_t wakeups() { return _wakeups; }
+	static uint32_t timeouts() { return _timeouts; }
+	static uint8_t idle(uint32_t now);
+	static void resetStats(uint32_t now);
+};
+
+#endif //SLAPPYBELL_FIRMWARE_EVENT_LOOP_H
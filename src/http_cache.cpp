@@ -0,0 +1,397 @@
+//
+// Created by agent on 2026/10/19.
+//
+
+#include <Arduino.h>
+#include <FS.h>
+#include <LittleFS.h>
+#include <HTTPClient.h>
+#include <Preferences.h>
+
+#include "config.h"
+#include "event_loop.h"
+#include "http_cache.h"
+#include "manifest.h"
+
+#define HTTP_CACHE_INDEX	HTTP_CACHE_DIR "/index"
+#define HTTP_CACHE_MAGIC	0x48434931	// "HCI1"
+
+HTTP_CACHE_ENTRY HttpCache::_entry[HTTP_CACHE_ENTRIES];
+bool HttpCache::_enabled = false;
+bool HttpCache::_revalidate = false;
+uint32_t HttpCache::_useSequence = 0;
+uint32_t HttpCache::_hits = 0;
+uint32_t HttpCache::_misses = 0;
+
+char HttpCache::_jobUrl[HTTP_CACHE_URL_LENGTH];
+char HttpCache::_jobEtag[HTTP_CACHE_ETAG_LENGTH];
+char HttpCache::_jobLastModified[HTTP_CACHE_DATE_LENGTH];
+uint32_t HttpCache::_jobSize = 0;
+volatile HttpCacheJobState HttpCache::_jobState = HTTP_JOB_IDLE;
+
+static void copyString(char *dst, const char *src, size_t len) {
+	strncpy(dst, src, len);
+	dst[len-1] = 0;
+}
+
+void HttpCache::init() {
+	for (int i = 0; i < HTTP_CACHE_ENTRIES; i++) {
+		_entry[i].url[0] = 0;
+		_entry[i].size = 0;
+	}
+	Preferences prefs;
+	if (prefs.begin(PREFERENCES_NAMESPACE, true)) {
+		_enabled = prefs.getBool("http-cache", false);
+		_revalidate = prefs.getBool("http-reval", false);
+		prefs.end();
+	}
+	if (!LittleFS.exists(HTTP_CACHE_DIR))
+		LittleFS.mkdir(HTTP_CACHE_DIR);
+	LittleFS.remove(HTTP_CACHE_TEMP);
+
+	File index = LittleFS.open(HTTP_CACHE_INDEX, "r");
+	if (index) {
+		uint32_t magic = 0;
+		if (index.read((uint8_t*)&magic, sizeof(magic)) == sizeof(magic) && magic == HTTP_CACHE_MAGIC) {
+			index.read((uint8_t*)_entry, sizeof(_entry));
+		}
+		index.close();
+	}
+	// インデックスと実ファイルが一致しないエントリは捨てる
+	for (int i = 0; i < HTTP_CACHE_ENTRIES; i++) {
+		HTTP_CACHE_ENTRY *e = &_entry[i];
+		e->url[sizeof(e->url)-1] = 0;
+		e->etag[sizeof(e->etag)-1] = 0;
+		e->lastModified[sizeof(e->lastModified)-1] = 0;
+		if (e->url[0] == 0)
+			continue;
+		char path[32];
+		_path(e->hash, path, sizeof(path));
+		File file = LittleFS.open(path, "r");
+		if (!file || file.size() != e->size || e->hash != _hash(e->url))
+			e->url[0] = 0;
+		if (e->lastUse > _useSequence)
+			_useSequence = e->lastUse;
+	}
+	// インデックスにないファイルを削除する
+	File dir = LittleFS.open(HTTP_CACHE_DIR);
+	File file = dir.openNextFile();
+	while (file) {
+		char path[48];
+		snprintf(path, sizeof(path), HTTP_CACHE_DIR "/%s", file.name());
+		file.close();
+		bool used = strcmp(path, HTTP_CACHE_INDEX) == 0;
+		for (int i = 0; i < HTTP_CACHE_ENTRIES && !used; i++) {
+			char p[32];
+			_path(_entry[i].hash, p, sizeof(p));
+			used = _entry[i].url[0] != 0 && strcmp(p, path) == 0;
+		}
+		if (!used)
+			LittleFS.remove(path);
+		file = dir.openNextFile();
+	}
+	_save();
+}
+
+uint32_t HttpCache::_hash(const char *url) {
+	// FNV-1a
+	uint32_t h = 2166136261u;
+	while (*url) {
+		h ^= (uint8_t)*url++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+void HttpCache::_path(uint32_t hash, char *path, size_t len) {
+	snprintf(path, len, HTTP_CACHE_DIR "/%08lx.mp3", (ulong)hash);
+}
+
+HTTP_CACHE_ENTRY *HttpCache::_find(const char *url) {
+	for (int i = 0; i < HTTP_CACHE_ENTRIES; i++) {
+		if (_entry[i].url[0] != 0 && strcmp(_entry[i].url, url) == 0)
+			return &_entry[i];
+	}
+	return nullptr;
+}
+
+void HttpCache::_release(HTTP_CACHE_ENTRY *e) {
+	if (e->url[0] == 0)
+		return;
+	char path[32];
+	_path(e->hash, path, sizeof(path));
+	LittleFS.remove(path);
+	Manifest::invalidateUsage();
+	e->url[0] = 0;
+	e->size = 0;
+}
+
+bool HttpCache::_evict(const char *except) {
+	HTTP_CACHE_ENTRY *victim = nullptr;
+	for (int i = 0; i < HTTP_CACHE_ENTRIES; i++) {
+		HTTP_CACHE_ENTRY *e = &_entry[i];
+		if (e->url[0] == 0 || (except != nullptr && strcmp(e->url, except) == 0))
+			continue;
+		if (victim == nullptr || e->lastUse < victim->lastUse)
+			victim = e;
+	}
+	if (victim == nullptr)
+		return false;
+	_release(victim);
+	return true;
+}
+
+void HttpCache::_save() {
+	File index = LittleFS.open(HTTP_CACHE_INDEX, "w");
+	if (!index)
+		return;
+	uint32_t magic = HTTP_CACHE_MAGIC;
+	index.write((const uint8_t*)&magic, sizeof(magic));
+	index.write((const uint8_t*)_entry, sizeof(_entry));
+	index.close();
+}
+
+void HttpCache::_saveSettings() {
+	Preferences prefs;
+	if (prefs.begin(PREFERENCES_NAMESPACE, false)) {
+		prefs.putBool("http-cache", _enabled);
+		prefs.putBool("http-reval", _revalidate);
+		prefs.end();
+	}
+}
+
+void HttpCache::setEnabled(bool enable) {
+	_enabled = enable;
+	_saveSettings();
+}
+
+void HttpCache::setRevalidate(bool enable) {
+	_revalidate = enable;
+	_saveSettings();
+}
+
+uint32_t HttpCache::used() {
+	uint32_t total = 0;
+	for (int i = 0; i < HTTP_CACHE_ENTRIES; i++) {
+		if (_entry[i].url[0] != 0)
+			total += _entry[i].size;
+	}
+	return total;
+}
+
+const HTTP_CACHE_ENTRY *HttpCache::entry(int index) {
+	if (index < 0 || index >= HTTP_CACHE_ENTRIES || _entry[index].url[0] == 0)
+		return nullptr;
+	return &_entry[index];
+}
+
+bool HttpCache::lookup(const char *url, char *path, size_t len) {
+	if (!_enabled)
+		return false;
+	HTTP_CACHE_ENTRY *e = _find(url);
+	if (e == nullptr) {
+		_misses++;
+		return false;
+	}
+	_hits++;
+	e->lastUse = ++_useSequence;
+	_path(e->hash, path, len);
+	return true;
+}
+
+bool HttpCache::fetch(const char *url) {
+	if (!_enabled || strlen(url) >= HTTP_CACHE_URL_LENGTH)
+		return false;
+	return _startJob(url, nullptr);
+}
+
+bool HttpCache::revalidate(const char *url) {
+	if (!_enabled || !_revalidate)
+		return false;
+	HTTP_CACHE_ENTRY *e = _find(url);
+	if (e == nullptr || (e->etag[0] == 0 && e->lastModified[0] == 0))
+		return false;
+	return _startJob(url, e);
+}
+
+bool HttpCache::trim(size_t bytes, const char *playing) {
+	size_t freed = 0;
+	while (freed < bytes) {
+		uint32_t before = used();
+		if (!_evict(playing))
+			break;
+		freed += before - used();
+	}
+	_save();
+	return freed >= bytes;
+}
+
+void HttpCache::clear() {
+	for (int i = 0; i < HTTP_CACHE_ENTRIES; i++)
+		_release(&_entry[i]);
+	_save();
+}
+
+bool HttpCache::_claimJob(const char *url, const HTTP_CACHE_ENTRY *e) {
+	if (_jobState != HTTP_JOB_IDLE)
+		return false;
+	// アップロード用に予約した容量は使わない
+	if (Manifest::freeBytes() < HTTP_CACHE_MAX_FILE_SIZE)
+		return false;
+	copyString(_jobUrl, url, sizeof(_jobUrl));
+	_jobEtag[0] = 0;
+	_jobLastModified[0] = 0;
+	if (e != nullptr) {
+		copyString(_jobEtag, e->etag, sizeof(_jobEtag));
+		copyString(_jobLastModified, e->lastModified, sizeof(_jobLastModified));
+	}
+	_jobSize = 0;
+	_jobState = HTTP_JOB_RUNNING;
+	return true;
+}
+
+bool HttpCache::_startJob(const char *url, const HTTP_CACHE_ENTRY *e) {
+	if (!_claimJob(url, e))
+		return false;
+	if (xTaskCreate(_jobTask, "httpcache", 6144, nullptr, 1, nullptr) != pdPASS) {
+		_jobState = HTTP_JOB_IDLE;
+		return false;
+	}
+	return true;
+}
+
+void HttpCache::_jobTask(void *arg) {
+	HttpCacheJobState result = HTTP_JOB_FAILED;
+	HTTPClient http;
+	http.setReuse(false);
+	http.setConnectTimeout(HTTP_CACHE_TIMEOUT);
+	http.setTimeout(HTTP_CACHE_TIMEOUT);
+	if (http.begin(_jobUrl)) {
+		const char *keys[] = { "ETag", "Last-Modified" };
+		http.collectHeaders(keys, 2);
+		if (_jobEtag[0] != 0)
+			http.addHeader("If-None-Match", _jobEtag);
+		if (_jobLastModified[0] != 0)
+			http.addHeader("If-Modified-Since", _jobLastModified);
+		int code = http.GET();
+		int length = http.getSize();
+		if (code == HTTP_CODE_NOT_MODIFIED) {
+			result = HTTP_JOB_NOT_MODIFIED;
+		} else if (code == HTTP_CODE_OK && length <= HTTP_CACHE_MAX_FILE_SIZE) {
+			File file = LittleFS.open(HTTP_CACHE_TEMP, "w");
+			if (file) {
+				uint8_t buff[512];
+				WiFiClient *stream = http.getStreamPtr();
+				size_t total = 0;
+				uint32_t lastRead = millis();
+				bool success = true;
+				while ((http.connected() || stream->available() > 0) && (length < 0 || total < (size_t)length)) {
+					size_t n = stream->available();
+					if (n == 0) {
+						if (millis() - lastRead > HTTP_CACHE_TIMEOUT) {
+							success = false;
+							break;
+						}
+						vTaskDelay(1);
+						continue;
+					}
+					if (n > sizeof(buff))
+						n = sizeof(buff);
+					n = stream->readBytes(buff, n);
+					if (total + n > HTTP_CACHE_MAX_FILE_SIZE || file.write(buff, n) != n) {
+						success = false;
+						break;
+					}
+					total += n;
+					lastRead = millis();
+				}
+				file.close();
+				if (success && total > 0 && (length < 0 || total == (size_t)length)) {
+					copyString(_jobEtag, http.header("ETag").c_str(), sizeof(_jobEtag));
+					copyString(_jobLastModified, http.header("Last-Modified").c_str(), sizeof(_jobLastModified));
+					_jobSize = total;
+					result = HTTP_JOB_DONE;
+				} else {
+					LittleFS.remove(HTTP_CACHE_TEMP);
+				}
+			}
+		}
+		http.end();
+	}
+	_jobState = result;
+	EventLoop::post(EVENT_TASK);
+	vTaskDelete(nullptr);
+}
+
+// 再生用の受信(StreamBuffer)の内容をそのまま保存する
+// 受信側がHTTP_CACHE_TEMPへ書き込み、終わったらendStore()を呼ぶ
+bool HttpCache::beginStore(const char *url) {
+	if (!_enabled || strlen(url) >= HTTP_CACHE_URL_LENGTH || _find(url) != nullptr)
+		return false;
+	return _claimJob(url, nullptr);
+}
+
+// 受信側のタスクから呼ばれる sizeが0なら保存しない
+void HttpCache::endStore(uint32_t size, const char *etag, const char *lastModified) {
+	if (size == 0) {
+		LittleFS.remove(HTTP_CACHE_TEMP);
+		_jobState = HTTP_JOB_FAILED;
+	} else {
+		copyString(_jobEtag, etag, sizeof(_jobEtag));
+		copyString(_jobLastModified, lastModified, sizeof(_jobLastModified));
+		_jobSize = size;
+		_jobState = HTTP_JOB_DONE;
+	}
+	EventLoop::post(EVENT_TASK);
+}
+
+void HttpCache::_commitJob(const char *playing) {
+	HTTP_CACHE_ENTRY *e = _find(_jobUrl);
+	if (_jobState == HTTP_JOB_DONE) {
+		if (e != nullptr && strcmp(playing, _jobUrl) == 0)
+			return;	// 再生中のファイルは置き換えない(再生終了後に反映)
+		if (e != nullptr)
+			_release(e);
+		uint32_t hash = _hash(_jobUrl);
+		for (int i = 0; i < HTTP_CACHE_ENTRIES; i++) {
+			if (_entry[i].url[0] != 0 && _entry[i].hash == hash)
+				_release(&_entry[i]);
+		}
+		bool fit = true;
+		while (used() + _jobSize > HTTP_CACHE_SIZE && fit)
+			fit = _evict(playing);
+		e = nullptr;
+		for (int i = 0; i < HTTP_CACHE_ENTRIES && e == nullptr; i++) {
+			if (_entry[i].url[0] == 0)
+				e = &_entry[i];
+		}
+		if (e == nullptr && _evict(playing)) {
+			for (int i = 0; i < HTTP_CACHE_ENTRIES && e == nullptr; i++) {
+				if (_entry[i].url[0] == 0)
+					e = &_entry[i];
+			}
+		}
+		char path[32];
+		_path(hash, path, sizeof(path));
+		if (fit && e != nullptr && LittleFS.rename(HTTP_CACHE_TEMP, path)) {
+			copyString(e->url, _jobUrl, sizeof(e->url));
+			copyString(e->etag, _jobEtag, sizeof(e->etag));
+			copyString(e->lastModified, _jobLastModified, sizeof(e->lastModified));
+			e->hash = hash;
+			e->size = _jobSize;
+			e->lastUse = ++_useSequence;
+		} else {
+			LittleFS.remove(HTTP_CACHE_TEMP);
+		}
+		Manifest::invalidateUsage();
+		_save();
+	}
+	_jobState = HTTP_JOB_IDLE;
+}
+
+void HttpCache::process(const char *playing) {
+	HttpCacheJobState state = _jobState;
+	if (state == HTTP_JOB_IDLE || state == HTTP_JOB_RUNNING)
+		return;
+	_commitJob(playing);
+}
@@ -0,0 +1,80 @@
+//
+// Created by agent on 2026/10/19.
+//
+
+#ifndef SLAPPYBELL_FIRMWARE_HTTP_CACHE_H
+#define SLAPPYBELL_FIRMWARE_HTTP_CACHE_H
+
+#include <Arduino.h>
+#include "config.h"
+
+typedef struct _HTTP_CACHE_ENTRY {
+	char		url[HTTP_CACHE_URL_LENGTH];
+	char		etag[HTTP_CACHE_ETAG_LENGTH];
+	char		lastModified[HTTP_CACHE_DATE_LENGTH];
+	uint32_t	hash;
+	uint32_t	size;
+	uint32_t	lastUse;
+} HTTP_CACHE_ENTRY;
+
+enum HttpCacheJobState {
+	HTTP_JOB_IDLE,
+	HTTP_JOB_RUNNING,
+	HTTP_JOB_DONE,
+	HTTP_JOB_NOT_MODIFIED,
+	HTTP_JOB_FAILED,
+};
+
+// http://で再生したmp3をLittleFSの/http以下に保存するLRUキャッシュ
+// ダウンロードと再検証はバックグラウンドのタスクで行い、
+// 結果の反映はprocess()でメインループから行う
+class HttpCache {
+private:
+	static HTTP_CACHE_ENTRY _entry[HTTP_CACHE_ENTRIES];
+	static bool _enabled;
+	static bool _revalidate;
+	static uint32_t _useSequence;
+	static uint32_t _hits;
+	static uint32_t _misses;
+
+	static char _jobUrl[HTTP_CACHE_URL_LENGTH];
+	static char _jobEtag[HTTP_CACHE_ETAG_LENGTH];
+	static char _jobLastModified[HTTP_CACHE_DATE_LENGTH];
+	static uint32_t _jobSize;
+	static volatile HttpCacheJobState _jobState;
+
+	static uint32_t _hash(const char *url);
+	static void _path(uint32_t hash, char *path, size_t len);
+	static HTTP_CACHE_ENTRY *_find(const char *url);
+	static void _release(HTTP_CACHE_ENTRY *e);
+	static bool _evict(const char *except);
+	static void _save();
+	static void _saveSettings();
+	static bool _claimJob(const char *url, const HTTP_CACHE_ENTRY *e);
+	static bool _startJob(const char *url, const HTTP_CACHE_ENTRY *e);
+	static void _jobTask(void *arg);
+	static void _commitJob(const char *playing);
+public:
+	static void init();
+	static bool enabled() { return _enabled; }
+	static bool revalidateEnabled() { return _revalidate; }
+	static void setEnabled(bool enable);
+	static void setRevalidate(bool enable);
+	static uint32_t hits() { return _hits; }
+	static uint32_t misses() { return _misses; }
+	static uint32_t used();
+	static const HTTP_CACHE_ENTRY *entry(int index);
+
+	static bool contains(const char *url) { return _enabled && _find(url) != nullptr; }
+	static bool busy() { return _jobState != HTTP_JOB_IDLE; }
+	static bool lookup(const char *url, char *path, size_t len);
+	static bool fetch(const char *url);
+	static bool revalidate(const char *url);
+	static bool beginStore(const char *url);
+	static void endStore(uint32_t size, const char *etag, const char *lastModified);
+	static bool trim(size_t bytes, const char *playing);
+	static void clear();
+	static void process(const char *playing);
+};
+
+#endif //SLAPPYBELL_FIRMWARE_HTTP_CACHE_H
@@ -0,0 +1,138 @@
+//
+// Created by agent on 2026/10/19.
+//
+
+#include "config.h"
+#include "led_pattern.h"
+
+LedPattern::LedPattern() {
+	_sequenceCount = 0;
+	_sequencePtr = 0;
+	_lastTime = 0;
+	_follow = false;
+	_r = 0;
+	_g = 0;
+	_b = 0;
+
+	for (int i = 0; i < MAX_LED_SEQUENCE_LENGTH; i++)
+	{
+		LED_SEQUENCE *p = &_sequence[i];
+		p->R = 0; p->G = 0; p->B = 0;
+		p->gradient = false;
+		p->time = 0;
+		p->diffR = 0; p->diffG = 0; p->diffB = 0;
+	}
+}
+
+// segment()に書き込んだcount個のセグメントで点灯を始める
+void LedPattern::start(size_t count, bool follow) {
+	if (count > 1) {
+		for (size_t i = 0; i < count; i++) {
+			LED_SEQUENCE *seg = &_sequence[i];
+			LED_SEQUENCE *next = &_sequence[(i + 1) % count];
+			seg->diffR = seg->gradient ? next->R - seg->R : 0;
+			seg->diffG = seg->gradient ? next->G - seg->G : 0;
+			seg->diffB = seg->gradient ? next->B - seg->B : 0;
+		}
+	} else {
+		_sequence[0].time = 0;
+		_sequence[0].gradient = false;
+		_sequence[0].diffR = 0;
+		_sequence[0].diffG = 0;
+		_sequence[0].diffB = 0;
+	}
+	_sequencePtr = 0;
+	_lastTime = 0;
+	_follow = follow;
+	_sequenceCount = count;
+}
+
+// 消灯する 表示を変える必要があればtrueを返す
+bool LedPattern::reset() {
+	_sequencePtr = 0;
+	_sequenceCount = 0;
+	_lastTime = 0;
+	_follow = false;
+	if (_r != 0 || _g != 0 || _b != 0) {
+		_r = 0;
+		_g = 0;
+		_b = 0;
+		return true;
+	}
+	return false;
+}
+
+// 時刻nowの色を求める 色が変わればtrueを返す
+// levelは音量に合わせる場合の明るさ(0-255)
+bool LedPattern::update(uint32_t now, uint8_t level) {
+	if(_sequenceCount > 0) {
+		const LED_SEQUENCE *seg = &_sequence[_sequencePtr];
+		uint8_t r = seg->R;
+		uint8_t g = seg->G;
+		uint8_t b = seg->B;
+		if (_lastTime != 0) {
+			uint32_t dt = now -_lastTime;
+			if (seg->time <= dt) {
+				_sequencePtr++;
+				if(_sequencePtr >= _sequenceCount) {
+					_sequencePtr = 0;
+				}
+				seg = &_sequence[_sequencePtr];
+				r = seg->R;
+				g = seg->G;
+				b = seg->B;
+				_lastTime = now;
+			} else if (seg->gradient) {
+				// 整数演算で補間する (dt < time)
+				r += (int32_t)((int64_t)seg->diffR * dt / seg->time);
+				g += (int32_t)((int64_t)seg->diffG * dt / seg->time);
+				b += (int32_t)((int64_t)seg->diffB * dt / seg->time);
+			}
+		}
+		else {
+			_lastTime = now;
+		}
+		if (_follow) {
+			uint16_t scale = (uint16_t)level + 1;
+			r = (uint8_t)((r * scale) >> 8);
+			g = (uint8_t)((g * scale) >> 8);
+			b = (uint8_t)((b * scale) >> 8);
+		}
+		if (_r != r || _g != g || _b != b) {
+			_r = r;
+			_g = g;
+			_b = b;
+			return true;
+		}
+	}
+	return false;
+}
+
+// 次に色が変わるまでの時間(ms) 変わらなければUINT32_MAX
+uint32_t LedPattern::nextChange(uint32_t now) const {
+	if (_sequenceCount == 0)
+		return UINT32_MAX;
+	if (_lastTime == 0)
+		return 0;
+	// グラデーションと音量に合わせる場合は毎フレーム変わる
+	const LED_SEQUENCE *seg = &_sequence[_sequencePtr];
+	if (seg->gradient || _follow)
+		return 0;
+	if (_sequenceCount == 1)
+		return UINT32_MAX;
+	uint32_t dt = now - _lastTime;
+	return seg->time > dt ? seg->time - dt : 0;
+}
+
+// 今の色を出力テーブルで変換し、GRB順(NEO_GRB)の画素バッファのfirstからcount個へ書き込む
+void LedPattern::fill(uint8_t *pixels, uint16_t first, uint16_t count, const uint8_t *table) const {
+	uint8_t r = table[_r];
+	uint8_t g = table[_g];
+	uint8_t b = table[_b];
+	uint8_t *p = pixels + (size_t)first * 3;
+	for (uint16_t i = 0; i < count; i++) {
+		*p++ = g;
+		*p++ = r;
+		*p++ = b;
+	}
+}
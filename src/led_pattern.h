@@ -0,0 +1,47 @@
+//
+// Created by agent on 2026/10/19.
+//
+
+#ifndef SLAPPYBELL_FIRMWARE_LED_PATTERN_H
+#define SLAPPYBELL_FIRMWARE_LED_PATTERN_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "config.h"
+
+typedef struct _LED_SEQUENCE {
+	uint8_t R;
+	uint8_t G;
+	uint8_t B;
+	bool gradient;
+	int16_t diffR;		// 次のセグメントの色との差分(グラデーション時)
+	int16_t diffG;
+	int16_t diffB;
+	uint32_t	time;
+} LED_SEQUENCE;
+
+// 1スロット分の発光パターンを時間に沿って進め、表示する色を求める
+// Arduinoに依存しないので、ホストのテストとベンチマークでも同じコードを動かせる
+class LedPattern {
+private:
+	LED_SEQUENCE 	_sequence[MAX_LED_SEQUENCE_LENGTH];
+	size_t			_sequenceCount;
+	size_t			_sequencePtr;
+	uint32_t 		_lastTime;
+	bool			_follow;		// 再生中の音の音量に合わせて明るさを変える
+	uint8_t _r;
+	uint8_t _g;
+	uint8_t _b;
+public:
+	LedPattern();
+	LED_SEQUENCE *segment(int index) { return &_sequence[index]; }
+	void start(size_t count, bool follow);
+	bool reset();
+	bool update(uint32_t now, uint8_t level);
+	uint32_t nextChange(uint32_t now) const;
+	bool active() const { return _sequenceCount > 0; }
+	bool following() const { return _follow && _sequenceCount > 0; }
+	void fill(uint8_t *pixels, uint16_t first, uint16_t count, const uint8_t *table) const;
+};
+
+#endif //SLAPPYBELL_FIRMWARE_LED_PATTERN_H
@@ -3,33 +3,55 @@
 //
 
 #include <Arduino.h>
+#include <new>
 #include <Adafruit_NeoPixel.h>
+#include <Preferences.h>
 
 #include "config.h"
 #include "led_sequencer.h"
 
 #include "processor.h"
+#include "profiler.h"
 #include "utils.h"
 
 Adafruit_NeoPixel pixels(SLOT_COUNT, PIN_NEOPIXEL, NEO_GRB + NEO_KHZ800);
-LedSequencer LedSequencer::_ledSequencer[SLOT_COUNT];
+LedSequencer *LedSequencer::_ledSequencer = nullptr;
+int LedSequencer::_slotCount = 0;
+uint16_t LedSequencer::_stripLength = 0;
+uint32_t LedSequencer::_lastFrameTime = 0;
+uint8_t LedSequencer::_brightness = 255;
+uint8_t LedSequencer::_outputTable[256];
+uint8_t LedSequencer::_level = 0;
 
-LedSequencer::LedSequencer() {
-	_ledIndex = -1;
-	_sequenceCount = 0;
-	_sequencePtr = 0;
-	_lastTime = 0;
-	_r = 0;
-	_g = 0;
-	_b = 0;
+namespace {
+// ガンマ補正テーブル(γ=2.25)をコンパイル時に生成する
+// x^2.25 = x^2 * sqrt(sqrt(x))
+constexpr double gammaSqrt(double x, double cur, int n) {
+	return n == 0 ? cur : gammaSqrt(x, 0.5 * (cur + x / cur), n - 1);
+}
+constexpr double gammaCurve(double x) {
+	return x * x * gammaSqrt(gammaSqrt(x, 1.0, 24), 1.0, 24);
+}
+constexpr uint8_t gammaValue(int i) {
+	return (uint8_t)(gammaCurve(i / 255.0) * 255.0 + 0.5);
+}
 
-	LED_SEQUENCE *p = &_sequence[0];
-	for (int i = 0; i < MAX_LED_SEQUENCE_LENGTH; i++)
-	{
-		p->R = 0; p->G = 0; p->B = 0;
-		p->time = 0;
-		p->deltaR = 0; p->deltaG = 0; p->deltaB = 0;
-	}
+template<int... I> struct GammaIndex {};
+template<int N, int... I> struct GammaBuild : GammaBuild<N - 1, N - 1, I...> {};
+template<int... I> struct GammaBuild<0, I...> { typedef GammaIndex<I...> type; };
+
+struct GammaTable { uint8_t value[256]; };
+template<int... I> constexpr GammaTable makeGammaTable(GammaIndex<I...>) {
+	return GammaTable{{ gammaValue(I)... }};
+}
+
+constexpr GammaTable gamma8 = makeGammaTable(GammaBuild<256>::type());
+static_assert(gamma8.value[0] == 0 && gamma8.value[255] == 255, "bad gamma table");
+}
+
+LedSequencer::LedSequencer() {
+	_firstPixel = 0;
+	_pixelCount = 0;
 }
 
 const char *LedSequencer::_parseColorSegment(const char *ptr, LED_SEQUENCE *seg) {
@@ -54,146 +76,201 @@ const char *LedSequencer::_parseColorSegment(const char *ptr, LED_SEQUENCE *seg)
 // RGB:50,RGB	50msec color change
 // RGB>RGB		1sec gradient
 // RGB:50>RGB	50msec gradient
+// ~RGB			follow sound level
 bool LedSequencer::_parse(const char *ptr) {
 	_reset();
 	ptr = Utils::skipWs(ptr);
 	if (!ptr)
 		return false;
+	bool follow = false;
+	if (*ptr == '~') {
+		follow = true;
+		ptr++;
+	}
 	int segs = 0;
 	while (*ptr && segs < MAX_LED_SEQUENCE_LENGTH) {
 		if (!Utils::isHex(*ptr))
 			break;
-		LED_SEQUENCE *seg = &_sequence[segs++];
+		LED_SEQUENCE *seg = _pattern.segment(segs++);
 		ptr = _parseColorSegment(ptr, seg);
 		if (!ptr)
 			return false;
 		if (*ptr == '>') {
-			seg->deltaR = 1;
+			seg->gradient = true;
 			ptr++;
 		} else {
-			seg->deltaR = 0;
-			seg->deltaG = 0;
-			seg->deltaB = 0;
+			seg->gradient = false;
 			if (*ptr == ',')
 				ptr++;
 		}
 	}
 	if (segs == 0)
 		return false;
-	for (int i = 0; i < segs-1; i++) {
-		LED_SEQUENCE *seg = &_sequence[i];
-		if (seg->deltaR == 1) {
-			int diffR = (seg+1)->R - seg->R;
-			int diffG = (seg+1)->G - seg->G;
-			int diffB = (seg+1)->B - seg->B;
-			seg->deltaR = (float)diffR / seg->time;
-			seg->deltaG = (float)diffG / seg->time;
-			seg->deltaB = (float)diffB / seg->time;
-		}
-	}
-	if (segs > 1) {
-		LED_SEQUENCE *seg = &_sequence[segs-1];
-		if (seg->deltaR == 1) {
-			int diffR = _sequence[0].R - seg->R;
-			int diffG = _sequence[0].G - seg->G;
-			int diffB = _sequence[0].B - seg->B;
-			seg->deltaR = (float)diffR / seg->time;
-			seg->deltaG = (float)diffG / seg->time;
-			seg->deltaB = (float)diffB / seg->time;
-		}
-	} else {
-		_sequence[0].time = 0;
-		_sequence[0].deltaR = 0;
-		_sequence[0].deltaG = 0;
-		_sequence[0].deltaB = 0;
-	}
-	_sequenceCount = segs;
-
-//	for (int i = 0; i < segs; i++) {
-//		Processor::sendLog("sequence[%d]=%6.6lx:%6.6lx:%6.6lx time=%lu", i, _sequence[i].R, _sequence[i].G, _sequence[i].B, _sequence[i].time);
-//	}
+	_pattern.start(segs, follow);
 
 	return true;
 }
 
 bool LedSequencer::_reset() {
-	_sequencePtr = 0;
-	_sequenceCount = 0;
-	_lastTime = 0;
-	if (_r != 0 || _g != 0 || _b != 0) {
-		_r = 0;
-		_g = 0;
-		_b = 0;
-		pixels.setPixelColor(_ledIndex, 0);
+	if (_pattern.reset()) {
+		_render();
 		return true;
 	}
 	return false;
 }
 
 bool LedSequencer::_update(uint32_t now) {
-	if(_sequenceCount > 0) {
-		byte r = _sequence[_sequencePtr].R;
-		byte g = _sequence[_sequencePtr].G;
-		byte b = _sequence[_sequencePtr].B;
-		if (_lastTime != 0) {
-			uint32_t dt = now -_lastTime;
-			if ( _sequence[_sequencePtr].time <= dt) {
-				_sequencePtr++;
-				if(_sequencePtr >= _sequenceCount) {
-					_sequencePtr = 0;
-				}
-				r = _sequence[_sequencePtr].R;
-				g = _sequence[_sequencePtr].G;
-				b = _sequence[_sequencePtr].B;
-				_lastTime = now;
-			} else {
-				if (_sequence[_sequencePtr].deltaR != 0)
-					r += (byte)((double)_sequence[_sequencePtr].deltaR * dt);
-				if (_sequence[_sequencePtr].deltaG != 0)
-					g += (byte)((double)_sequence[_sequencePtr].deltaG * dt);
-				if (_sequence[_sequencePtr].deltaB != 0)
-					b += (byte)((double)_sequence[_sequencePtr].deltaB * dt);
-			}
-		}
-		else {
-			_lastTime = now;
-		}
-		if (_r != r || _g != g || _b != b) {
-			_r = r;
-			_g = g;
-			_b = b;
-			pixels.setPixelColor(_ledIndex, Adafruit_NeoPixel::Color(r,g,b));
-			return true;
-		}
+	if (_pattern.update(now, _level)) {
+		_render();
+		return true;
 	}
 	return false;
 }
 
-void LedSequencer::init() {
-	pixels.begin();
-	pixels.clear();
-	pixels.show();
-	for (int i = 0; i < SLOT_COUNT; i++) {
-		_ledSequencer[i]._ledIndex = i;
+void LedSequencer::_render() {
+	if (_pixelCount == 0)
+		return;
+	_pattern.fill(pixels.getPixels(), _firstPixel, _pixelCount, _outputTable);
+}
+
+bool LedSequencer::_allocate(uint16_t pixelCount, const uint16_t *slotPixels, int slotCount) {
+	LedSequencer *sequencer = new (std::nothrow) LedSequencer[slotCount];
+	if (sequencer == nullptr)
+		return false;
+	uint16_t first = 0;
+	for (int i = 0; i < slotCount; i++) {
+		sequencer[i]._firstPixel = first;
+		sequencer[i]._pixelCount = slotPixels[i];
+		first += slotPixels[i];
 	}
+	delete[] _ledSequencer;
+	_ledSequencer = sequencer;
+	_slotCount = slotCount;
+	_stripLength = pixelCount;
+	pixels.updateLength(pixelCount);
+	return true;
+}
+
+void LedSequencer::_buildOutputTable() {
+	// ガンマ補正と明るさを1つのテーブルにまとめ、出力時は参照のみにする
+	uint16_t scale = (uint16_t)_brightness + 1;
+	for (int i = 0; i < 256; i++) {
+		_outputTable[i] = (uint8_t)((gamma8.value[i] * scale) >> 8);
+	}
+}
 
+void LedSequencer::_bootPattern() {
+	// 起動時のパターンは標準の6スロット構成のみ
+	if (_slotCount != SLOT_COUNT)
+		return;
 	_ledSequencer[5]._parse("3333CC:2000>000000:2000>000000:2000>000000:2000>000000:2000>000000:2000>000000:2000>000000:2000>000000:2000>000000:2000>");
 	_ledSequencer[4]._parse("000000:2000>3333CC:2000>000000:2000>000000:2000>000000:2000>000000:2000>000000:2000>000000:2000>000000:2000>3333CC:2000>");
 	_ledSequencer[3]._parse("000000:2000>000000:2000>3333CC:2000>000000:2000>000000:2000>000000:2000>000000:2000>000000:2000>3333CC:2000>000000:2000>");
 	_ledSequencer[2]._parse("000000:2000>000000:2000>000000:2000>3333CC:2000>000000:2000>000000:2000>000000:2000>3333CC:2000>000000:2000>000000:2000>");
 	_ledSequencer[1]._parse("000000:2000>000000:2000>000000:2000>000000:2000>3333CC:2000>000000:2000>3333CC:2000>000000:2000>000000:2000>000000:2000>");
 	_ledSequencer[0]._parse("000000:2000>000000:2000>000000:2000>000000:2000>000000:2000>3333CC:2000>000000:2000>000000:2000>000000:2000>000000:2000>");
+}
+
+void LedSequencer::init() {
+	uint16_t slotPixels[MAX_SLOT_COUNT];
+	uint16_t pixelCount = 0;
+	int slotCount = 0;
+
+	Preferences prefs;
+	if (prefs.begin(PREFERENCES_NAMESPACE, true)) {
+		pixelCount = prefs.getUShort("led-pixels", 0);
+		size_t len = prefs.getBytesLength("led-slots");
+		if (len > 0 && len <= sizeof(slotPixels) && len % sizeof(uint16_t) == 0) {
+			prefs.getBytes("led-slots", slotPixels, len);
+			slotCount = (int)(len / sizeof(uint16_t));
+		}
+		_brightness = prefs.getUChar("led-bright", 255);
+		prefs.end();
+	}
+	_buildOutputTable();
+	uint32_t total = 0;
+	for (int i = 0; i < slotCount; i++) {
+		if (slotPixels[i] == 0)
+			slotCount = 0;
+		total += slotPixels[i];
+	}
+	if (slotCount == 0 || pixelCount == 0 || pixelCount > MAX_PIXEL_COUNT || total > pixelCount) {
+		pixelCount = SLOT_COUNT;
+		slotCount = SLOT_COUNT;
+		for (int i = 0; i < SLOT_COUNT; i++)
+			slotPixels[i] = 1;
+	}
+	_allocate(pixelCount, slotPixels, slotCount);
+
+	pixels.begin();
+	pixels.clear();
+	pixels.show();
+	_bootPattern();
+}
+
+bool LedSequencer::configure(uint16_t pixelCount, const uint16_t *slotPixels, int slotCount) {
+	if (pixelCount == 0 || pixelCount > MAX_PIXEL_COUNT)
+		return false;
+	if (slotCount <= 0 || slotCount > MAX_SLOT_COUNT)
+		return false;
+	uint32_t total = 0;
+	for (int i = 0; i < slotCount; i++) {
+		if (slotPixels[i] == 0)
+			return false;
+		total += slotPixels[i];
+	}
+	if (total > pixelCount)
+		return false;
+
+	pixels.clear();
+	pixels.show();
+	if (!_allocate(pixelCount, slotPixels, slotCount))
+		return false;
+	pixels.clear();
+	pixels.show();
 
+	Preferences prefs;
+	if (prefs.begin(PREFERENCES_NAMESPACE, false)) {
+		prefs.putUShort("led-pixels", pixelCount);
+		prefs.putBytes("led-slots", slotPixels, slotCount * sizeof(uint16_t));
+		prefs.end();
+	}
+	return true;
+}
+
+uint16_t LedSequencer::slotPixels(int index) {
+	if (index < 0 || index >= _slotCount)
+		return 0;
+	return _ledSequencer[index]._pixelCount;
+}
+
+void LedSequencer::setBrightness(uint8_t brightness) {
+	if (_brightness == brightness)
+		return;
+	_brightness = brightness;
+	_buildOutputTable();
+	for (int i = 0; i < _slotCount; i++) {
+		_ledSequencer[i]._render();
+	}
+	pixels.show();
+
+	Preferences prefs;
+	if (prefs.begin(PREFERENCES_NAMESPACE, false)) {
+		prefs.putUChar("led-bright", brightness);
+		prefs.end();
+	}
 }
 
 void LedSequencer::clear(int index) {
 	if (index != -1) {
+		if (index < 0 || index >= _slotCount)
+			return;
 		if (_ledSequencer[index]._reset()) {
 			pixels.show();
 		}
 	} else {
 		bool update = false;
-		for (int i = 0; i < SLOT_COUNT; i++) {
+		for (int i = 0; i < _slotCount; i++) {
 			if(_ledSequencer[i]._reset())
 				update = true;
 		}
@@ -202,17 +279,49 @@ void LedSequencer::clear(int index) {
 	}
 }
 
-void LedSequencer::update(uint32_t now) {
+bool LedSequencer::update(uint32_t now) {
+	// 画素数が多い場合pixels.show()が数msかかるため、フレーム間隔で間引く
+	if (now - _lastFrameTime < LED_FRAME_INTERVAL)
+		return false;
+	_lastFrameTime = now;
 	bool updated = false;
-	for (int i = 0; i < SLOT_COUNT; i++) {
+	for (int i = 0; i < _slotCount; i++) {
 		if (_ledSequencer[i]._update(now))
 			updated = true;
 	}
 	if (updated) {
+		uint32_t cycles = Profiler::start();
 		pixels.show();
+		Profiler::record(PROFILE_SHOW, cycles);
+	}
+	return updated;
+}
+
+// 次に表示を更新する必要があるまでの時間(ms) 変化しなければUINT32_MAX
+uint32_t LedSequencer::nextUpdate(uint32_t now) {
+	uint32_t wait = UINT32_MAX;
+	for (int i = 0; i < _slotCount; i++) {
+		uint32_t t = _ledSequencer[i]._pattern.nextChange(now);
+		if (t < wait)
+			wait = t;
+	}
+	if (wait == UINT32_MAX)
+		return wait;
+	uint32_t elapsed = now - _lastFrameTime;
+	uint32_t frame = elapsed < LED_FRAME_INTERVAL ? LED_FRAME_INTERVAL - elapsed : 0;
+	return wait > frame ? wait : frame;
+}
+
+bool LedSequencer::following() {
+	for (int i = 0; i < _slotCount; i++) {
+		if (_ledSequencer[i]._pattern.following())
+			return true;
 	}
+	return false;
 }
 
 bool LedSequencer::parse(int index, const char *pattern) {
+	if (index < 0 || index >= _slotCount)
+		return false;
 	return _ledSequencer[index]._parse(pattern);
 }
@@ -6,39 +6,46 @@
 #define SLAPPYBELL_FIRMWARE_LED_SEQUENCER_H
 
 #include <Arduino.h>
-
-typedef struct _LED_SEQUENCE {
-	byte R;
-	byte G;
-	byte B;
-	float deltaR;
-	float deltaG;
-	float deltaB;
-	uint32_t	time;
-} LED_SEQUENCE;
+#include "config.h"
+#include "led_pattern.h"
 
 class LedSequencer {
 private:
-	int 			_ledIndex;
-	LED_SEQUENCE 	_sequence[MAX_LED_SEQUENCE_LENGTH];
-	size_t			_sequenceCount;
-	size_t			_sequencePtr;
-	uint32_t 		_lastTime;
-	byte _r;
-	byte _g;
-	byte _b;
+	uint16_t		_firstPixel;
+	uint16_t		_pixelCount;
+	LedPattern		_pattern;
+
+	static LedSequencer *_ledSequencer;
+	static int _slotCount;
+	static uint16_t _stripLength;
+	static uint32_t _lastFrameTime;
+	static uint8_t _brightness;
+	static uint8_t _outputTable[256];
+	static uint8_t _level;
 
-	static LedSequencer _ledSequencer[SLOT_COUNT];
 	const char *_parseColorSegment(const char *ptr, LED_SEQUENCE *seg);
 	bool _parse(const char *pattern);
 	bool _reset();
 	bool _update(uint32_t now);
+	void _render();
+	static bool _allocate(uint16_t pixelCount, const uint16_t *slotPixels, int slotCount);
+	static void _bootPattern();
+	static void _buildOutputTable();
 public:
 	LedSequencer();
 	static void init();
+	static bool configure(uint16_t pixelCount, const uint16_t *slotPixels, int slotCount);
+	static int slotCount() { return _slotCount; }
+	static uint16_t pixelCount() { return _stripLength; }
+	static uint16_t slotPixels(int index);
+	static void setBrightness(uint8_t brightness);
+	static uint8_t brightness() { return _brightness; }
 	static void clear(int index = -1);
-	static void update(uint32_t now);
+	static bool update(uint32_t now);
+	static uint32_t nextUpdate(uint32_t now);
 	static bool parse(int index, const char *pattern);
+	static bool following();
+	static void setLevel(uint8_t level) { _level = level; }
 };
 
 
@@ -2,7 +2,9 @@
 #include <WiFi.h>
 #include <esp_wifi.h>
 
+#include "event_loop.h"
 #include "processor.h"
+#include "trace.h"
 #include "transport_serial.h"
 #include "transport_ble.h"
 
@@ -24,6 +26,8 @@ void onBleDisconnect(Transport *transport)
 
 void setup() {
 //	resetReason = esp_reset_reason();
+	Trace::record(TRACE_BOOT);
+	EventLoop::init();
 	processor = new Processor();
 	processor->init();
 	serialTransport = new SerialTransport(processor);
@@ -33,6 +37,8 @@ void setup() {
 	bleTransport->startAdv();
 	bleTransport->setConnectCallback(onBleConnect);
 	bleTransport->setDisconnectCallback(onBleDisconnect);
+	processor->addTransport(serialTransport);
+	processor->addTransport(bleTransport);
 }
 
 void loop() {
@@ -76,8 +82,11 @@ void loop() {
 		}
 		if(size > sizeof(serialBuffer))
 			size = sizeof(serialBuffer);
-		size_t readSize =Serial.read(serialBuffer, size);
+		size_t readSize = serialTransport->read(serialBuffer, size);
 		processor->onTransportDataArrive(now, serialTransport, serialBuffer, readSize);
 	}
 	processor->process(now);
+	// 次の仕事まで、受信などのイベントを待って止まる
+	if (Serial.available() == 0)
+		EventLoop::wait(processor->waitTime(millis()));
 }
@@ -0,0 +1,391 @@
+//
+// Created by agent on 2026/10/19.
+//
+
+#include <Arduino.h>
+#include <FS.h>
+#include <LittleFS.h>
+
+#include <mbedtls/sha256.h>
+
+#include "config.h"
+#include "envelope.h"
+#include "manifest.h"
+#include "mp3_index.h"
+#include "utils.h"
+
+#define MANIFEST_STORE_PATH	MANIFEST_DIR "/store"
+#define MANIFEST_MAGIC		0x4D4E4631	// "MNF1"
+
+typedef struct _MANIFEST_HEADER {
+	uint32_t	magic;
+	uint32_t	count;
+} MANIFEST_HEADER;
+
+// 保存する内容
+typedef struct _MANIFEST_RECORD {
+	char		name[32];
+	char		target[32];
+	uint32_t	size;
+	uint8_t		hash[MANIFEST_HASH_SIZE];
+} MANIFEST_RECORD;
+
+MANIFEST_ENTRY *Manifest::_entry = nullptr;
+int Manifest::_count = 0;
+int Manifest::_capacity = 0;
+size_t Manifest::_totalBytes = 0;
+size_t Manifest::_usedBytes = 0;
+size_t Manifest::_storeSize = 0;
+size_t Manifest::_reservedBytes = 0;
+volatile bool Manifest::_usageValid = false;
+
+void Manifest::init() {
+	if (!LittleFS.exists(MANIFEST_DIR))
+		LittleFS.mkdir(MANIFEST_DIR);
+	_count = 0;
+	File root = LittleFS.open("/");
+	File file = root.openNextFile();
+	while (file) {
+		if (!file.isDirectory()) {
+			if (!_grow())
+				break;
+			MANIFEST_ENTRY *e = &_entry[_count++];
+			snprintf(e->name, sizeof(e->name), "/%s", file.name());
+			e->target[0] = 0;
+			e->size = file.size();
+			e->duration = 0;
+		}
+		file = root.openNextFile();
+	}
+	for (int i = 0; i < _count; i++) {
+		MP3_INDEX_INFO info;
+		if (Mp3Index::load(_entry[i].name, &info))
+			_entry[i].duration = info.duration;
+	}
+	_load();
+	_totalBytes = LittleFS.totalBytes();
+	_usedBytes = LittleFS.usedBytes();
+	_usageValid = true;
+}
+
+// 保存済みのハッシュと別名を読み込む
+// サイズが変わっていたりハッシュのないファイルは計算し直す
+void Manifest::_load() {
+	int files = _count;
+	bool *hashed = (bool*)calloc(files > 0 ? files : 1, sizeof(bool));
+	bool changed = false;
+	File file = LittleFS.open(MANIFEST_STORE_PATH, "r");
+	_storeSize = file ? file.size() : 0;
+	MANIFEST_HEADER header;
+	if (file && file.read((uint8_t*)&header, sizeof(header)) == sizeof(header) && header.magic == MANIFEST_MAGIC) {
+		MANIFEST_RECORD record;
+		for (uint32_t i = 0; i < header.count; i++) {
+			if (file.read((uint8_t*)&record, sizeof(record)) != sizeof(record))
+				break;
+			record.name[sizeof(record.name)-1] = 0;
+			record.target[sizeof(record.target)-1] = 0;
+			if (record.target[0] == 0) {
+				MANIFEST_ENTRY *e = _find(record.name);
+				if (e != nullptr && e->size == record.size && hashed != nullptr && e - _entry < files) {
+					memcpy(e->hash, record.hash, MANIFEST_HASH_SIZE);
+					hashed[e - _entry] = true;
+				}
+				continue;
+			}
+			// 広げると一覧の場所が変わるので、別名の指す先はその後で探す
+			if (_find(record.name) != nullptr || !_grow()) {
+				changed = true;
+				continue;
+			}
+			MANIFEST_ENTRY *t = _find(record.target);
+			if (t == nullptr || t - _entry >= files) {
+				changed = true;
+				continue;
+			}
+			MANIFEST_ENTRY *e = &_entry[_count++];
+			memcpy(e->name, record.name, sizeof(e->name));
+			memcpy(e->target, record.target, sizeof(e->target));
+			memcpy(e->hash, record.hash, MANIFEST_HASH_SIZE);
+			e->size = t->size;
+			e->duration = t->duration;
+		}
+	} else {
+		changed = true;
+	}
+	if (file)
+		file.close();
+	for (int i = 0; i < _count; i++) {
+		if (_entry[i].target[0] == 0 && (hashed == nullptr || i >= files || !hashed[i])) {
+			_hashFile(_entry[i].name, _entry[i].hash);
+			changed = true;
+		}
+	}
+	// 中身の変わったファイルを指していた別名は外す
+	for (int i = _count - 1; i >= 0; i--) {
+		MANIFEST_ENTRY *t = _entry[i].target[0] != 0 ? _find(_entry[i].target) : nullptr;
+		if (t != nullptr && memcmp(t->hash, _entry[i].hash, MANIFEST_HASH_SIZE) != 0) {
+			_erase(&_entry[i]);
+			changed = true;
+		}
+	}
+	free(hashed);
+	if (changed)
+		_save();
+}
+
+void Manifest::_save() {
+	File file = LittleFS.open(MANIFEST_STORE_PATH, "w");
+	if (!file)
+		return;
+	MANIFEST_HEADER header;
+	header.magic = MANIFEST_MAGIC;
+	header.count = _count;
+	file.write((const uint8_t*)&header, sizeof(header));
+	for (int i = 0; i < _count; i++) {
+		MANIFEST_RECORD record;
+		memset(&record, 0, sizeof(record));
+		memcpy(record.name, _entry[i].name, sizeof(record.name));
+		memcpy(record.target, _entry[i].target, sizeof(record.target));
+		record.size = _entry[i].size;
+		memcpy(record.hash, _entry[i].hash, MANIFEST_HASH_SIZE);
+		file.write((const uint8_t*)&record, sizeof(record));
+	}
+	// 一覧のファイル自身の大きさの変化も使用量に反映する
+	size_t size = file.size();
+	file.close();
+	_usedBytes = _usedBytes - _blocks(_storeSize) + _blocks(size);
+	_storeSize = size;
+}
+
+bool Manifest::_hashFile(const char *path, uint8_t *hash) {
+	memset(hash, 0, MANIFEST_HASH_SIZE);
+	File file = LittleFS.open(path, "r");
+	if (!file)
+		return false;
+	mbedtls_sha256_context ctx;
+	mbedtls_sha256_init(&ctx);
+	mbedtls_sha256_starts_ret(&ctx, 0);
+	uint8_t buffer[512];
+	size_t n;
+	while ((n = file.read(buffer, sizeof(buffer))) > 0)
+		mbedtls_sha256_update_ret(&ctx, buffer, n);
+	mbedtls_sha256_finish_ret(&ctx, hash);
+	mbedtls_sha256_free(&ctx);
+	file.close();
+	return true;
+}
+
+// 一覧に1つ追加できるようにする(足りなければPSRAMの領域を広げる)
+// 広げると一覧の場所が変わるので、それまでに得たエントリは使えなくなる
+bool Manifest::_grow() {
+	if (_count < _capacity)
+		return true;
+	int capacity = _capacity + MANIFEST_ENTRIES;
+	MANIFEST_ENTRY *entry = (MANIFEST_ENTRY*)ps_realloc(_entry, capacity * sizeof(MANIFEST_ENTRY));
+	if (entry == nullptr)
+		return false;
+	_entry = entry;
+	_capacity = capacity;
+	return true;
+}
+
+const MANIFEST_ENTRY *Manifest::entry(int index) {
+	if (index < 0 || index >= _count)
+		return nullptr;
+	return &_entry[index];
+}
+
+MANIFEST_ENTRY *Manifest::_find(const char *path) {
+	for (int i = 0; i < _count; i++) {
+		if (strcmp(_entry[i].name, path) == 0)
+			return &_entry[i];
+	}
+	return nullptr;
+}
+
+// 同じ内容のファイル(別名ではなく実体)を探す
+const MANIFEST_ENTRY *Manifest::findHash(const uint8_t *hash) {
+	for (int i = 0; i < _count; i++) {
+		if (_entry[i].target[0] == 0 && memcmp(_entry[i].hash, hash, MANIFEST_HASH_SIZE) == 0)
+			return &_entry[i];
+	}
+	return nullptr;
+}
+
+// 再生などで実際に開くファイル名
+const char *Manifest::path(const char *name) {
+	const MANIFEST_ENTRY *e = _find(name);
+	if (e == nullptr)
+		return nullptr;
+	return e->target[0] != 0 ? e->target : e->name;
+}
+
+size_t Manifest::_blocks(size_t size) {
+	return (size + MANIFEST_BLOCK_SIZE - 1) / MANIFEST_BLOCK_SIZE * MANIFEST_BLOCK_SIZE;
+}
+
+void Manifest::_erase(MANIFEST_ENTRY *e) {
+	*e = _entry[--_count];
+}
+
+// 書き込みの終わったファイルだけを調べ直し、使用量は差分で更新する
+// ハッシュが分かっていれば渡す(なければファイルを読んで計算する)
+bool Manifest::refresh(const char *path, const uint8_t *hash) {
+	File file = LittleFS.open(path, "r");
+	if (!file) {
+		remove(path);
+		return false;
+	}
+	size_t size = file.size();
+	file.close();
+	MANIFEST_ENTRY *e = _find(path);
+	if (e == nullptr) {
+		if (!_grow()) {
+			_usageValid = false;
+			return false;
+		}
+		e = &_entry[_count++];
+		strncpy(e->name, path, sizeof(e->name));
+		e->name[sizeof(e->name)-1] = 0;
+		e->target[0] = 0;
+		e->size = 0;
+	}
+	_usedBytes = _usedBytes - _blocks(e->size) + _blocks(size);
+	e->size = size;
+	MP3_INDEX_INFO info;
+	e->duration = Mp3Index::load(path, &info) ? info.duration : 0;
+	if (hash != nullptr)
+		memcpy(e->hash, hash, MANIFEST_HASH_SIZE);
+	else
+		_hashFile(path, e->hash);
+	_save();
+	return true;
+}
+
+// ファイルを消した後に呼ぶ(別名なら一覧から外すだけ)
+void Manifest::remove(const char *path) {
+	MANIFEST_ENTRY *e = _find(path);
+	if (e == nullptr)
+		return;
+	if (e->target[0] == 0) {
+		size_t blocks = _blocks(e->size);
+		_usedBytes = _usedBytes > blocks ? _usedBytes - blocks : 0;
+		for (int i = _count - 1; i >= 0; i--) {
+			if (strcmp(_entry[i].target, path) == 0)
+				_erase(&_entry[i]);
+		}
+		e = _find(path);
+	}
+	_erase(e);
+	_save();
+}
+
+// nameをtargetと同じ内容の別名にする(nameは一覧にないこと)
+bool Manifest::link(const char *name, const char *target) {
+	if (_find(target) == nullptr || _find(name) != nullptr || !_grow())
+		return false;
+	const MANIFEST_ENTRY *t = _find(target);
+	if (t->target[0] != 0)
+		t = _find(t->target);
+	MANIFEST_ENTRY *e = &_entry[_count++];
+	strncpy(e->name, name, sizeof(e->name));
+	e->name[sizeof(e->name)-1] = 0;
+	memcpy(e->target, t->name, sizeof(e->target));
+	memcpy(e->hash, t->hash, MANIFEST_HASH_SIZE);
+	e->size = t->size;
+	e->duration = t->duration;
+	_save();
+	return true;
+}
+
+bool Manifest::_move(const char *from, const char *to) {
+	if (!LittleFS.rename(from, to))
+		return false;
+	char fromPath[48];
+	char toPath[48];
+	Mp3Index::makePath(from, fromPath, sizeof(fromPath));
+	Mp3Index::makePath(to, toPath, sizeof(toPath));
+	LittleFS.rename(fromPath, toPath);
+	Envelope::makePath(from, fromPath, sizeof(fromPath));
+	Envelope::makePath(to, toPath, sizeof(toPath));
+	LittleFS.rename(fromPath, toPath);
+	return true;
+}
+
+// pathの名前を一覧から外す
+// 同じ内容の別名が残っていれば、ファイルをその名前へ移して残す
+// ファイルやインデックスを消す必要があればtrueを返す(その後でremove()を呼ぶ)
+bool Manifest::unlink(const char *path) {
+	MANIFEST_ENTRY *e = _find(path);
+	if (e == nullptr)
+		return true;
+	if (e->target[0] != 0) {
+		_erase(e);
+		_save();
+		return false;
+	}
+	MANIFEST_ENTRY *heir = nullptr;
+	for (int i = 0; i < _count; i++) {
+		if (strcmp(_entry[i].target, path) != 0)
+			continue;
+		if (heir == nullptr)
+			heir = &_entry[i];
+		else
+			memcpy(_entry[i].target, heir->name, sizeof(_entry[i].target));
+	}
+	if (heir == nullptr)
+		return true;
+	if (!_move(path, heir->name)) {
+		// 移せなければ別名ごと外す
+		char name[32];
+		memcpy(name, heir->name, sizeof(name));
+		for (int i = _count - 1; i >= 0; i--) {
+			if (strcmp(_entry[i].target, path) == 0 || strcmp(_entry[i].target, name) == 0)
+				_erase(&_entry[i]);
+		}
+		_save();
+		return true;
+	}
+	heir->target[0] = 0;
+	_erase(_find(path));
+	_save();
+	return false;
+}
+
+// 64桁の16進数
+const char *Manifest::parseHash(const char *ptr, uint8_t *hash) {
+	for (int i = 0; i < MANIFEST_HASH_SIZE; i++) {
+		if (!Utils::isHex(ptr[0]) || !Utils::isHex(ptr[1]))
+			return nullptr;
+		ptr = Utils::parseHexByte(ptr, &hash[i]);
+	}
+	if (*ptr != ' ' && *ptr != '\0')
+		return nullptr;
+	return ptr;
+}
+
+void Manifest::hashString(const uint8_t *hash, char *str) {
+	for (int i = 0; i < MANIFEST_HASH_SIZE; i++)
+		sprintf(&str[i * 2], "%02x", hash[i]);
+}
+
+// ダウンロードキャッシュや/.indexのインデックスと包絡線など、一覧にないファイルが変わった後だけ調べ直す
+// 一覧にあるファイルの増減は差分で更新する
+size_t Manifest::usedBytes() {
+	if (!_usageValid) {
+		_usageValid = true;
+		_usedBytes = LittleFS.usedBytes();
+	}
+	return _usedBytes;
+}
+
+// アップロード中の一時ファイルの分は予約として差し引く
+size_t Manifest::freeBytes() {
+	size_t used = usedBytes() + _reservedBytes;
+	return _totalBytes > used ? _totalBytes - used : 0;
+}
+
+// sizeバイトのファイルを保存するのに必要な容量
+size_t Manifest::required(size_t size) {
+	return _blocks(size) + UPLOAD_EXTRA_BLOCKS * MANIFEST_BLOCK_SIZE;
+}
@@ -0,0 +1,65 @@
+//
+// Created by agent on 2026/10/19.
+//
+
+#ifndef SLAPPYBELL_FIRMWARE_MANIFEST_H
+#define SLAPPYBELL_FIRMWARE_MANIFEST_H
+
+#include <Arduino.h>
+#include "config.h"
+
+typedef struct _MANIFEST_ENTRY {
+	char		name[32];		// "/sound1.mp3"
+	char		target[32];		// 別名なら同じ内容のファイル名(ファイルそのものなら空)
+	uint32_t	size;
+	uint32_t	duration;		// ms (インデックスがなければ0)
+	uint8_t		hash[MANIFEST_HASH_SIZE];
+} MANIFEST_ENTRY;
+
+// 内蔵ストレージに保存したmp3ファイルの一覧と使用量
+// 起動時に一度だけストレージを調べ、以降はアップロードと削除のたびに更新する
+// ファイルは内容のSHA-256でも引けるようにし、同じ内容は別名として1つのファイルを共有する
+class Manifest {
+private:
+	static MANIFEST_ENTRY *_entry;		// PSRAM (足りなくなったら広げる)
+	static int _count;
+	static int _capacity;
+	static size_t _totalBytes;
+	static size_t _usedBytes;
+	static size_t _storeSize;
+	static size_t _reservedBytes;
+	static volatile bool _usageValid;
+
+	static MANIFEST_ENTRY *_find(const char *path);
+	static bool _grow();
+	static size_t _blocks(size_t size);
+	static void _erase(MANIFEST_ENTRY *e);
+	static bool _hashFile(const char *path, uint8_t *hash);
+	static void _load();
+	static void _save();
+	static bool _move(const char *from, const char *to);
+public:
+	static void init();
+	static int count() { return _count; }
+	static const MANIFEST_ENTRY *entry(int index);
+	static const MANIFEST_ENTRY *find(const char *path) { return _find(path); }
+	static const MANIFEST_ENTRY *findHash(const uint8_t *hash);
+	static bool exists(const char *path) { return _find(path) != nullptr; }
+	static bool reserveEntry() { return _grow(); }
+	static const char *path(const char *name);
+	static bool refresh(const char *path, const uint8_t *hash = nullptr);
+	static void remove(const char *path);
+	static bool link(const char *name, const char *target);
+	static bool unlink(const char *path);
+	static const char *parseHash(const char *ptr, uint8_t *hash);
+	static void hashString(const uint8_t *hash, char *str);
+	static void invalidateUsage() { _usageValid = false; }
+	static size_t totalBytes() { return _totalBytes; }
+	static size_t usedBytes();
+	static size_t freeBytes();
+	static size_t required(size_t size);
+	static void reserve(size_t bytes) { _reservedBytes = bytes; }
+	static void release() { _reservedBytes = 0; }
+};
+
+#endif //SLAPPYBELL_FIRMWARE_MANIFEST_H
@@ -0,0 +1,351 @@
+//
+// Created by agent on 2026/10/19.
+//
+
+#include <Arduino.h>
+#include <Audio.h>
+#include <driver/i2s.h>
+
+#include "config.h"
+#include "mixer.h"
+#include "pcm_decoder.h"
+#include "status_code.h"
+#include "synth.h"
+
+extern Audio audio;
+
+MIXER_VOICE Mixer::_voice[MIXER_VOICES];
+uint32_t Mixer::_voiceSequence = 0;
+uint16_t Mixer::_masterGain = 256;
+uint32_t Mixer::_outputRate = MIXER_SAMPLE_RATE;
+bool Mixer::_pumping = false;
+int16_t Mixer::_block[MIXER_BLOCK_FRAMES * 2];
+size_t Mixer::_blockOffset = 0;
+size_t Mixer::_blockSize = 0;
+uint32_t Mixer::_cycles = 0;
+uint32_t Mixer::_voiceFrames = 0;
+uint32_t Mixer::_steals = 0;
+volatile uint32_t Mixer::_streamFrames = 0;
+
+// ボイスの割り当てと解放を、メインループでのsnapshot()と排他する
+// 毎フレームの位置の更新は排他しない
+static portMUX_TYPE voiceLock = portMUX_INITIALIZER_UNLOCKED;
+
+// Audioの出力1フレームごとに呼ばれる(下位16bitが左、上位16bitが右)
+void audio_process_i2s(uint32_t *sample, bool *continueI2S) {
+	Mixer::mix(sample, audio.getSampleRate());
+}
+
+static inline int16_t clip16(int32_t v) {
+	if (v > 32767)
+		return 32767;
+	if (v < -32768)
+		return -32768;
+	return (int16_t)v;
+}
+
+void Mixer::init() {
+	for (int i = 0; i < MIXER_VOICES; i++) {
+		_voice[i].entry = nullptr;
+		_voice[i].next = nullptr;
+		_voice[i].active = false;
+	}
+}
+
+void Mixer::_setRate(MIXER_VOICE *v, uint32_t rate) {
+	const uint8_t *h = v->entry->data;
+	uint32_t srcRate = h[24] | (h[25] << 8) | ((uint32_t)h[26] << 16) | ((uint32_t)h[27] << 24);
+	v->sourceRate = srcRate;
+	v->step = (uint32_t)(((uint64_t)srcRate << 16) / rate);
+}
+
+SOUND_CACHE_ENTRY *Mixer::_openPcm(const char *path, int *code) {
+	SOUND_CACHE_ENTRY *e = SoundCache::open(path);
+	if (e == nullptr) {
+		*code = CD_FILE_NOT_FOUND;
+		return nullptr;
+	}
+	if (e->pcm != SOUND_PCM_READY || e->size <= WAV_HEADER_SIZE) {
+		SoundCache::close(e);
+		*code = CD_FILE_IO_ERROR;
+		return nullptr;
+	}
+	*code = CD_SUCCESS;
+	return e;
+}
+
+void Mixer::_assign(MIXER_VOICE *v, SOUND_CACHE_ENTRY *e, uint16_t gain) {
+	v->entry = e;
+	v->samples = (const int16_t*)(e->data + WAV_HEADER_SIZE);
+	v->length = (e->size - WAV_HEADER_SIZE) / sizeof(int16_t);
+	v->gain = gain;
+	_setRate(v, _outputRate);
+}
+
+MIXER_VOICE *Mixer::_find(uint32_t id) {
+	for (int i = 0; i < MIXER_VOICES; i++) {
+		if (_voice[i].active && _voice[i].started == id)
+			return &_voice[i];
+	}
+	return nullptr;
+}
+
+int Mixer::play(const char *path, uint8_t gain, uint32_t *id) {
+	int code;
+	SOUND_CACHE_ENTRY *e = _openPcm(path, &code);
+	if (e == nullptr)
+		return code;
+	// 空きがなければ一番古いボイスを止めて使う
+	MIXER_VOICE *v = nullptr;
+	for (int i = 0; i < MIXER_VOICES; i++) {
+		MIXER_VOICE *c = &_voice[i];
+		if (!c->active) {
+			v = c;
+			break;
+		}
+		if (v == nullptr || c->started < v->started)
+			v = c;
+	}
+	if (v->active) {
+		_stopVoice(v);
+		_steals++;
+	}
+	portENTER_CRITICAL(&voiceLock);
+	_assign(v, e, (uint16_t)(gain * 256 / 100));
+	v->position = 0;
+	v->fraction = 0;
+	v->next = nullptr;
+	v->started = ++_voiceSequence;
+	v->active = true;
+	portEXIT_CRITICAL(&voiceLock);
+	if (id != nullptr)
+		*id = v->started;
+	return CD_SUCCESS;
+}
+
+int Mixer::chain(uint32_t id, const char *path, uint8_t gain) {
+	MIXER_VOICE *v = _find(id);
+	if (v == nullptr || v->next != nullptr)
+		return CD_ERROR;
+	int code;
+	SOUND_CACHE_ENTRY *e = _openPcm(path, &code);
+	if (e == nullptr)
+		return code;
+	portENTER_CRITICAL(&voiceLock);
+	v->nextGain = (uint16_t)(gain * 256 / 100);
+	v->next = e;
+	portEXIT_CRITICAL(&voiceLock);
+	return CD_SUCCESS;
+}
+
+bool Mixer::isPlaying(uint32_t id) {
+	return _find(id) != nullptr;
+}
+
+bool Mixer::hasNext(uint32_t id) {
+	MIXER_VOICE *v = _find(id);
+	return v != nullptr && v->next != nullptr;
+}
+
+void Mixer::_stopVoice(MIXER_VOICE *v) {
+	if (!v->active)
+		return;
+	portENTER_CRITICAL(&voiceLock);
+	SOUND_CACHE_ENTRY *entry = v->entry;
+	SOUND_CACHE_ENTRY *next = v->next;
+	v->active = false;
+	v->entry = nullptr;
+	v->next = nullptr;
+	portEXIT_CRITICAL(&voiceLock);
+	// キャッシュの排他は待つことがあるので、スピンロックの外で閉じる
+	SoundCache::close(entry);
+	if (next != nullptr)
+		SoundCache::close(next);
+}
+
+void Mixer::stop(const char *path) {
+	for (int i = 0; i < MIXER_VOICES; i++) {
+		MIXER_VOICE *v = &_voice[i];
+		if (v->active && (path == nullptr || strcmp(v->entry->name, path) == 0))
+			_stopVoice(v);
+	}
+	if (path == nullptr)
+		Synth::stop();
+}
+
+bool Mixer::isActive() {
+	return activeVoices() > 0 || Synth::isActive();
+}
+
+int Mixer::activeVoices() {
+	int n = 0;
+	for (int i = 0; i < MIXER_VOICES; i++) {
+		if (_voice[i].active)
+			n++;
+	}
+	return n;
+}
+
+bool Mixer::snapshot(int index, MIXER_VOICE_INFO *info) {
+	if (index < 0 || index >= MIXER_VOICES)
+		return false;
+	portENTER_CRITICAL(&voiceLock);
+	const MIXER_VOICE *v = &_voice[index];
+	bool active = v->active && v->entry != nullptr;
+	if (active) {
+		memcpy(info->name, v->entry->name, sizeof(info->name));
+		info->position = v->position;
+		info->length = v->length;
+		info->sourceRate = v->sourceRate;
+		info->gain = v->gain;
+		info->started = v->started;
+	}
+	portEXIT_CRITICAL(&voiceLock);
+	return active;
+}
+
+void Mixer::setVolume(uint8_t volume) {
+	// Audio::setVolume()と同じ0-21の値を、おおよそ同じカーブのゲインにする
+	_masterGain = (uint16_t)((uint32_t)volume * volume * 256 / (21 * 21));
+}
+
+uint32_t Mixer::cyclesPerVoiceFrame() {
+	if (_voiceFrames == 0)
+		return 0;
+	return _cycles / _voiceFrames;
+}
+
+// Audioが再生している音の、スピーカーから出ている位置(ms)
+uint32_t Mixer::streamTime() {
+	if (_outputRate == 0)
+		return 0;
+	uint32_t ms = (uint32_t)((uint64_t)_streamFrames * 1000 / _outputRate);
+	return ms > AUDIO_DMA_BUFFER_MS ? ms - AUDIO_DMA_BUFFER_MS : 0;
+}
+
+// 最後に鳴らし始めたボイスのファイル名と再生位置(ms)
+// ミキサはオーディオタスクで動いているので、値はコピーして返す
+bool Mixer::latest(char *name, size_t len, uint32_t *position) {
+	MIXER_VOICE_INFO latest;
+	latest.started = 0;
+	for (int i = 0; i < MIXER_VOICES; i++) {
+		MIXER_VOICE_INFO info;
+		if (snapshot(i, &info) && info.started > latest.started)
+			latest = info;
+	}
+	if (latest.started == 0 || latest.sourceRate == 0)
+		return false;
+	strncpy(name, latest.name, len);
+	name[len-1] = 0;
+	uint32_t ms = (uint32_t)((uint64_t)latest.position * 1000 / latest.sourceRate);
+	*position = ms > AUDIO_DMA_BUFFER_MS ? ms - AUDIO_DMA_BUFFER_MS : 0;
+	return true;
+}
+
+int32_t Mixer::_mixFrame() {
+	uint32_t start = ESP.getCycleCount();
+	int32_t acc = 0;
+	int active = 0;
+	for (int i = 0; i < MIXER_VOICES; i++) {
+		MIXER_VOICE *v = &_voice[i];
+		if (!v->active)
+			continue;
+		if (v->position >= v->length && v->next != nullptr) {
+			// 端数の位置を引き継いで次の音へ切り替える
+			SOUND_CACHE_ENTRY *done = v->entry;
+			portENTER_CRITICAL(&voiceLock);
+			v->position -= v->length;
+			_assign(v, v->next, v->nextGain);
+			v->next = nullptr;
+			portEXIT_CRITICAL(&voiceLock);
+			SoundCache::close(done);
+		}
+		if (v->position >= v->length) {
+			_stopVoice(v);
+			continue;
+		}
+		acc += ((int32_t)v->samples[v->position] * v->gain) >> 8;
+		uint32_t f = v->fraction + v->step;
+		v->position += f >> 16;
+		v->fraction = f & 0xFFFF;
+		active++;
+	}
+	if (Synth::isActive()) {
+		acc += Synth::next(_outputRate);
+		active++;
+	}
+	if (active == 0)
+		return 0;
+	acc = (acc * _masterGain) >> 8;
+	// 統計は溢れる前に半分にして平均を保つ
+	if (_cycles > 0x80000000) {
+		_cycles >>= 1;
+		_voiceFrames >>= 1;
+	}
+	_cycles += ESP.getCycleCount() - start;
+	_voiceFrames += active;
+	return acc;
+}
+
+void Mixer::mix(uint32_t *sample, uint32_t sampleRate) {
+	if (sampleRate != 0 && sampleRate != _outputRate) {
+		_outputRate = sampleRate;
+		for (int i = 0; i < MIXER_VOICES; i++) {
+			if (_voice[i].active)
+				_setRate(&_voice[i], _outputRate);
+		}
+	}
+	_streamFrames++;
+	int32_t acc = _mixFrame();
+	if (acc == 0)
+		return;
+	int16_t left = (int16_t)(*sample & 0xFFFF);
+	int16_t right = (int16_t)(*sample >> 16);
+	left = clip16(left + acc);
+	right = clip16(right + acc);
+	*sample = ((uint32_t)(uint16_t)right << 16) | (uint16_t)left;
+}
+
+void Mixer::pump() {
+	if (!_pumping) {
+		if (!isActive())
+			return;
+		_pumping = true;
+		_outputRate = MIXER_SAMPLE_RATE;
+		i2s_set_sample_rates(I2S_NUM_0, _outputRate);
+		for (int i = 0; i < MIXER_VOICES; i++) {
+			if (_voice[i].active)
+				_setRate(&_voice[i], _outputRate);
+		}
+	}
+	while (true) {
+		if (_blockOffset == _blockSize) {
+			if (!isActive()) {
+				// 最後のブロックを出力し終えたらDMAバッファを無音にする
+				i2s_zero_dma_buffer(I2S_NUM_0);
+				_pumping = false;
+				_blockOffset = 0;
+				_blockSize = 0;
+				return;
+			}
+			for (int i = 0; i < MIXER_BLOCK_FRAMES; i++) {
+				int16_t s = clip16(_mixFrame());
+				_block[i*2] = s;
+				_block[i*2+1] = s;
+			}
+			_blockOffset = 0;
+			_blockSize = sizeof(_block);
+		}
+		size_t written = 0;
+		i2s_write(I2S_NUM_0, (const uint8_t*)_block + _blockOffset, _blockSize - _blockOffset, &written, 0);
+		if (written == 0)
+			return;
+		_blockOffset += written;
+	}
+}
+
+void Mixer::pause() {
+	_pumping = false;
+	_blockOffset = 0;
+	_blockSize = 0;
+}
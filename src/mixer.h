@@ -0,0 +1,84 @@
+//
+// Created by agent on 2026/10/19.
+//
+
+#ifndef SLAPPYBELL_FIRMWARE_MIXER_H
+#define SLAPPYBELL_FIRMWARE_MIXER_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "sound_cache.h"
+
+typedef struct _MIXER_VOICE {
+	SOUND_CACHE_ENTRY*	entry;
+	const int16_t*		samples;
+	uint32_t			length;		// フレーム数
+	uint32_t			position;	// フレーム位置
+	uint16_t			fraction;	// positionの小数部(1/65536)
+	uint32_t			step;		// 16.16固定小数点
+	uint32_t			sourceRate;
+	uint16_t			gain;		// 256 = 1.0
+	uint32_t			started;
+	SOUND_CACHE_ENTRY*	next;		// 続けて鳴らすPCM(継ぎ目なし)
+	uint16_t			nextGain;
+	bool				active;
+} MIXER_VOICE;
+
+// メインループに渡すボイスの状態のコピー
+typedef struct _MIXER_VOICE_INFO {
+	char		name[32];
+	uint32_t	position;	// フレーム位置
+	uint32_t	length;		// フレーム数
+	uint32_t	sourceRate;
+	uint16_t	gain;		// 256 = 1.0
+	uint32_t	started;
+} MIXER_VOICE_INFO;
+
+// キャッシュ上のPCMとシンセサイザの音を同時に鳴らすソフトウェアミキサ
+// Audioの再生中はaudio_process_i2s()でAudioの出力に加算し、
+// Audioが停止している間はpump()で直接I2Sへ書き込む
+// ボイスはオーディオタスクで入れ替わるので、メインループへはsnapshot()でコピーを渡す
+class Mixer {
+private:
+	static MIXER_VOICE _voice[MIXER_VOICES];
+	static uint32_t _voiceSequence;
+	static uint16_t _masterGain;
+	static uint32_t _outputRate;
+	static bool _pumping;
+	static int16_t _block[MIXER_BLOCK_FRAMES * 2];
+	static size_t _blockOffset;
+	static size_t _blockSize;
+	static uint32_t _cycles;
+	static uint32_t _voiceFrames;
+	static uint32_t _steals;
+	static volatile uint32_t _streamFrames;
+
+	static void _stopVoice(MIXER_VOICE *v);
+	static int32_t _mixFrame();
+	static void _setRate(MIXER_VOICE *v, uint32_t rate);
+	static void _assign(MIXER_VOICE *v, SOUND_CACHE_ENTRY *e, uint16_t gain);
+	static SOUND_CACHE_ENTRY *_openPcm(const char *path, int *code);
+	static MIXER_VOICE *_find(uint32_t id);
+public:
+	static void init();
+	static int play(const char *path, uint8_t gain, uint32_t *id = nullptr);
+	static int chain(uint32_t id, const char *path, uint8_t gain);
+	static bool isPlaying(uint32_t id);
+	static bool hasNext(uint32_t id);
+	static void stop(const char *path = nullptr);
+	static bool isActive();
+	static int activeVoices();
+	static bool snapshot(int index, MIXER_VOICE_INFO *info);
+	static void setVolume(uint8_t volume);
+	static uint32_t steals() { return _steals; }
+	static uint32_t cyclesPerVoiceFrame();
+	static void resetStreamTime() { _streamFrames = 0; }
+	static uint32_t streamTime();
+	static bool latest(char *name, size_t len, uint32_t *position);
+
+	static void mix(uint32_t *sample, uint32_t sampleRate);
+	static void pump();
+	static void pause();
+};
+
+#endif //SLAPPYBELL_FIRMWARE_MIXER_H
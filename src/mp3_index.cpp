@@ -0,0 +1,247 @@
+//
+// Created by agent on 2026/10/19.
+//
+
+#include <Arduino.h>
+#include <FS.h>
+#include <LittleFS.h>
+
+#include "config.h"
+#include "manifest.h"
+#include "mp3_index.h"
+#include "pcm_decoder.h"
+
+#define MP3_INDEX_MAGIC			0x4D494431	// "MID1"
+#define MP3_FRAME_SAMPLES		1152
+#define MP3_SUPPORTED_RATE		44100
+#define MP3_MIN_BITRATE			96000
+#define MP3_MAX_BITRATE			192000
+
+static const uint16_t mpeg1Layer3BitRate[16] = {
+	0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0
+};
+static const uint32_t mpeg1SampleRate[4] = { 44100, 48000, 32000, 0 };
+
+void Mp3Scanner::begin() {
+	_state = MP3_SCAN_START;
+	_headerLen = 0;
+	_skip = 0;
+	_offset = 0;
+	_junk = 0;
+	_error = nullptr;
+	memset(&_info, 0, sizeof(_info));
+	_info.magic = MP3_INDEX_MAGIC;
+	_info.seekInterval = MP3_INDEX_SEEK_INTERVAL;
+}
+
+bool Mp3Scanner::_fail(const char *error) {
+	_state = MP3_SCAN_ERROR;
+	_error = error;
+	return false;
+}
+
+// 4バイトのフレームヘッダを確認する
+// 同期ワードでなければtrueを返してそのまま探し続ける
+bool Mp3Scanner::_frame(uint32_t offset) {
+	const uint8_t *h = _header;
+	if (h[0] != 0xFF || (h[1] & 0xE0) != 0xE0)
+		return true;
+	uint8_t version = (h[1] >> 3) & 3;
+	uint8_t layer = (h[1] >> 1) & 3;
+	uint8_t rateIndex = h[2] >> 4;
+	uint8_t freqIndex = (h[2] >> 2) & 3;
+	if (version == 1 || layer == 0 || rateIndex == 0 || rateIndex == 15 || freqIndex == 3)
+		return true;
+	if (version != 3 || layer != 1)
+		return _fail("not MPEG1 Layer3");
+	uint32_t bitRate = mpeg1Layer3BitRate[rateIndex] * 1000;
+	uint32_t sampleRate = mpeg1SampleRate[freqIndex];
+	if (sampleRate != MP3_SUPPORTED_RATE)
+		return _fail("sample rate");
+	if (bitRate < MP3_MIN_BITRATE || bitRate > MP3_MAX_BITRATE)
+		return _fail("bit rate");
+	if (_info.frames == 0) {
+		_info.dataOffset = offset;
+		_info.bitRate = bitRate;
+		_info.sampleRate = sampleRate;
+		_info.channels = (h[3] >> 6) == 3 ? 1 : 2;
+	} else if (bitRate != _info.bitRate) {
+		return _fail("VBR");
+	}
+
+	// テーブルが一杯になったら間引いて間隔を倍にする
+	if (_info.frames % _info.seekInterval == 0) {
+		if (_info.seekCount == MP3_INDEX_SEEK_ENTRIES) {
+			for (int i = 0; i < MP3_INDEX_SEEK_ENTRIES / 2; i++)
+				_seek[i] = _seek[i * 2];
+			_info.seekCount = MP3_INDEX_SEEK_ENTRIES / 2;
+			_info.seekInterval *= 2;
+		}
+		if (_info.frames % _info.seekInterval == 0)
+			_seek[_info.seekCount++] = offset;
+	}
+	_info.frames++;
+
+	uint32_t length = 144 * bitRate / sampleRate + ((h[2] >> 1) & 1);
+	_skip = length - 4;
+	_state = _skip > 0 ? MP3_SCAN_SKIP : MP3_SCAN_HEADER;
+	_headerLen = 0;
+	return true;
+}
+
+bool Mp3Scanner::feed(const uint8_t *data, size_t size) {
+	while (size > 0) {
+		switch (_state) {
+		case MP3_SCAN_ERROR:
+			return false;
+		case MP3_SCAN_SKIP: {
+			size_t n = size < _skip ? size : _skip;
+			data += n;
+			size -= n;
+			_offset += n;
+			_skip -= n;
+			if (_skip == 0)
+				_state = MP3_SCAN_HEADER;
+			break;
+		}
+		case MP3_SCAN_START:
+			_header[_headerLen++] = *data++;
+			size--;
+			_offset++;
+			if (_headerLen < 10)
+				break;
+			if (_header[0] == 'I' && _header[1] == 'D' && _header[2] == '3') {
+				_skip = ((uint32_t)(_header[6] & 0x7F) << 21) | ((uint32_t)(_header[7] & 0x7F) << 14) |
+					((uint32_t)(_header[8] & 0x7F) << 7) | (_header[9] & 0x7F);
+				if (_header[5] & 0x10)
+					_skip += 10;
+				_headerLen = 0;
+				_state = _skip > 0 ? MP3_SCAN_SKIP : MP3_SCAN_HEADER;
+			} else {
+				// タグがなければ読んだ10バイトをフレームとして読み直す
+				uint8_t head[10];
+				memcpy(head, _header, sizeof(head));
+				_headerLen = 0;
+				_offset -= sizeof(head);
+				_state = MP3_SCAN_HEADER;
+				if (!feed(head, sizeof(head)))
+					return false;
+			}
+			break;
+		case MP3_SCAN_HEADER:
+			_header[_headerLen++] = *data++;
+			size--;
+			_offset++;
+			if (_headerLen < 4)
+				break;
+			if (!_frame(_offset - 4))
+				return false;
+			if (_headerLen == 4) {
+				// 同期が取れないので1バイトずらして探す
+				memmove(_header, _header + 1, 3);
+				_headerLen = 3;
+				if (++_junk > MP3_SCAN_MAX_JUNK)
+					return _fail(_info.frames == 0 ? "no mp3 frame" : "broken stream");
+			}
+			break;
+		}
+	}
+	return true;
+}
+
+bool Mp3Scanner::finish() {
+	if (_state == MP3_SCAN_ERROR)
+		return false;
+	if (_info.frames == 0)
+		return _fail("no mp3 frame");
+	_info.duration = (uint32_t)((uint64_t)_info.frames * MP3_FRAME_SAMPLES * 1000 / _info.sampleRate);
+	return true;
+}
+
+bool Mp3Scanner::save(const char *path) const {
+	char indexPath[48];
+	Mp3Index::makePath(path, indexPath, sizeof(indexPath));
+	File file = LittleFS.open(indexPath, "w");
+	if (!file)
+		return false;
+	bool success = file.write((const uint8_t*)&_info, sizeof(_info)) == sizeof(_info) &&
+		file.write((const uint8_t*)_seek, _info.seekCount * sizeof(uint32_t)) == _info.seekCount * sizeof(uint32_t);
+	file.close();
+	if (!success)
+		LittleFS.remove(indexPath);
+	// 一覧にないファイルなので、使用量は調べ直してもらう
+	Manifest::invalidateUsage();
+	return success;
+}
+
+void Mp3Index::makePath(const char *path, char *indexPath, size_t len) {
+	snprintf(indexPath, len, MP3_INDEX_DIR "%s", path);
+}
+
+// インデックスのないファイル(以前のバージョンで保存したもの)は起動時に作る
+void Mp3Index::init() {
+	if (!LittleFS.exists(MP3_INDEX_DIR))
+		LittleFS.mkdir(MP3_INDEX_DIR);
+	File root = LittleFS.open("/");
+	File file = root.openNextFile();
+	while (file) {
+		if (!file.isDirectory()) {
+			char path[32];
+			char indexPath[48];
+			snprintf(path, sizeof(path), "/%s", file.name());
+			file.close();
+			makePath(path, indexPath, sizeof(indexPath));
+			if (!LittleFS.exists(indexPath))
+				build(path);
+		}
+		file = root.openNextFile();
+	}
+}
+
+bool Mp3Index::build(const char *path) {
+	File file = LittleFS.open(path, "r");
+	if (!file)
+		return false;
+	Mp3Scanner scanner;
+	uint8_t buffer[512];
+	bool success = true;
+	while (success) {
+		size_t n = file.read(buffer, sizeof(buffer));
+		if (n == 0)
+			break;
+		success = scanner.feed(buffer, n);
+	}
+	file.close();
+	if (!success || !scanner.finish())
+		return false;
+	return scanner.save(path);
+}
+
+bool Mp3Index::load(const char *path, MP3_INDEX_INFO *info) {
+	char indexPath[48];
+	makePath(path, indexPath, sizeof(indexPath));
+	File file = LittleFS.open(indexPath, "r");
+	if (!file)
+		return false;
+	bool success = file.read((uint8_t*)info, sizeof(*info)) == sizeof(*info) && info->magic == MP3_INDEX_MAGIC;
+	file.close();
+	return success;
+}
+
+void Mp3Index::remove(const char *path) {
+	char indexPath[48];
+	makePath(path, indexPath, sizeof(indexPath));
+	if (LittleFS.exists(indexPath)) {
+		LittleFS.remove(indexPath);
+		Manifest::invalidateUsage();
+	}
+}
+
+// PCMに変換した場合の大きさ(モノラル16bit、WAVヘッダを含む)
+// インデックスがなければ0を返す
+size_t Mp3Index::pcmSize(const char *path) {
+	MP3_INDEX_INFO info;
+	if (!load(path, &info))
+		return 0;
+	return info.frames * MP3_FRAME_SAMPLES * sizeof(int16_t) + WAV_HEADER_SIZE;
+}
@@ -0,0 +1,70 @@
+//
+// Created by agent on 2026/10/19.
+//
+
+#ifndef SLAPPYBELL_FIRMWARE_MP3_INDEX_H
+#define SLAPPYBELL_FIRMWARE_MP3_INDEX_H
+
+#include <Arduino.h>
+#include "config.h"
+
+// /.index/<ファイル名> に保存するmp3ファイルの情報
+// この後にseekCount個のフレーム位置(uint32_t)が続く
+typedef struct _MP3_INDEX_INFO {
+	uint32_t	magic;
+	uint32_t	dataOffset;		// 最初のフレームの位置
+	uint32_t	frames;
+	uint32_t	duration;		// ms
+	uint32_t	bitRate;		// bps
+	uint32_t	sampleRate;
+	uint8_t		channels;
+	uint8_t		reserved;
+	uint16_t	seekInterval;	// シークテーブルの間隔(フレーム数)
+	uint16_t	seekCount;
+	uint16_t	reserved2;
+} MP3_INDEX_INFO;
+
+enum Mp3ScanState {
+	MP3_SCAN_START,			// ID3v2タグの確認
+	MP3_SCAN_HEADER,		// フレームヘッダの読み込み
+	MP3_SCAN_SKIP,			// タグやフレーム本体の読み飛ばし
+	MP3_SCAN_ERROR,
+};
+
+// 分割して届くmp3のデータからフレームヘッダを拾い、
+// 再生できる形式(MPEG1 Layer3, 44.1kHz, 96~192kbps CBR)か確認する
+class Mp3Scanner {
+private:
+	Mp3ScanState _state;
+	uint8_t _header[10];
+	size_t _headerLen;
+	uint32_t _skip;
+	uint32_t _offset;
+	uint32_t _junk;
+	const char *_error;
+	MP3_INDEX_INFO _info;
+	uint32_t _seek[MP3_INDEX_SEEK_ENTRIES];
+
+	bool _fail(const char *error);
+	bool _frame(uint32_t offset);
+public:
+	Mp3Scanner() { begin(); }
+	void begin();
+	bool feed(const uint8_t *data, size_t size);
+	bool finish();
+	const char *error() const { return _error; }
+	const MP3_INDEX_INFO &info() const { return _info; }
+	bool save(const char *path) const;
+};
+
+class Mp3Index {
+public:
+	static void makePath(const char *path, char *indexPath, size_t len);
+	static void init();
+	static bool build(const char *path);
+	static bool load(const char *path, MP3_INDEX_INFO *info);
+	static void remove(const char *path);
+	static size_t pcmSize(const char *path);
+};
+
+#endif //SLAPPYBELL_FIRMWARE_MP3_INDEX_H
@@ -0,0 +1,175 @@
+//
+// Created by agent on 2026/10/19.
+//
+
+#include <Arduino.h>
+#include "mp3_decoder/mp3_decoder.h"
+
+#include "pcm_decoder.h"
+
+#define MP3_MAX_FRAME_SAMPLES	(1152*2)
+#define MP3_ERR_NONE					 0
+#define MP3_ERR_INDATA_UNDERFLOW		-1
+#define MP3_ERR_MAINDATA_UNDERFLOW		-2
+
+static void putLE16(uint8_t *p, uint16_t v) {
+	p[0] = v & 0xFF;
+	p[1] = (v >> 8) & 0xFF;
+}
+
+static void putLE32(uint8_t *p, uint32_t v) {
+	p[0] = v & 0xFF;
+	p[1] = (v >> 8) & 0xFF;
+	p[2] = (v >> 16) & 0xFF;
+	p[3] = (v >> 24) & 0xFF;
+}
+
+PcmDecoder::PcmDecoder() {
+	_in = nullptr;
+	_inLeft = 0;
+	_out = nullptr;
+	_outSize = 0;
+	_outCapacity = 0;
+	_frame = nullptr;
+	_sampleRate = 0;
+	_keep = true;
+	_envelope = nullptr;
+	_active = false;
+}
+
+PcmDecoder::~PcmDecoder() {
+	cancel();
+}
+
+bool PcmDecoder::begin(const uint8_t *mp3, size_t size, size_t maxOutput, bool keep, EnvelopeBuilder *envelope) {
+	cancel();
+	// ID3v2タグを読み飛ばす
+	size_t offset = 0;
+	if (size > 10 && mp3[0] == 'I' && mp3[1] == 'D' && mp3[2] == '3') {
+		offset = 10 + (((size_t)mp3[6] & 0x7F) << 21 | ((size_t)mp3[7] & 0x7F) << 14 |
+			((size_t)mp3[8] & 0x7F) << 7 | ((size_t)mp3[9] & 0x7F));
+		if (mp3[5] & 0x10)
+			offset += 10;
+		if (offset >= size)
+			return false;
+	}
+	_frame = (int16_t*)malloc(MP3_MAX_FRAME_SAMPLES * sizeof(int16_t));
+	_out = (uint8_t*)ps_malloc(maxOutput);
+	if (_frame == nullptr || _out == nullptr || !MP3Decoder_AllocateBuffers()) {
+		free(_frame);
+		free(_out);
+		_frame = nullptr;
+		_out = nullptr;
+		return false;
+	}
+	_in = mp3 + offset;
+	_inLeft = (int)(size - offset);
+	_outSize = WAV_HEADER_SIZE;
+	_outCapacity = maxOutput;
+	_sampleRate = 0;
+	_keep = keep;
+	_envelope = envelope;
+	if (_envelope != nullptr)
+		_envelope->begin();
+	_active = true;
+	return true;
+}
+
+PcmDecodeResult PcmDecoder::step(int frames) {
+	if (!_active)
+		return PCM_DECODE_ERROR;
+	while (frames-- > 0) {
+		int sync = MP3FindSyncWord((unsigned char*)_in, _inLeft);
+		if (sync < 0)
+			return PCM_DECODE_DONE;
+		_in += sync;
+		_inLeft -= sync;
+
+		int before = _inLeft;
+		int ret = MP3Decode((unsigned char*)_in, &_inLeft, _frame, 0);
+		_in += before - _inLeft;
+		if (ret == MP3_ERR_INDATA_UNDERFLOW)
+			return PCM_DECODE_DONE;
+		if (ret == MP3_ERR_MAINDATA_UNDERFLOW)
+			continue;
+		if (ret != MP3_ERR_NONE) {
+			// 壊れたフレームは1バイト進めて再同期する
+			if (before == _inLeft && _inLeft > 0) {
+				_in++;
+				_inLeft--;
+			}
+			continue;
+		}
+
+		uint32_t rate = MP3GetSampRate();
+		if (_sampleRate == 0)
+			_sampleRate = rate;
+		else if (_sampleRate != rate)
+			return PCM_DECODE_ERROR;
+		int channels = MP3GetChannels();
+		int samples = MP3GetOutputSamps() / (channels > 0 ? channels : 1);
+		if (_outSize + samples * sizeof(int16_t) > _outCapacity)
+			return PCM_DECODE_ERROR;
+
+		// スピーカーは1つなのでモノラルにまとめて保持する
+		int16_t *out = (int16_t*)(_out + _outSize);
+		if (channels == 2) {
+			for (int i = 0; i < samples; i++)
+				out[i] = (int16_t)(((int32_t)_frame[i*2] + _frame[i*2+1]) / 2);
+		} else {
+			memcpy(out, _frame, samples * sizeof(int16_t));
+		}
+		if (_envelope != nullptr)
+			_envelope->add(out, samples, rate);
+		if (_keep)
+			_outSize += samples * sizeof(int16_t);
+	}
+	return PCM_DECODE_CONTINUE;
+}
+
+void PcmDecoder::cancel() {
+	if (_frame != nullptr)
+		MP3Decoder_FreeBuffers();
+	free(_frame);
+	free(_out);
+	_frame = nullptr;
+	_out = nullptr;
+	_in = nullptr;
+	_inLeft = 0;
+	_outSize = 0;
+	_outCapacity = 0;
+	_envelope = nullptr;
+	_active = false;
+}
+
+void PcmDecoder::_writeHeader() {
+	uint32_t dataSize = _outSize - WAV_HEADER_SIZE;
+	uint8_t *h = _out;
+	memcpy(h, "RIFF", 4);
+	putLE32(h + 4, 36 + dataSize);
+	memcpy(h + 8, "WAVEfmt ", 8);
+	putLE32(h + 16, 16);
+	putLE16(h + 20, 1);					// PCM
+	putLE16(h + 22, 1);					// mono
+	putLE32(h + 24, _sampleRate);
+	putLE32(h + 28, _sampleRate * 2);	// byte rate
+	putLE16(h + 32, 2);					// block align
+	putLE16(h + 34, 16);				// bits per sample
+	memcpy(h + 36, "data", 4);
+	putLE32(h + 40, dataSize);
+}
+
+uint8_t *PcmDecoder::release(size_t *size) {
+	if (!_active || !_keep || _sampleRate == 0 || _outSize <= WAV_HEADER_SIZE) {
+		cancel();
+		return nullptr;
+	}
+	_writeHeader();
+	uint8_t *out = (uint8_t*)ps_realloc(_out, _outSize);
+	if (out == nullptr)
+		out = _out;
+	*size = _outSize;
+	_out = nullptr;
+	cancel();
+	return out;
+}
@@ -0,0 +1,50 @@
+//
+// Created by agent on 2026/10/19.
+//
+
+#ifndef SLAPPYBELL_FIRMWARE_PCM_DECODER_H
+#define SLAPPYBELL_FIRMWARE_PCM_DECODER_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "envelope.h"
+
+#define WAV_HEADER_SIZE 44
+#define PCM_FRAME_SIZE	(WAV_HEADER_SIZE + 1152 * 2)	// 1フレーム分だけ出力する場合の大きさ
+
+enum PcmDecodeResult {
+	PCM_DECODE_CONTINUE,
+	PCM_DECODE_DONE,
+	PCM_DECODE_ERROR,
+};
+
+// mp3データをモノラル16bitのWAVデータにデコードする
+// デコーダのバッファはAudioと共有のため、Audioの再生中には使用できない
+// step()で数フレームずつデコードし、メインループを長時間止めないようにする
+// keepにfalseを指定すると出力を残さず、包絡線だけを求める
+class PcmDecoder {
+private:
+	const uint8_t*	_in;
+	int				_inLeft;
+	uint8_t*		_out;
+	size_t			_outSize;
+	size_t			_outCapacity;
+	int16_t*		_frame;
+	uint32_t		_sampleRate;
+	bool			_keep;
+	EnvelopeBuilder* _envelope;
+	bool			_active;
+
+	void _writeHeader();
+public:
+	PcmDecoder();
+	~PcmDecoder();
+	bool begin(const uint8_t *mp3, size_t size, size_t maxOutput, bool keep = true, EnvelopeBuilder *envelope = nullptr);
+	PcmDecodeResult step(int frames);
+	void cancel();
+	bool isActive() const { return _active; }
+	uint8_t *release(size_t *size);
+	uint32_t sampleRate() const { return _sampleRate; }
+};
+
+#endif //SLAPPYBELL_FIRMWARE_PCM_DECODER_H
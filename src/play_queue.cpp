@@ -0,0 +1,44 @@
+//
+// Created by agent on 2026/10/19.
+//
+
+#include "play_queue.h"
+
+PLAY_QUEUE_ITEM PlayQueue::_item[PLAY_QUEUE_LENGTH];
+int PlayQueue::_head = 0;
+int PlayQueue::_count = 0;
+
+bool PlayQueue::push(const char *name, uint8_t gain) {
+	if (_count >= PLAY_QUEUE_LENGTH || strlen(name) >= sizeof(_item[0].name))
+		return false;
+	PLAY_QUEUE_ITEM *item = &_item[(_head + _count) % PLAY_QUEUE_LENGTH];
+	strcpy(item->name, name);
+	item->gain = gain;
+	item->prerolled = false;
+	_count++;
+	return true;
+}
+
+PLAY_QUEUE_ITEM *PlayQueue::front() {
+	if (_count == 0)
+		return nullptr;
+	return &_item[_head];
+}
+
+void PlayQueue::pop() {
+	if (_count == 0)
+		return;
+	_head = (_head + 1) % PLAY_QUEUE_LENGTH;
+	_count--;
+}
+
+void PlayQueue::clear() {
+	_head = 0;
+	_count = 0;
+}
+
+const PLAY_QUEUE_ITEM *PlayQueue::item(int index) {
+	if (index < 0 || index >= _count)
+		return nullptr;
+	return &_item[(_head + index) % PLAY_QUEUE_LENGTH];
+}
@@ -0,0 +1,32 @@
+//
+// Created by agent on 2026/10/19.
+//
+
+#ifndef SLAPPYBELL_FIRMWARE_PLAY_QUEUE_H
+#define SLAPPYBELL_FIRMWARE_PLAY_QUEUE_H
+
+#include <Arduino.h>
+#include "config.h"
+
+typedef struct _PLAY_QUEUE_ITEM {
+	char		name[80];		// "/sound1.mp3" または "http://..."
+	uint8_t		gain;
+	bool		prerolled;		// 次の再生の準備済み
+} PLAY_QUEUE_ITEM;
+
+// 続けて再生するファイルの待ち行列(リングバッファ)
+class PlayQueue {
+private:
+	static PLAY_QUEUE_ITEM _item[PLAY_QUEUE_LENGTH];
+	static int _head;
+	static int _count;
+public:
+	static bool push(const char *name, uint8_t gain);
+	static PLAY_QUEUE_ITEM *front();
+	static void pop();
+	static void clear();
+	static int count() { return _count; }
+	static const PLAY_QUEUE_ITEM *item(int index);
+};
+
+#endif //SLAPPYBELL_FIRMWARE_PLAY_QUEUE_H
@@ -4,18 +4,32 @@
 
 #include <FS.h>
 #include <LittleFS.h>
-#include <Audio.h>
+#include <Preferences.h>
 #include <WiFi.h>
 #include <esp_wifi.h>
 
 #include "transport.h"
 #include "processor.h"
+#include "audio_task.h"
+#include "bundle.h"
+#include "cpu_governor.h"
+#include "envelope.h"
+#include "event_loop.h"
+#include "http_cache.h"
 #include "led_sequencer.h"
+#include "manifest.h"
+#include "mixer.h"
+#include "mp3_index.h"
+#include "play_queue.h"
+#include "profiler.h"
+#include "sound_cache.h"
 #include "status_code.h"
+#include "stream_buffer.h"
+#include "synth.h"
+#include "timer_wheel.h"
+#include "trace.h"
 #include "utils.h"
 
-Audio audio;
-
 enum CommandId
 {
     WiFiConnect,
@@ -33,7 +47,6 @@ Processor* Processor::_instance = nullptr;
 Processor::Processor()
 {
     _instance = this;
-    _cpuClockHigh = true;
     _receiveBuffer[0] = '\0';
     _receiveBufferReadPtr = _receiveBuffer;
     _receiveBufferWritePtr = _receiveBuffer;
@@ -46,16 +59,50 @@ Processor::Processor()
     _wifiStatus = WIFI_CLOSE;
     _wifiDisconnectReason = 0;
     _wifiNotifyPending = false;
-    _lastWifiConnectTime = 0;
+    _wifiRetryTimer = 0;
+    _wifiRetryEnabled = false;
+    _wifiRetryCount = 0;
+    _wifiSsid[0] = 0;
+    _wifiPassword[0] = 0;
+    memset(_wifiBssid, 0, sizeof(_wifiBssid));
+    _wifiChannel = 0;
+    _wifiFastConnect = false;
+    _wifiApChanged = false;
+    _wifiConnectStart = 0;
+    _wifiConnectTime = 0;
+    _wifiEventRegistered = false;
+    _wifiIdleTimer = 0;
+    _wifiLastUse = 0;
+    _wifiPendingPlay.timer = 0;
+    _wifiSleeps = 0;
+    _wifiHeapOn = 0;
+    _wifiHeapOff = 0;
 
     _uploadFileSize = 0;
     _receiveFileSize = 0;
     _fileUploadStatus = 0;
     _lastUploadTime = 0;
+    _uploadTimer = 0;
     _lastAvailable = 0;
+    _uploadCrc = 0xFFFF;
+    _uploadExpectedCrc = 0;
+    _uploadCheckCrc = false;
+    mbedtls_sha256_init(&_uploadHash);
+    _uploadBundle = false;
 
+    _uploadFileName[0] = 0;
     _playFileName[0] = 0;
+    _queueActive = false;
+    _queueStarted = false;
+    _queueNotifyPending = false;
+    _queueVoice = 0;
+    _streamPaused = false;
     _serialDisconnectTime = 0;
+    _serialDisconnectTimer = 0;
+    for (int i = 0; i < MAX_SLOT_COUNT; i++)
+        _ledTimer[i] = 0;
+    for (int i = 0; i < DELAYED_PLAY_ENTRIES; i++)
+        _delayedPlay[i].timer = 0;
     _firstConnect = true;
 
     _currentTransport = nullptr;
@@ -97,6 +144,14 @@ const char* Processor::getMessageFromCode(int code)
         return RC_NO_WIFI_CONNECTION;
     case CD_WIFI_CONNECT_FAILED:
         return RC_WIFI_CONNECT_FAILED;
+    case CD_UNSUPPORTED_FORMAT:
+        return RC_UNSUPPORTED_FORMAT;
+    case CD_CHECKSUM_ERROR:
+        return RC_CHECKSUM_ERROR;
+    case CD_TIMER_FULL:
+        return RC_TIMER_FULL;
+    case CD_FILE_IN_USE:
+        return RC_FILE_IN_USE;
     case CD_WIFI_CONNECTED:
         return RC_WIFI_CONNECTED;
     case CD_WIFI_SSID_NOT_FOUND:
@@ -109,6 +164,16 @@ const char* Processor::getMessageFromCode(int code)
         return RC_TIMEOUT;
     case CD_OVERFLOW:
         return RC_OVERFLOW;
+    case CD_QUEUE_FULL:
+        return RC_QUEUE_FULL;
+    case CD_QUEUE_FINISHED:
+        return RC_QUEUE_FINISHED;
+    case CD_STREAM_REBUFFERING:
+        return RC_STREAM_REBUFFERING;
+    case CD_STREAM_RESUMED:
+        return RC_STREAM_RESUMED;
+    case CD_QUEUE_SKIPPED:
+        return RC_QUEUE_SKIPPED;
     default:
         return RC_ERROR;
     }
@@ -141,6 +206,7 @@ const char* Processor::getWifiStatusMessage(wl_status_t s)
 
 void Processor::sendNotify(int code, bool hasBody)
 {
+    Trace::record(TRACE_NOTIFY, code);
     const char* statusLine = getMessageFromCode(code);
     Utils::init_buffer(&_messageBufferRef, _messageBuffer, sizeof(_messageBuffer));
     if (hasBody)
@@ -158,6 +224,7 @@ void Processor::sendNotify(int code, bool hasBody)
 
 void Processor::sendResponse(int code, bool hasBody)
 {
+    Trace::record(TRACE_RESPONSE, code);
     const char* statusLine = getMessageFromCode(code);
     Utils::init_buffer(&_messageBufferRef, _messageBuffer, sizeof(_messageBuffer));
     if (hasBody)
@@ -175,6 +242,7 @@ void Processor::sendResponse(int code, bool hasBody)
 
 void Processor::sendResponse(int code, bool hasBody, const char* format, ...)
 {
+    Trace::record(TRACE_RESPONSE, code);
     Utils::init_buffer(&_messageBufferRef, _messageBuffer, sizeof(_messageBuffer));
     Utils::printf_buffer(&_messageBufferRef, RESPONSE_PREFIX " %s", getMessageFromCode(code));
     if (format != nullptr)
@@ -223,6 +291,17 @@ void Processor::flushSendBuffer()
     Utils::init_buffer(&_messageBufferRef, _messageBuffer, sizeof(_messageBuffer));
 }
 
+// 1行が通信のパケットをまたがないように、入りきらなければ先に送信する
+void Processor::reserveBody(size_t len)
+{
+    size_t used = _messageBufferRef.ptr - _messageBuffer;
+    size_t packet = _currentTransport != nullptr ? _currentTransport->packetSize() : sizeof(_messageBuffer);
+    if (packet > sizeof(_messageBuffer))
+        packet = sizeof(_messageBuffer);
+    if (used > 0 && (used + len > packet || len >= _messageBufferRef.remain))
+        flushSendBuffer();
+}
+
 void Processor::sendMessage(const char* message)
 {
     if (_currentTransport == nullptr)
@@ -232,18 +311,70 @@ void Processor::sendMessage(const char* message)
 
 void Processor::init()
 {
-    setCpuFrequencyMhz(160);
-    _cpuClockHigh = false;
+    CpuGovernor::init(millis());
+    TimerWheel::init(millis());
     if (!LittleFS.begin())
     {
         LittleFS.format();
     }
+    // 前回中断したアップロードの一時ファイルを消す
+    if (!LittleFS.exists(UPLOAD_TEMP_DIR))
+        LittleFS.mkdir(UPLOAD_TEMP_DIR);
+    else if (LittleFS.exists(UPLOAD_TEMP_PATH))
+        LittleFS.remove(UPLOAD_TEMP_PATH);
+    Mp3Index::init();
+    Manifest::init();
+    Bundle::init();
+    SoundCache::init();
+    HttpCache::init();
     pinMode(PIN_SD_MODE, OUTPUT);
     digitalWrite(PIN_SD_MODE, HIGH);
-    audio.setPinout(PIN_I2S_BCLK, PIN_I2S_LRC, PIN_I2S_DOUT);
-    audio.setVolume(21); // 0...21
-    WiFi.onEvent(onWiFiEvent);
+    AudioTask::init();
     LedSequencer::init();
+    // 保存したネットワークがあれば、ホストからの指示を待たずにつなぐ
+    loadWifiSettings();
+    if (_wifiSsid[0] != 0)
+        wifiConnect(millis());
+}
+
+void Processor::loadWifiSettings()
+{
+    Preferences prefs;
+    if (prefs.begin(PREFERENCES_NAMESPACE, true))
+    {
+        if (prefs.isKey("wifi-ssid"))
+        {
+            prefs.getString("wifi-ssid", _wifiSsid, sizeof(_wifiSsid));
+            prefs.getString("wifi-pass", _wifiPassword, sizeof(_wifiPassword));
+            if (prefs.getBytes("wifi-bssid", _wifiBssid, sizeof(_wifiBssid)) == sizeof(_wifiBssid))
+                _wifiChannel = prefs.getUChar("wifi-ch", 0);
+        }
+        prefs.end();
+    }
+}
+
+// SSIDが空ならネットワークの設定を消す
+void Processor::saveWifiSettings()
+{
+    Preferences prefs;
+    if (prefs.begin(PREFERENCES_NAMESPACE, false))
+    {
+        if (_wifiSsid[0] == 0)
+        {
+            prefs.remove("wifi-ssid");
+            prefs.remove("wifi-pass");
+            prefs.remove("wifi-bssid");
+            prefs.remove("wifi-ch");
+        }
+        else
+        {
+            prefs.putString("wifi-ssid", _wifiSsid);
+            prefs.putString("wifi-pass", _wifiPassword);
+            prefs.putBytes("wifi-bssid", _wifiBssid, sizeof(_wifiBssid));
+            prefs.putUChar("wifi-ch", _wifiChannel);
+        }
+        prefs.end();
+    }
 }
 
 void Processor::onWiFiEvent(WiFiEvent_t event, WiFiEventInfo_t info)
@@ -251,25 +382,158 @@ void Processor::onWiFiEvent(WiFiEvent_t event, WiFiEventInfo_t info)
     switch (event)
     {
     case SYSTEM_EVENT_STA_CONNECTED:
-        _instance->onWifiConnect(millis());
+        Trace::record(TRACE_WIFI, event, info.wifi_sta_connected.channel);
+        _instance->onWifiConnect(millis(), info.wifi_sta_connected.bssid, info.wifi_sta_connected.channel);
         break;
 
     case SYSTEM_EVENT_STA_DISCONNECTED:
+        Trace::record(TRACE_WIFI, event, info.wifi_sta_disconnected.reason);
         _instance->onWifiDisconnect(millis(), info.wifi_sta_disconnected.reason);
         break;
     }
+    EventLoop::post(EVENT_WIFI);
 }
 
-void Processor::wifiConnect(const char* ssid, const char* passwd)
+// Wi-Fiのドライバは最初に使うときに起動し、使わない時間が続くとwifiSleep()で止める
+void Processor::wifiConnect(uint32_t now)
 {
-    WiFi.setAutoReconnect(true);
-    WiFi.begin(ssid, passwd);
+    if (!_wifiEventRegistered)
+    {
+        WiFi.onEvent(onWiFiEvent);
+        _wifiEventRegistered = true;
+    }
+    // 切断時のつなぎ直しはコアに任せず、scheduleWifiRetry()で間隔を空けて行う
+    WiFi.setAutoReconnect(false);
+    // 前回つながったアクセスポイントが分かっていれば、全チャンネルを探さずに直接つなぐ
+    _wifiFastConnect = _wifiChannel != 0;
+    if (_wifiFastConnect)
+        WiFi.begin(_wifiSsid, _wifiPassword, _wifiChannel, _wifiBssid);
+    else
+        WiFi.begin(_wifiSsid, _wifiPassword);
     _wifiStatus = WIFI_CONNECTING;
-    _lastWifiConnectTime = millis();
+    _wifiConnectStart = now;
+    _wifiConnectTime = 0;
+    _wifiRetryEnabled = true;
+    _wifiRetryCount = 0;
+    scheduleWifiRetry(now);
+    _wifiLastUse = now;
+    _wifiIdleTimer = TimerWheel::reschedule(now, _wifiIdleTimer, WIFI_IDLE_TIMEOUT, onWifiIdleTimer);
+}
+
+// 最後に使ってからWIFI_IDLE_TIMEOUTが過ぎたらWi-Fiを止める
+// ダウンロードや再生で使っている間は延ばす
+void Processor::onWifiIdleTimer(uint32_t now, uint32_t arg)
+{
+    Processor* self = _instance;
+    self->_wifiIdleTimer = 0;
+    if (self->_wifiStatus == WIFI_CLOSE)
+        return;
+    if (AudioTask::isStreaming() || HttpCache::busy() ||
+        TimerWheel::pending(self->_wifiPendingPlay.timer))
+        self->_wifiLastUse = now;
+    uint32_t idle = now - self->_wifiLastUse;
+    if (idle < WIFI_IDLE_TIMEOUT)
+    {
+        self->_wifiIdleTimer = TimerWheel::schedule(now, WIFI_IDLE_TIMEOUT - idle, onWifiIdleTimer);
+        return;
+    }
+    self->wifiSleep();
+}
+
+// 切断してドライバを解放し、空いたヒープを再生のキャッシュに回す
+// 保存したネットワークは残し、次に使うときにwifiConnect()で起動し直す
+void Processor::wifiSleep()
+{
+    uint32_t heap = ESP.getFreeHeap();
+    wifiDisconnect();
+    WiFi.mode(WIFI_OFF);
+    _wifiStatus = WIFI_CLOSE;
+    TimerWheel::cancel(_wifiIdleTimer);
+    _wifiIdleTimer = 0;
+    _wifiHeapOn = heap;
+    _wifiHeapOff = ESP.getFreeHeap();
+    _wifiSleeps++;
+}
+
+// Wi-Fiを止めている間にURLの再生を指示されたら、起こしてつながってから再生する
+// キャッシュにあるURLはWi-Fiなしで再生できるので起こさない
+bool Processor::deferNetworkPlay(uint32_t now, const char* name, uint8_t gain)
+{
+    if (!Utils::strcmp_ptr("http://", name) || _wifiStatus != WIFI_CLOSE || _wifiSsid[0] == 0)
+        return false;
+    char cachePath[32];
+    if (HttpCache::lookup(name, cachePath, sizeof(cachePath)))
+        return false;
+    strcpy(_wifiPendingPlay.name, name);
+    _wifiPendingPlay.gain = gain;
+    _wifiPendingPlay.timer = TimerWheel::reschedule(now, _wifiPendingPlay.timer, WIFI_WAKE_TIMEOUT, onWifiWakeTimer);
+    wifiConnect(now);
+    return true;
+}
+
+void Processor::onWifiWakeTimer(uint32_t now, uint32_t arg)
+{
+    Processor* self = _instance;
+    self->_wifiPendingPlay.timer = 0;
+    if (self->_state == COMMAND_LISTEN && self->_currentTransport != nullptr && self->_serialDisconnectTime == 0)
+        self->sendNotify(CD_NO_WIFI_CONNECTION);
+}
+
+void Processor::startPendingPlay()
+{
+    TimerWheel::cancel(_wifiPendingPlay.timer);
+    _wifiPendingPlay.timer = 0;
+    uint32_t voice;
+    int code = playSound(_wifiPendingPlay.name, _wifiPendingPlay.gain, &voice);
+    if (voice == 0 && code == CD_SUCCESS)
+        stopQueue();
+    if (code != CD_SUCCESS && _state == COMMAND_LISTEN && _currentTransport != nullptr && _serialDisconnectTime == 0)
+        sendNotify(code);
+}
+
+// 失敗が続くほど次に試すまでの間隔を倍にしてWIFI_RETRY_MAXで止める
+// アクセスポイントが落ちている間に電波を使い続けず、BLEや再生の邪魔をしないようにする
+// 複数の機器が同時に失敗しても揃って試さないように、間隔を前後に揺らす
+void Processor::scheduleWifiRetry(uint32_t now)
+{
+    uint32_t delay = WIFI_RETRY_INTERVAL;
+    for (int i = 0; i < _wifiRetryCount && delay < WIFI_RETRY_MAX; i++)
+        delay <<= 1;
+    if (delay > WIFI_RETRY_MAX)
+        delay = WIFI_RETRY_MAX;
+    uint32_t jitter = delay * WIFI_RETRY_JITTER / 100;
+    delay = delay - jitter + esp_random() % (jitter * 2 + 1);
+    _wifiRetryTimer = TimerWheel::reschedule(now, _wifiRetryTimer, delay, onWifiRetryTimer);
+}
+
+// 期限までにつながらなければ、やり直して次の期限を決める
+void Processor::onWifiRetryTimer(uint32_t now, uint32_t arg)
+{
+    Processor* self = _instance;
+    self->_wifiRetryTimer = 0;
+    if (!self->_wifiRetryEnabled || self->_wifiStatus == WIFI_CONNECTED)
+        return;
+    WiFi.disconnect();
+    if (self->_wifiFastConnect)
+    {
+        // アクセスポイントが替わったかもしれないので、以降は全チャンネルを探す
+        self->_wifiFastConnect = false;
+        WiFi.begin(self->_wifiSsid, self->_wifiPassword);
+    }
+    else
+    {
+        WiFi.reconnect();
+    }
+    if (self->_wifiRetryCount < 255)
+        self->_wifiRetryCount++;
+    self->scheduleWifiRetry(now);
 }
 
 void Processor::wifiDisconnect()
 {
+    _wifiRetryEnabled = false;
+    TimerWheel::cancel(_wifiRetryTimer);
+    _wifiRetryTimer = 0;
     WiFi.setAutoReconnect(false);
     for (int i = 0; i < 5; i++)
     {
@@ -280,19 +544,20 @@ void Processor::wifiDisconnect()
         }
     }
     if (WiFi.status() == WL_CONNECTED)
-    {
-        sendResponse(CD_ERROR);
         return;
-    }
     _wifiStatus = WIFI_CLOSE;
     WiFi.setAutoReconnect(false);
 }
 
 void Processor::stopAudio(const char* soundName)
 {
-    if (soundName != nullptr && strcmp(soundName, _playFileName) != 0)
-        return;
-    audio.stopSong();
+    if (soundName != nullptr)
+    {
+        AudioTask::mixStop(soundName);
+        if (strcmp(soundName, _playFileName) != 0)
+            return;
+    }
+    AudioTask::stop();
     _playFileName[0] = 0;
 }
 
@@ -338,8 +603,14 @@ void Processor::cmdWifi(uint32_t now, const char* cmd)
     cmd = Utils::skipWs(cmd);
     if (cmd == nullptr || *cmd == '\0')
     {
-        const char* st = getWifiStatusMessage(WiFi.status());
-        sendResponse(CD_SUCCESS, false, ", %s", st);
+        const char* st = _wifiStatus == WIFI_CLOSE ? (_wifiSsid[0] != 0 ? "Sleep" : "Off") : getWifiStatusMessage(WiFi.status());
+        if (TimerWheel::pending(_wifiRetryTimer) && _wifiStatus != WIFI_CONNECTED)
+            sendResponse(CD_SUCCESS, false, ", %s attempt=%u next=%lu", st, _wifiRetryCount,
+                (ulong)TimerWheel::remain(now, _wifiRetryTimer));
+        else if (_wifiStatus == WIFI_CONNECTED)
+            sendResponse(CD_SUCCESS, false, ", %s time=%lu channel=%u", st, (ulong)_wifiConnectTime, _wifiChannel);
+        else
+            sendResponse(CD_SUCCESS, false, ", %s", st);
         return;
     }
     cmd = Utils::parseString(cmd, ssid, sizeof(ssid));
@@ -354,7 +625,15 @@ void Processor::cmdWifi(uint32_t now, const char* cmd)
     {
         if (strcmp(ssid, "off") == 0)
         {
-            wifiDisconnect();
+            TimerWheel::cancel(_wifiPendingPlay.timer);
+            _wifiPendingPlay.timer = 0;
+            if (_wifiStatus != WIFI_CLOSE)
+                wifiSleep();
+            // 次の起動でつながないように、保存したネットワークも忘れる
+            _wifiSsid[0] = 0;
+            _wifiPassword[0] = 0;
+            _wifiChannel = 0;
+            saveWifiSettings();
             sendResponse(CD_SUCCESS);
             return;
         }
@@ -365,13 +644,19 @@ void Processor::cmdWifi(uint32_t now, const char* cmd)
     {
         wifiDisconnect();
     }
-    wifiConnect(ssid, passwd);
+    // 別のネットワークかもしれないので、前回のアクセスポイントは使わない
+    strcpy(_wifiSsid, ssid);
+    strcpy(_wifiPassword, passwd);
+    memset(_wifiBssid, 0, sizeof(_wifiBssid));
+    _wifiChannel = 0;
+    saveWifiSettings();
+    wifiConnect(now);
     sendResponse(CD_SUCCESS);
 }
 
 void Processor::cmdLedOn(uint32_t now, const char* cmd)
 {
-    // led-on slot pattern
+    // led-on slot pattern [ttl]
     if (*cmd != ' ')
     {
         sendResponse(CD_NEED_PARAMETER);
@@ -384,20 +669,61 @@ void Processor::cmdLedOn(uint32_t now, const char* cmd)
         sendResponse(CD_INTEGER_PARSE_ERROR);
         return;
     }
-    if (slot < 0 || SLOT_COUNT <= slot)
+    int slotCount = LedSequencer::slotCount();
+    if (slot < 0 || slotCount <= slot)
     {
         sendResponse(CD_SLOT_ERROR);
         return;
     }
-    slot = SLOT_COUNT - slot - 1;
+    slot = slotCount - slot - 1;
+    // パターンの後の数字は自動で消灯するまでの時間(ms)
+    uint ttl = 0;
+    const char* p = Utils::skipWs(cmd);
+    const char* option = p != nullptr ? strchr(p, ' ') : nullptr;
+    if (option != nullptr && Utils::skipWs(option) != nullptr)
+    {
+        option = Utils::parseUInt(option, &ttl);
+        if (option == nullptr || Utils::skipWs(option) != nullptr || ttl == 0 || ttl > LED_TTL_MAX)
+        {
+            sendResponse(CD_BAD_PARAMETER);
+            return;
+        }
+    }
     if (!LedSequencer::parse(slot, cmd))
     {
         sendResponse(CD_BAD_COMMAND_FORMAT);
         return;
     }
+    TimerWheel::cancel(_ledTimer[slot]);
+    _ledTimer[slot] = 0;
+    if (ttl > 0)
+    {
+        _ledTimer[slot] = TimerWheel::schedule(now, ttl, onLedTimer, slot);
+        if (_ledTimer[slot] == 0)
+        {
+            LedSequencer::clear(slot);
+            sendResponse(CD_TIMER_FULL);
+            return;
+        }
+    }
     sendResponse(CD_SUCCESS);
 }
 
+void Processor::onLedTimer(uint32_t now, uint32_t arg)
+{
+    _instance->_ledTimer[arg] = 0;
+    LedSequencer::clear((int)arg);
+}
+
+void Processor::cancelLedTimers()
+{
+    for (int i = 0; i < MAX_SLOT_COUNT; i++)
+    {
+        TimerWheel::cancel(_ledTimer[i]);
+        _ledTimer[i] = 0;
+    }
+}
+
 void Processor::cmdLedOff(uint32_t now, const char* cmd)
 {
     // led-off slot
@@ -413,247 +739,1305 @@ void Processor::cmdLedOff(uint32_t now, const char* cmd)
         sendResponse(CD_BAD_COMMAND_FORMAT);
         return;
     }
-    slot = SLOT_COUNT - slot - 1;
+    int slotCount = LedSequencer::slotCount();
+    if (slot < 0 || slotCount <= slot)
+    {
+        sendResponse(CD_SLOT_ERROR);
+        return;
+    }
+    slot = slotCount - slot - 1;
+    TimerWheel::cancel(_ledTimer[slot]);
+    _ledTimer[slot] = 0;
     LedSequencer::clear(slot);
     sendResponse(CD_SUCCESS);
 }
 
-void Processor::cmdPlay(uint32_t now, const char* cmd)
+void Processor::cmdLedConfig(uint32_t now, const char* cmd)
 {
-    // play "mp3-file"
-    if (*cmd != ' ')
+    // led-config [pixels n0,n1,...]
+    cmd = Utils::skipWs(cmd);
+    if (cmd == nullptr || *cmd == '\0')
     {
-        sendResponse(CD_NEED_PARAMETER);
+        char slots[MAX_SLOT_COUNT * 5];
+        STR_BUFFER buffer;
+        Utils::init_buffer(&buffer, slots, sizeof(slots));
+        for (int i = 0; i < LedSequencer::slotCount(); i++)
+        {
+            Utils::printf_buffer(&buffer, i == 0 ? "%u" : ",%u", LedSequencer::slotPixels(i));
+        }
+        sendResponse(CD_SUCCESS, false, ", pixels=%u slots=%s", LedSequencer::pixelCount(), slots);
         return;
     }
-    stopAudio();
-    _playFileName[0] = 0;
-
-    cmd = Utils::parseString(cmd, _playFileName, sizeof(_playFileName));
+    uint pixelCount;
+    cmd = Utils::parseUInt(cmd, &pixelCount);
     if (!cmd)
     {
         sendResponse(CD_BAD_COMMAND_FORMAT);
         return;
     }
-    if (_playFileName[0] != 0)
+    uint16_t slotPixels[MAX_SLOT_COUNT];
+    int slotCount = 0;
+    while (true)
     {
-        if (Utils::strcmp_ptr("http://", _playFileName))
+        uint n;
+        cmd = Utils::parseUInt(cmd, &n);
+        if (!cmd)
         {
-            if (_wifiStatus != WIFI_CONNECTED)
-            {
-                sendResponse(CD_NO_WIFI_CONNECTION);
-                return;
-            }
-            setCpuFrequencyMhz(240);
-            _cpuClockHigh = true;
-            if (!audio.connecttohost(_playFileName))
-            {
-                sendResponse(CD_FILE_IO_ERROR);
-                return;
-            }
+            sendResponse(slotCount == 0 ? CD_NEED_PARAMETER : CD_BAD_COMMAND_FORMAT);
+            return;
         }
-        else
+        if (slotCount >= MAX_SLOT_COUNT || n > MAX_PIXEL_COUNT)
         {
-            if (_playFileName[0] != '/')
-            {
-                char t[32];
-                strcpy(t, _playFileName);
-                strcpy(&_playFileName[1], t);
-                _playFileName[0] = '/';
-            }
-            if (!LittleFS.exists(_playFileName))
-            {
-                sendResponse(CD_FILE_NOT_FOUND);
-                return;
-            }
-            setCpuFrequencyMhz(240);
-            _cpuClockHigh = true;
-            if (!audio.connecttoFS(LittleFS, _playFileName))
-            {
-                sendResponse(CD_FILE_IO_ERROR);
-                return;
-            }
+            sendResponse(CD_BAD_PARAMETER);
+            return;
         }
+        slotPixels[slotCount++] = (uint16_t)n;
+        if (*cmd != ',')
+            break;
+        cmd++;
     }
-    sendResponse(CD_SUCCESS);
-}
-
-void Processor::cmdStop(uint32_t now, const char* cmd)
-{
     if (*cmd != '\0')
+    {
+        sendResponse(CD_BAD_COMMAND_FORMAT);
+        return;
+    }
+    if (pixelCount > MAX_PIXEL_COUNT ||
+        !LedSequencer::configure((uint16_t)pixelCount, slotPixels, slotCount))
     {
         sendResponse(CD_BAD_PARAMETER);
         return;
     }
-    stopAudio();
+    // スロットの並びが変わるので、消灯の予定も捨てる
+    cancelLedTimers();
     sendResponse(CD_SUCCESS);
 }
 
-void Processor::cmdVolume(uint32_t now, const char* cmd)
+void Processor::cmdLedBrightness(uint32_t now, const char* cmd)
 {
-    // volume 100
-    if (*cmd != ' ')
+    // led-brightness [0-100]
+    cmd = Utils::skipWs(cmd);
+    if (cmd == nullptr || *cmd == '\0')
     {
-        sendResponse(CD_NEED_PARAMETER);
+        uint percent = (LedSequencer::brightness() * 100 + 127) / 255;
+        sendResponse(CD_SUCCESS, false, ", brightness=%u", percent);
         return;
     }
-    uint volume;
-    cmd = Utils::parseUInt(cmd, &volume);
-    if (!cmd)
+    uint percent;
+    cmd = Utils::parseUInt(cmd, &percent);
+    if (!cmd || *cmd != '\0')
     {
         sendResponse(CD_BAD_COMMAND_FORMAT);
         return;
     }
-    if (volume < 0 || volume > 100)
+    if (percent > 100)
     {
-        sendResponse(CD_COMMAND_ERROR);
+        sendResponse(CD_BAD_PARAMETER);
         return;
     }
-    uint8_t v = (uint8_t)(21.0f * (float)volume / 100.0f);;
-    if (v == 0 && volume > 0)
-        v = 1;
-    audio.setVolume(v);
+    LedSequencer::setBrightness((uint8_t)((percent * 255 + 50) / 100));
     sendResponse(CD_SUCCESS);
 }
 
-void Processor::cmdUpload(uint32_t now, const char* cmd)
+const char* Processor::parseSoundName(const char* cmd, char* name, size_t len)
 {
-    // upload "filename" fileSize
-    char fileName[32];
+    // 内蔵ストレージのファイル名は先頭に'/'を付ける
+    cmd = Utils::parseString(cmd, &name[1], len - 2);
+    if (!cmd)
+        return nullptr;
+    if (name[1] == 0 || name[1] == '/' || Utils::strcmp_ptr("http://", &name[1]))
+        memmove(name, &name[1], strlen(&name[1]) + 1);
+    else
+        name[0] = '/';
+    return cmd;
+}
+
+// 再生で開く名前
+// 内蔵ストレージの別名は実際のファイル名にし、内蔵ストレージになければバンドルから探す
+const char* Processor::soundPath(const char* name)
+{
+    const char* path = Manifest::path(name);
+    if (path == nullptr && Bundle::find(name) != nullptr)
+        path = name;
+    return path;
+}
+
+const char* Processor::parseGain(const char* cmd, uint8_t* gain)
+{
+    // 数字だけの語を音量(0-100)とみなす
+    *gain = 100;
+    const char* p = Utils::skipWs(cmd);
+    if (p == nullptr)
+        return cmd;
+    uint v;
+    const char* end = Utils::parseUInt(p, &v);
+    if (end == nullptr || (*end != ' ' && *end != '\0'))
+        return cmd;
+    if (v > 100)
+        return nullptr;
+    *gain = (uint8_t)v;
+    return end;
+}
+
+const char* Processor::parseDelay(const char* cmd, uint32_t* delay)
+{
+    // delay=<ms>
+    *delay = 0;
+    const char* p = Utils::skipWs(cmd);
+    if (p == nullptr)
+        return cmd;
+    p = Utils::strcmp_ptr("delay=", p);
+    if (p == nullptr)
+        return cmd;
+    if (*p == ' ')
+        return nullptr;
+    uint v;
+    p = Utils::parseUInt(p, &v);
+    if (p == nullptr || (*p != ' ' && *p != '\0') || v > DELAYED_PLAY_MAX_DELAY)
+        return nullptr;
+    *delay = v;
+    return p;
+}
+
+void Processor::beginAudio()
+{
+    CpuGovernor::boost(millis());
+}
+
+int Processor::playSound(const char* name, uint8_t gain, uint32_t* voice)
+{
+    if (voice != nullptr)
+        *voice = 0;
+    if (*name != 0 && !Utils::strcmp_ptr("http://", name))
+    {
+        // 別名は同じ内容のファイルを再生する
+        name = soundPath(name);
+        if (name == nullptr)
+            return CD_FILE_NOT_FOUND;
+        bool cached = SoundCache::lookup(name);
+        if (!cached)
+        {
+            // 内蔵ストレージのファイルはそのまま再生し、キャッシュへの読み込みは再生タスクに任せる
+            // バンドルのファイルはフラッシュをマップするだけなので、その場で登録する
+            if (Manifest::exists(name))
+                SoundCache::request(name);
+            else
+                cached = SoundCache::load(name);
+        }
+        if (cached && SoundCache::isPcm(name))
+        {
+            // デコード済みのPCMはミキサで再生し、他の音を止めない
+            return AudioTask::mixPlay(name, gain, voice);
+        }
+        stopAudio();
+        strcpy(_playFileName, name);
+        beginAudio();
+        return AudioTask::playFile(_playFileName, cached);
+    }
+
+    stopAudio();
+    if (*name == 0)
+        return CD_SUCCESS;
+    strcpy(_playFileName, name);
+    char cachePath[32];
+    if (HttpCache::lookup(_playFileName, cachePath, sizeof(cachePath)))
+    {
+        // キャッシュから再生し、必要なら裏で更新を確認する
+        if (_wifiStatus == WIFI_CONNECTED)
+            HttpCache::revalidate(_playFileName);
+        beginAudio();
+        return AudioTask::playFile(cachePath, false);
+    }
+    if (_wifiStatus != WIFI_CONNECTED)
+        return CD_NO_WIFI_CONNECTION;
+    _wifiLastUse = millis();
+    beginAudio();
+    if (StreamBuffer::enabled() || HttpCache::enabled())
+    {
+        // キャッシュへの保存は再生用の受信と同じ接続で行う
+        bool store = HttpCache::beginStore(_playFileName);
+        return AudioTask::playStream(_playFileName, store);
+    }
+    return AudioTask::playHost(_playFileName);
+}
+
+void Processor::stopQueue()
+{
+    PlayQueue::clear();
+    _queueActive = false;
+    _queueVoice = 0;
+}
+
+void Processor::cmdPlay(uint32_t now, const char* cmd)
+{
+    // play "mp3-file" [gain] [delay=ms]
     if (*cmd != ' ')
     {
         sendResponse(CD_NEED_PARAMETER);
         return;
     }
-    cmd = Utils::parseString(cmd, fileName, sizeof(fileName));
-    if (!cmd)
+    char name[sizeof(_playFileName)];
+    uint8_t gain;
+    uint32_t delay;
+    cmd = parseSoundName(cmd, name, sizeof(name));
+    if (cmd)
+        cmd = parseGain(cmd, &gain);
+    if (cmd)
+        cmd = parseDelay(cmd, &delay);
+    if (!cmd || Utils::skipWs(cmd) != nullptr)
     {
         sendResponse(CD_BAD_COMMAND_FORMAT);
         return;
     }
-    cmd = Utils::parseUInt(cmd, &_uploadFileSize);
-    if (!cmd)
+    if (delay > 0)
     {
-        sendResponse(CD_BAD_COMMAND_FORMAT);
+        // 内蔵ストレージの名前は予約する時点で確かめる
+        if (*name == '/' && soundPath(name) == nullptr)
+        {
+            sendResponse(CD_FILE_NOT_FOUND);
+            return;
+        }
+        DELAYED_PLAY* entry = nullptr;
+        for (int i = 0; i < DELAYED_PLAY_ENTRIES; i++)
+        {
+            if (!TimerWheel::pending(_delayedPlay[i].timer))
+            {
+                entry = &_delayedPlay[i];
+                break;
+            }
+        }
+        if (entry != nullptr)
+            entry->timer = TimerWheel::schedule(now, delay, onDelayedPlayTimer, (uint32_t)(entry - _delayedPlay));
+        if (entry == nullptr || entry->timer == 0)
+        {
+            sendResponse(CD_TIMER_FULL);
+            return;
+        }
+        strcpy(entry->name, name);
+        entry->gain = gain;
+        sendResponse(CD_SUCCESS);
         return;
     }
-    if (fileName[0] != '/')
-    {
-        char t[32];
-        strcpy(t, fileName);
-        strcpy(&fileName[1], t);
-        fileName[0] = '/';
-    }
-    if (strlen(fileName) == 0 || _uploadFileSize == 0)
+    if (deferNetworkPlay(now, name, gain))
     {
-        sendResponse(CD_COMMAND_ERROR);
+        sendResponse(CD_SUCCESS);
         return;
     }
-    size_t totalBytes = LittleFS.totalBytes();
-    size_t usedBytes = LittleFS.usedBytes();
-    size_t freeBytes = totalBytes - usedBytes;
-    if (freeBytes < _uploadFileSize)
-    {
-        sendResponse(CD_STORAGE_FULL);
+    uint32_t voice;
+    int code = playSound(name, gain, &voice);
+    // mp3の再生で置き換えた場合はキューも破棄する
+    if (voice == 0 && code == CD_SUCCESS)
+        stopQueue();
+    sendResponse(code);
+}
+
+// 予約した再生の失敗は、応答の代わりに通知で知らせる
+void Processor::onDelayedPlayTimer(uint32_t now, uint32_t arg)
+{
+    Processor* self = _instance;
+    DELAYED_PLAY* entry = &self->_delayedPlay[arg];
+    entry->timer = 0;
+    if (self->deferNetworkPlay(now, entry->name, entry->gain))
         return;
-    }
+    uint32_t voice;
+    int code = self->playSound(entry->name, entry->gain, &voice);
+    if (voice == 0 && code == CD_SUCCESS)
+        self->stopQueue();
+    if (code != CD_SUCCESS && self->_state == COMMAND_LISTEN && self->_currentTransport != nullptr && self->_serialDisconnectTime == 0)
+        self->sendNotify(code);
+}
 
-    stopAudio(fileName);
-    _fileUploadStatus = CD_SUCCESS;
-    _uploadFile = LittleFS.open(fileName, "w");
-    if (!_uploadFile)
+void Processor::cancelDelayedPlay()
+{
+    for (int i = 0; i < DELAYED_PLAY_ENTRIES; i++)
     {
-        _fileUploadStatus = CD_FILE_IO_ERROR;
-        sendResponse(CD_FILE_IO_ERROR);
-        return;
+        TimerWheel::cancel(_delayedPlay[i].timer);
+        _delayedPlay[i].timer = 0;
     }
-
-    _receiveFileSize = 0;
-    _state = FILE_UPLOAD;
-    _lastUploadTime = 0;
-    _lastAvailable = 0;
-    sendResponse(CD_SUCCESS, false, ", Upload Start. size=%u", _uploadFileSize);
 }
 
-void Processor::cmdRemove(uint32_t now, const char* cmd)
+void Processor::cmdQueue(uint32_t now, const char* cmd)
 {
-    // remove "fileName"
-    char fileName[32];
-    if (*cmd != ' ')
+    // queue
+    // queue add "mp3-file" [gain] ["mp3-file" [gain]...]
+    // queue clear
+    if (*cmd == '\0')
     {
-        sendResponse(CD_NEED_PARAMETER);
+        sendResponse(CD_SUCCESS, true);
+        if (_queueActive)
+        {
+            // ボイスはオーディオタスクで入れ替わるので、コピーから表示する
+            MIXER_VOICE_INFO info;
+            bool mixing = false;
+            for (int i = 0; i < MIXER_VOICES && _queueVoice != 0 && !mixing; i++)
+                mixing = Mixer::snapshot(i, &info) && info.started == _queueVoice;
+            const char* playing = mixing ? info.name : _playFileName;
+            sendBody("Playing: %s", *playing == '/' ? playing + 1 : playing);
+        }
+        for (int i = 0; i < PlayQueue::count(); i++)
+        {
+            const PLAY_QUEUE_ITEM* item = PlayQueue::item(i);
+            sendBody("%d %s %u%s", i, *item->name == '/' ? item->name + 1 : item->name, item->gain,
+                item->prerolled ? " ready" : "");
+        }
+        sendEnd();
         return;
     }
-    cmd = Utils::parseString(cmd, fileName, sizeof(fileName));
-    if (!cmd)
+    if (*cmd != ' ')
     {
         sendResponse(CD_BAD_COMMAND_FORMAT);
         return;
     }
-    if (fileName[0] != '/')
-    {
-        char t[32];
-        strcpy(t, fileName);
-        strcpy(&fileName[1], t);
-        fileName[0] = '/';
-    }
-
-    if (!LittleFS.exists(fileName))
+    const char* ptr;
+    if ((ptr = Utils::is_symbol_ptr("clear", cmd + 1)) != nullptr && *ptr == '\0')
     {
-        sendResponse(CD_FILE_NOT_FOUND);
+        // 再生中の音は止めずに、連続再生だけを終える
+        stopQueue();
+        _queueNotifyPending = false;
+        sendResponse(CD_SUCCESS);
         return;
     }
-    stopAudio(fileName);
-    if (!LittleFS.remove(fileName))
+    ptr = Utils::is_symbol_ptr("add", cmd + 1);
+    if (ptr == nullptr || *ptr != ' ')
     {
-        sendResponse(CD_FILE_IO_ERROR);
+        sendResponse(CD_BAD_PARAMETER);
         return;
     }
-    sendResponse(CD_SUCCESS);
+    // すべての引数を確認してから追加する
+    int added = 0;
+    for (int pass = 0; pass < 2; pass++)
+    {
+        cmd = ptr;
+        while (Utils::skipWs(cmd) != nullptr)
+        {
+            char name[sizeof(_playFileName)];
+            uint8_t gain;
+            cmd = parseSoundName(cmd, name, sizeof(name));
+            if (cmd)
+                cmd = parseGain(cmd, &gain);
+            if (!cmd || *name == 0)
+            {
+                sendResponse(CD_BAD_COMMAND_FORMAT);
+                return;
+            }
+            bool url = Utils::strcmp_ptr("http://", name);
+            if (pass == 0)
+            {
+                if (!url && soundPath(name) == nullptr)
+                {
+                    sendResponse(CD_FILE_NOT_FOUND);
+                    return;
+                }
+                if (++added + PlayQueue::count() > PLAY_QUEUE_LENGTH)
+                {
+                    sendResponse(CD_QUEUE_FULL);
+                    return;
+                }
+                continue;
+            }
+            // ローカルのファイルは再生タスクで先にPSRAMへ読み込んでおく
+            const char* path = url ? name : soundPath(name);
+            if (!url)
+                SoundCache::request(path);
+            PlayQueue::push(path, gain);
+        }
+    }
+    if (added == 0)
+    {
+        sendResponse(CD_NEED_PARAMETER);
+        return;
+    }
+    if (!_queueActive)
+    {
+        // 再生中の音が終わってから始める
+        _queueActive = true;
+        _queueVoice = 0;
+        _queueStarted = false;
+    }
+    sendResponse(CD_SUCCESS);
+}
+
+void Processor::prerollQueue()
+{
+    PLAY_QUEUE_ITEM* item = PlayQueue::front();
+    if (item == nullptr || item->prerolled)
+        return;
+    if (Utils::strcmp_ptr("http://", item->name))
+    {
+        // 次のURLはダウンロードキャッシュへ先読みしておく
+        if (!HttpCache::enabled() || _wifiStatus != WIFI_CONNECTED || HttpCache::contains(item->name))
+            item->prerolled = true;
+        else if (HttpCache::fetch(item->name))
+            item->prerolled = true;
+        return;
+    }
+    SoundCache::request(item->name);
+    item->prerolled = true;
+}
+
+void Processor::queueProcess()
+{
+    if (!_queueActive)
+        return;
+    if (_queueVoice != 0 && Mixer::isPlaying(_queueVoice))
+    {
+        // PCM同士はミキサで継ぎ目なくつなぐ
+        PLAY_QUEUE_ITEM* next = PlayQueue::front();
+        if (next != nullptr && !Mixer::hasNext(_queueVoice) && SoundCache::isPcm(next->name))
+        {
+            if (AudioTask::mixChain(_queueVoice, next->name, next->gain) == CD_SUCCESS)
+                PlayQueue::pop();
+            return;
+        }
+        prerollQueue();
+        return;
+    }
+    if (_queueVoice == 0 && AudioTask::isRunning())
+    {
+        if (_queueStarted)
+            prerollQueue();
+        return;
+    }
+    while (PlayQueue::count() > 0)
+    {
+        PLAY_QUEUE_ITEM* item = PlayQueue::front();
+        int code = playSound(item->name, item->gain, &_queueVoice);
+        if (code == CD_SUCCESS)
+        {
+            PlayQueue::pop();
+            _queueStarted = true;
+            return;
+        }
+        // 再生できなかったファイルは読み飛ばし、そのことを知らせる
+        if (_state == COMMAND_LISTEN && _currentTransport != nullptr && _serialDisconnectTime == 0)
+        {
+            sendNotify(CD_QUEUE_SKIPPED, true);
+            sendBody("%s %d", *item->name == '/' ? item->name + 1 : item->name, code);
+            sendEnd();
+        }
+        PlayQueue::pop();
+    }
+    _queueActive = false;
+    _queueVoice = 0;
+    if (_queueStarted)
+        _queueNotifyPending = true;
+}
+
+void Processor::cmdStop(uint32_t now, const char* cmd)
+{
+    if (*cmd != '\0')
+    {
+        sendResponse(CD_BAD_PARAMETER);
+        return;
+    }
+    stopQueue();
+    cancelDelayedPlay();
+    stopAudio();
+    AudioTask::mixStop();
+    sendResponse(CD_SUCCESS);
+}
+
+void Processor::cmdVolume(uint32_t now, const char* cmd)
+{
+    // volume 100
+    if (*cmd != ' ')
+    {
+        sendResponse(CD_NEED_PARAMETER);
+        return;
+    }
+    uint volume;
+    cmd = Utils::parseUInt(cmd, &volume);
+    if (!cmd)
+    {
+        sendResponse(CD_BAD_COMMAND_FORMAT);
+        return;
+    }
+    if (volume < 0 || volume > 100)
+    {
+        sendResponse(CD_COMMAND_ERROR);
+        return;
+    }
+    uint8_t v = (uint8_t)(21.0f * (float)volume / 100.0f);;
+    if (v == 0 && volume > 0)
+        v = 1;
+    AudioTask::setVolume(v);
+    sendResponse(CD_SUCCESS);
+}
+
+void Processor::cmdUpload(uint32_t now, const char* cmd)
+{
+    // upload "filename" fileSize [crc16]
+    char fileName[32];
+    if (*cmd != ' ')
+    {
+        sendResponse(CD_NEED_PARAMETER);
+        return;
+    }
+    cmd = Utils::parseString(cmd, fileName, sizeof(fileName));
+    if (!cmd)
+    {
+        sendResponse(CD_BAD_COMMAND_FORMAT);
+        return;
+    }
+    cmd = Utils::parseUInt(cmd, &_uploadFileSize);
+    if (!cmd)
+    {
+        sendResponse(CD_BAD_COMMAND_FORMAT);
+        return;
+    }
+    _uploadCheckCrc = false;
+    const char* ptr = Utils::skipWs(cmd);
+    if (ptr != nullptr)
+    {
+        uint32_t crc;
+        ptr = Utils::parseHex(ptr, &crc);
+        if (ptr == nullptr || Utils::skipWs(ptr) != nullptr || crc > 0xFFFF)
+        {
+            sendResponse(CD_BAD_COMMAND_FORMAT);
+            return;
+        }
+        _uploadExpectedCrc = (uint16_t)crc;
+        _uploadCheckCrc = true;
+    }
+    if (fileName[0] != '/')
+    {
+        char t[32];
+        strcpy(t, fileName);
+        strcpy(&fileName[1], t);
+        fileName[0] = '/';
+    }
+    if (strlen(fileName) == 0 || _uploadFileSize == 0)
+    {
+        sendResponse(CD_COMMAND_ERROR);
+        return;
+    }
+    // 元のファイルは最後に置き換えるまで残るので、全体が入る空きが必要
+    size_t required = Manifest::required(_uploadFileSize);
+    size_t freeBytes = Manifest::freeBytes();
+    if (freeBytes < required)
+    {
+        // ダウンロードキャッシュを削って空きを作る
+        HttpCache::trim(required - freeBytes, AudioTask::isRunning() ? _playFileName : "");
+        freeBytes = Manifest::freeBytes();
+    }
+    // 新しい名前なら一覧にも追加できること
+    if (freeBytes < required || (!Manifest::exists(fileName) && !Manifest::reserveEntry()))
+    {
+        sendResponse(CD_STORAGE_FULL);
+        return;
+    }
+
+    strcpy(_uploadFileName, fileName);
+    _uploadBundle = false;
+    _fileUploadStatus = CD_SUCCESS;
+    _uploadFile = LittleFS.open(UPLOAD_TEMP_PATH, "w");
+    if (!_uploadFile)
+    {
+        _fileUploadStatus = CD_FILE_IO_ERROR;
+        sendResponse(CD_FILE_IO_ERROR);
+        return;
+    }
+    Manifest::reserve(required);
+
+    _uploadScanner.begin();
+    _uploadCrc = 0xFFFF;
+    mbedtls_sha256_starts_ret(&_uploadHash, 0);
+    _receiveFileSize = 0;
+    _state = FILE_UPLOAD;
+    _lastUploadTime = 0;
+    _uploadTimer = TimerWheel::reschedule(now, _uploadTimer, DATA_CHUNK_TIMEOUT, onUploadTimer);
+    _lastAvailable = 0;
+    sendResponse(CD_SUCCESS, false, ", Upload Start. size=%u", _uploadFileSize);
+}
+
+void Processor::cmdRemove(uint32_t now, const char* cmd)
+{
+    // remove "fileName"
+    char fileName[32];
+    if (*cmd != ' ')
+    {
+        sendResponse(CD_NEED_PARAMETER);
+        return;
+    }
+    cmd = Utils::parseString(cmd, fileName, sizeof(fileName));
+    if (!cmd)
+    {
+        sendResponse(CD_BAD_COMMAND_FORMAT);
+        return;
+    }
+    if (fileName[0] != '/')
+    {
+        char t[32];
+        strcpy(t, fileName);
+        strcpy(&fileName[1], t);
+        fileName[0] = '/';
+    }
+
+    if (!Manifest::exists(fileName))
+    {
+        sendResponse(CD_FILE_NOT_FOUND);
+        return;
+    }
+    stopAudio(fileName);
+    SoundCache::remove(fileName);
+    // 同じ内容の別名が残っていればファイルはそのまま使う
+    if (Manifest::unlink(fileName) && !deleteSound(fileName))
+    {
+        sendResponse(CD_FILE_IO_ERROR);
+        return;
+    }
+    sendResponse(CD_SUCCESS);
+}
+
+void Processor::cmdList(uint32_t now, const char* cmd)
+{
+    // List
+    if (*cmd != '\0')
+    {
+        sendResponse(CD_BAD_PARAMETER);
+        return;
+    }
+    sendResponse(CD_SUCCESS, true);
+    sendBody("Storage Usage: %lu/%lu\nFiles:", (ulong)Manifest::usedBytes(), (ulong)Manifest::totalBytes());
+    for (int i = 0; i < Manifest::count(); i++)
+    {
+        const MANIFEST_ENTRY* e = Manifest::entry(i);
+        char line[64];
+        if (e->duration != 0)
+            snprintf(line, sizeof(line), "%s %lu %lu", e->name + 1, (ulong)e->size, (ulong)e->duration);
+        else
+            snprintf(line, sizeof(line), "%s %lu", e->name + 1, (ulong)e->size);
+        reserveBody(strlen(line) + 1);
+        sendBody("%s", line);
+    }
+    // バンドルのファイルは再生できるものだけを、バンドル内の番号と一緒に表示する
+    if (Bundle::count() > 0)
+    {
+        reserveBody(8);
+        sendBody("Bundle:");
+    }
+    for (int i = 0; i < Bundle::count(); i++)
+    {
+        if (Bundle::duration(i) == 0)
+            continue;
+        const BUNDLE_ENTRY* e = Bundle::entry(i);
+        char line[64];
+        snprintf(line, sizeof(line), "%d %s %lu %lu", i, e->name, (ulong)e->size, (ulong)Bundle::duration(i));
+        reserveBody(strlen(line) + 1);
+        sendBody("%s", line);
+    }
+    sendEnd();
+}
+
+void Processor::cmdHave(uint32_t now, const char* cmd)
+{
+    // have hash [hash ...]
+    // 持っていない内容のハッシュだけを返す
+    if (*cmd != ' ')
+    {
+        sendResponse(CD_NEED_PARAMETER);
+        return;
+    }
+    uint8_t hash[MANIFEST_HASH_SIZE];
+    for (const char* p = Utils::skipWs(cmd); p != nullptr; p = Utils::skipWs(p))
+    {
+        p = Manifest::parseHash(p, hash);
+        if (p == nullptr)
+        {
+            sendResponse(CD_BAD_COMMAND_FORMAT);
+            return;
+        }
+    }
+    sendResponse(CD_SUCCESS, true);
+    for (const char* p = Utils::skipWs(cmd); p != nullptr; p = Utils::skipWs(p))
+    {
+        p = Manifest::parseHash(p, hash);
+        if (Manifest::findHash(hash) != nullptr)
+            continue;
+        char line[MANIFEST_HASH_SIZE * 2 + 1];
+        Manifest::hashString(hash, line);
+        reserveBody(strlen(line) + 1);
+        sendBody("%s", line);
+    }
+    sendEnd();
+}
+
+void Processor::cmdLink(uint32_t now, const char* cmd)
+{
+    // link "fileName" hash
+    // 保存済みの内容に、データを送らずに別の名前を付ける
+    char fileName[32];
+    if (*cmd != ' ')
+    {
+        sendResponse(CD_NEED_PARAMETER);
+        return;
+    }
+    cmd = Utils::parseString(cmd, fileName, sizeof(fileName));
+    if (!cmd || (cmd = Utils::skipWs(cmd)) == nullptr)
+    {
+        sendResponse(CD_BAD_COMMAND_FORMAT);
+        return;
+    }
+    uint8_t hash[MANIFEST_HASH_SIZE];
+    cmd = Manifest::parseHash(cmd, hash);
+    if (!cmd || Utils::skipWs(cmd) != nullptr)
+    {
+        sendResponse(CD_BAD_COMMAND_FORMAT);
+        return;
+    }
+    if (fileName[0] != '/')
+    {
+        char t[32];
+        strcpy(t, fileName);
+        strcpy(&fileName[1], t);
+        fileName[0] = '/';
+    }
+    const MANIFEST_ENTRY* same = Manifest::findHash(hash);
+    if (same == nullptr)
+    {
+        sendResponse(CD_FILE_NOT_FOUND);
+        return;
+    }
+    char target[32];
+    strcpy(target, same->name);
+    const char* current = Manifest::path(fileName);
+    if (current != nullptr && strcmp(current, target) == 0)
+    {
+        sendResponse(CD_SUCCESS);
+        return;
+    }
+    if (current == nullptr && !Manifest::reserveEntry())
+    {
+        sendResponse(CD_STORAGE_FULL);
+        return;
+    }
+    stopAudio(fileName);
+    SoundCache::remove(fileName);
+    if (Manifest::unlink(fileName) && Manifest::exists(fileName) && !deleteSound(fileName))
+    {
+        sendResponse(CD_FILE_IO_ERROR);
+        return;
+    }
+    sendResponse(Manifest::link(fileName, target) ? CD_SUCCESS : CD_STORAGE_FULL);
+}
+
+void Processor::cmdCache(uint32_t now, const char* cmd)
+{
+    // cache [pin|unpin "fileName"] | [pcm on|off]
+    cmd = Utils::skipWs(cmd);
+    if (cmd == nullptr || *cmd == '\0')
+    {
+        uint32_t hits = SoundCache::hits();
+        uint32_t total = hits + SoundCache::misses();
+        sendResponse(CD_SUCCESS, true);
+        sendBody("Cache Usage: %lu/%lu", (ulong)SoundCache::used(), (ulong)SoundCache::capacity());
+        sendBody("Hit: %lu/%lu %lu%%", (ulong)hits, (ulong)total, (ulong)(total ? hits * 100 / total : 0));
+        sendBody("PCM: %s", SoundCache::pcmEnabled() ? "on" : "off");
+        sendBody("Files:");
+        for (int i = 0; i < SOUND_CACHE_ENTRIES; i++)
+        {
+            const SOUND_CACHE_ENTRY* e = SoundCache::entry(i);
+            if (e == nullptr)
+                continue;
+            if (strlen(e->name) + 24 > _messageBufferRef.remain)
+            {
+                flushSendBuffer();
+            }
+            sendBody("%s %lu %lu%s%s%s", e->name + 1, (ulong)e->size, (ulong)e->playCount,
+                e->pcm == SOUND_PCM_READY ? " pcm" : "", e->pinned ? " pinned" : "", e->mapped ? " mapped" : "");
+        }
+        sendEnd();
+        return;
+    }
+    const char* ptr = Utils::is_symbol_ptr("pcm", cmd);
+    if (ptr)
+    {
+        char mode[8];
+        ptr = Utils::parseString(ptr, mode, sizeof(mode) - 1);
+        if (!ptr || (strcmp(mode, "on") != 0 && strcmp(mode, "off") != 0))
+        {
+            sendResponse(CD_BAD_PARAMETER);
+            return;
+        }
+        SoundCache::setPcm(strcmp(mode, "on") == 0);
+        sendResponse(CD_SUCCESS);
+        return;
+    }
+    bool pin;
+    ptr = Utils::is_symbol_ptr("pin", cmd);
+    if (ptr)
+    {
+        pin = true;
+    }
+    else
+    {
+        ptr = Utils::is_symbol_ptr("unpin", cmd);
+        if (!ptr)
+        {
+            sendResponse(CD_BAD_PARAMETER);
+            return;
+        }
+        pin = false;
+    }
+    char fileName[32];
+    if (*ptr != ' ')
+    {
+        sendResponse(CD_NEED_PARAMETER);
+        return;
+    }
+    ptr = Utils::parseString(ptr, &fileName[1], sizeof(fileName) - 2);
+    if (!ptr)
+    {
+        sendResponse(CD_BAD_COMMAND_FORMAT);
+        return;
+    }
+    fileName[0] = '/';
+    const char* path = soundPath(fileName);
+    sendResponse(SoundCache::pin(path != nullptr ? path : fileName, pin));
+}
+
+void Processor::cmdStats(uint32_t now, const char* cmd)
+{
+    // stats [reset]
+    if (*cmd == ' ')
+    {
+        const char* ptr = Utils::is_symbol_ptr("reset", cmd + 1);
+        if (ptr == nullptr || *ptr != '\0')
+        {
+            sendResponse(CD_BAD_PARAMETER);
+            return;
+        }
+        AudioTask::resetStats();
+        CpuGovernor::resetStats(now);
+        EventLoop::resetStats(now);
+        Profiler::reset();
+        sendResponse(CD_SUCCESS);
+        return;
+    }
+    if (*cmd != '\0')
+    {
+        sendResponse(CD_BAD_PARAMETER);
+        return;
+    }
+    sendResponse(CD_SUCCESS, true);
+    sendBody("CPU: %luMHz load=%u%% reason=%s switch=%lu time=%lu/%lu/%lu",
+        (ulong)CpuGovernor::frequency(CpuGovernor::level()), CpuGovernor::utilisation(), CpuGovernor::reason(),
+        (ulong)CpuGovernor::switches(), (ulong)CpuGovernor::levelTime(now, CPU_LEVEL_LOW),
+        (ulong)CpuGovernor::levelTime(now, CPU_LEVEL_MIDDLE), (ulong)CpuGovernor::levelTime(now, CPU_LEVEL_HIGH));
+    sendBody("Audio: loops=%lu late=%lu underrun=%lu rebuffer=%lu max-gap=%lu", (ulong)AudioTask::loops(),
+        (ulong)AudioTask::lateLoops(), (ulong)AudioTask::underruns(), (ulong)AudioTask::rebuffers(),
+        (ulong)AudioTask::maxGap());
+    sendBody("Loop: idle=%u%% wakeup=%lu timeout=%lu timer=%d", EventLoop::idle(now), (ulong)EventLoop::wakeups(),
+        (ulong)EventLoop::timeouts(), TimerWheel::active());
+    reserveBody(80);
+    sendBody("Wi-Fi: %s sleep=%lu heap=%lu/%lu free=%lu", _wifiStatus == WIFI_CLOSE ? "off" : "on", (ulong)_wifiSleeps,
+        (ulong)_wifiHeapOn, (ulong)_wifiHeapOff, (ulong)ESP.getFreeHeap());
+    for (int i = 0; i < PROFILE_STAGES; i++)
+    {
+        // 時間はus(小数点以下1桁)、ヒストグラムは0でない最後の区間まで
+        PROFILE_STATS stats;
+        Profiler::stats((ProfileStage)i, &stats);
+        const PROFILE_STATS* s = &stats;
+        uint32_t count = s->count;
+        uint32_t mean = count > 0 ? (uint32_t)(s->total / count) : 0;
+        uint32_t min = count > 0 ? s->min : 0;
+        char histogram[PROFILE_BUCKETS * 11];
+        STR_BUFFER buffer;
+        Utils::init_buffer(&buffer, histogram, sizeof(histogram));
+        int last = 0;
+        for (int j = 0; j < PROFILE_BUCKETS; j++)
+        {
+            if (s->histogram[j] != 0)
+                last = j;
+        }
+        for (int j = 0; j <= last; j++)
+            Utils::printf_buffer(&buffer, j == 0 ? "%lu" : ",%lu", (ulong)s->histogram[j]);
+        reserveBody(64 + strlen(histogram));
+        sendBody("Stage %s: n=%lu min=%lu.%lu mean=%lu.%lu max=%lu.%lu hist=%s", Profiler::name((ProfileStage)i),
+            (ulong)count, (ulong)(min / 1000), (ulong)(min % 1000 / 100), (ulong)(mean / 1000),
+            (ulong)(mean % 1000 / 100), (ulong)(s->max / 1000), (ulong)(s->max % 1000 / 100), histogram);
+    }
+    sendEnd();
+}
+
+void Processor::cmdTransport(uint32_t now, const char* cmd)
+{
+    // transport [reset]
+    if (*cmd == ' ')
+    {
+        const char* ptr = Utils::is_symbol_ptr("reset", cmd + 1);
+        if (ptr == nullptr || *ptr != '\0')
+        {
+            sendResponse(CD_BAD_PARAMETER);
+            return;
+        }
+        for (int i = 0; i < _transportCount; i++)
+            _transports[i]->resetStats();
+        sendResponse(CD_SUCCESS);
+        return;
+    }
+    if (*cmd != '\0')
+    {
+        sendResponse(CD_BAD_PARAMETER);
+        return;
+    }
+    sendResponse(CD_SUCCESS, true);
+    for (int i = 0; i < _transportCount; i++)
+    {
+        Transport* t = _transports[i];
+        const TRANSPORT_STATS* s = t->stats();
+        uint32_t rttCount = s->rttCount;
+        uint32_t rttMean = rttCount > 0 ? (uint32_t)(s->rttTotal / rttCount) : 0;
+        char histogram[TRANSPORT_SIZE_BUCKETS * 11];
+        STR_BUFFER buffer;
+        Utils::init_buffer(&buffer, histogram, sizeof(histogram));
+        for (int j = 0; j < TRANSPORT_SIZE_BUCKETS; j++)
+            Utils::printf_buffer(&buffer, j == 0 ? "%lu" : ",%lu", (ulong)s->sizeHistogram[j]);
+        reserveBody(180);
+        sendBody("%s:%s in=%lu/%lu out=%lu/%lu overflow=%lu indicate=%lu/%lu rtt=%lu/%lu/%lu",
+            t->name(), t == _currentTransport ? " current" : "",
+            (ulong)s->bytesIn, (ulong)s->receives, (ulong)s->bytesOut, (ulong)s->sends, (ulong)s->overflows,
+            (ulong)s->indications, (ulong)s->indicationErrors,
+            (ulong)(rttCount > 0 ? s->rttMin : 0), (ulong)rttMean, (ulong)s->rttMax);
+        reserveBody(16 + strlen(histogram));
+        sendBody("%s-size: %s", t->name(), histogram);
+    }
+    sendEnd();
+}
+
+void Processor::cmdTrace(uint32_t now, const char* cmd)
+{
+    // trace [clear]
+    if (*cmd == ' ')
+    {
+        const char* ptr = Utils::is_symbol_ptr("clear", cmd + 1);
+        if (ptr == nullptr || *ptr != '\0')
+        {
+            sendResponse(CD_BAD_PARAMETER);
+            return;
+        }
+        Trace::clear();
+        sendResponse(CD_SUCCESS);
+        return;
+    }
+    if (*cmd != '\0')
+    {
+        sendResponse(CD_BAD_PARAMETER);
+        return;
+    }
+    if (_currentTransport == nullptr)
+        return;
+    // 応答の後に、sizeバイトの記録を古い順にそのまま送る
+    // 応答自身の記録が一番古い記録を上書きするので、1件少なく送る
+    uint32_t head = Trace::head();
+    uint32_t count = head < TRACE_ENTRIES - 1 ? head : TRACE_ENTRIES - 1;
+    sendResponse(CD_SUCCESS, false, ", Trace. size=%u record=%u count=%u", (uint)(count * sizeof(TRACE_RECORD)),
+        (uint)sizeof(TRACE_RECORD), (uint)count);
+    TRACE_RECORD records[16];
+    for (uint32_t sent = 0; sent < count;)
+    {
+        uint32_t n = count - sent < 16 ? count - sent : 16;
+        Trace::copy(head - count + sent, records, n);
+        size_t len = n * sizeof(TRACE_RECORD);
+        if (_currentTransport->send((const uint8_t*)records, len) != len)
+        {
+            // 途中で送れなくなったら、大きさの合わないデータが続かないように接続を閉じる
+            _currentTransport->close();
+            onTransportDisconnect(now, _currentTransport);
+            return;
+        }
+        sent += n;
+    }
+}
+
+void Processor::cmdVoices(uint32_t now, const char* cmd)
+{
+    // voices
+    if (*cmd != '\0')
+    {
+        sendResponse(CD_BAD_PARAMETER);
+        return;
+    }
+    sendResponse(CD_SUCCESS, true);
+    sendBody("Voices: %d/%d steal=%lu cost=%lu", Mixer::activeVoices(), MIXER_VOICES,
+        (ulong)Mixer::steals(), (ulong)Mixer::cyclesPerVoiceFrame());
+    for (int i = 0; i < MIXER_VOICES; i++)
+    {
+        MIXER_VOICE_INFO info;
+        if (!Mixer::snapshot(i, &info))
+            continue;
+        sendBody("%d %s %lu/%lu %u", i, info.name + 1, (ulong)info.position, (ulong)info.length,
+            (uint)((info.gain * 100 + 128) / 256));
+    }
+    sendEnd();
+}
+
+void Processor::cmdTone(uint32_t now, const char* cmd)
+{
+    // tone [sine|square|triangle|saw] [adsr=a,d,s,r] note[:ms],note[:ms],... [gain]
+    if (*cmd != ' ')
+    {
+        sendResponse(CD_NEED_PARAMETER);
+        return;
+    }
+    SYNTH_SEQUENCE sequence;
+    Synth::defaults(&sequence);
+    cmd = Synth::parseWave(cmd, &sequence.wave);
+    cmd = Synth::parseEnvelope(cmd, &sequence);
+    if (cmd)
+        cmd = Synth::parseNotes(cmd, &sequence);
+    if (cmd)
+        cmd = parseGain(cmd, &sequence.gain);
+    if (!cmd || Utils::skipWs(cmd) != nullptr)
+    {
+        sendResponse(CD_BAD_COMMAND_FORMAT);
+        return;
+    }
+    AudioTask::tone(&sequence);
+    sendResponse(CD_SUCCESS);
+}
+
+void Processor::cmdHttpCache(uint32_t now, const char* cmd)
+{
+    // http-cache [on|off|clear] | [revalidate on|off]
+    cmd = Utils::skipWs(cmd);
+    if (cmd == nullptr || *cmd == '\0')
+    {
+        uint32_t hits = HttpCache::hits();
+        uint32_t total = hits + HttpCache::misses();
+        sendResponse(CD_SUCCESS, true);
+        sendBody("HTTP Cache: %s revalidate=%s", HttpCache::enabled() ? "on" : "off",
+            HttpCache::revalidateEnabled() ? "on" : "off");
+        sendBody("Cache Usage: %lu/%lu", (ulong)HttpCache::used(), (ulong)HTTP_CACHE_SIZE);
+        sendBody("Hit: %lu/%lu %lu%%", (ulong)hits, (ulong)total, (ulong)(total ? hits * 100 / total : 0));
+        sendBody("URLs:");
+        for (int i = 0; i < HTTP_CACHE_ENTRIES; i++)
+        {
+            const HTTP_CACHE_ENTRY* e = HttpCache::entry(i);
+            if (e == nullptr)
+                continue;
+            if (strlen(e->url) + 12 > _messageBufferRef.remain)
+            {
+                flushSendBuffer();
+            }
+            sendBody("%s %lu", e->url, (ulong)e->size);
+        }
+        sendEnd();
+        return;
+    }
+    bool revalidate = false;
+    const char* ptr = Utils::is_symbol_ptr("revalidate", cmd);
+    if (ptr)
+    {
+        revalidate = true;
+        cmd = Utils::skipWs(ptr);
+        if (cmd == nullptr)
+        {
+            sendResponse(CD_NEED_PARAMETER);
+            return;
+        }
+    }
+    if ((ptr = Utils::is_symbol_ptr("on", cmd)) != nullptr && *ptr == '\0')
+    {
+        if (revalidate)
+            HttpCache::setRevalidate(true);
+        else
+            HttpCache::setEnabled(true);
+    }
+    else if ((ptr = Utils::is_symbol_ptr("off", cmd)) != nullptr && *ptr == '\0')
+    {
+        if (revalidate)
+            HttpCache::setRevalidate(false);
+        else
+            HttpCache::setEnabled(false);
+    }
+    else if (!revalidate && (ptr = Utils::is_symbol_ptr("clear", cmd)) != nullptr && *ptr == '\0')
+    {
+        if (Utils::strcmp_ptr("http://", _playFileName))
+            stopAudio();
+        HttpCache::clear();
+    }
+    else
+    {
+        sendResponse(CD_BAD_PARAMETER);
+        return;
+    }
+    sendResponse(CD_SUCCESS);
 }
 
-void Processor::cmdList(uint32_t now, const char* cmd)
+void Processor::cmdStream(uint32_t now, const char* cmd)
 {
-    // List
-    if (*cmd != '\0')
+    // stream [on|off] | [prebuffer <ms>]
+    cmd = Utils::skipWs(cmd);
+    if (cmd == nullptr || *cmd == '\0')
+    {
+        sendResponse(CD_SUCCESS, true);
+        sendBody("Stream Buffer: %s prebuffer=%u", StreamBuffer::enabled() ? "on" : "off", StreamBuffer::prebuffer());
+        sendBody("Network: throughput=%lu jitter=%lu target=%lu", (ulong)StreamBuffer::throughput(),
+            (ulong)StreamBuffer::jitter(), (ulong)StreamBuffer::target());
+        sendBody("Receive: %lu/%lu", (ulong)StreamBuffer::received(), (ulong)StreamBuffer::size());
+        sendBody("Underrun: %lu rebuffer=%lu", (ulong)AudioTask::underruns(), (ulong)AudioTask::rebuffers());
+        sendEnd();
+        return;
+    }
+    const char* ptr;
+    if ((ptr = Utils::is_symbol_ptr("on", cmd)) != nullptr && *ptr == '\0')
+    {
+        StreamBuffer::setEnabled(true);
+    }
+    else if ((ptr = Utils::is_symbol_ptr("off", cmd)) != nullptr && *ptr == '\0')
+    {
+        StreamBuffer::setEnabled(false);
+    }
+    else if ((ptr = Utils::is_symbol_ptr("prebuffer", cmd)) != nullptr)
+    {
+        uint ms;
+        ptr = Utils::parseUInt(ptr, &ms);
+        if (ptr == nullptr || Utils::skipWs(ptr) != nullptr)
+        {
+            sendResponse(CD_BAD_COMMAND_FORMAT);
+            return;
+        }
+        if (ms > 10000)
+        {
+            sendResponse(CD_COMMAND_ERROR);
+            return;
+        }
+        StreamBuffer::setPrebuffer((uint16_t)ms);
+    }
+    else
     {
         sendResponse(CD_BAD_PARAMETER);
         return;
     }
-    size_t totalBytes = LittleFS.totalBytes();
-    size_t usedBytes = LittleFS.usedBytes();
-    File root = LittleFS.open("/");
-    File file = root.openNextFile();
-    sendResponse(CD_SUCCESS, true);
-    sendBody("Storage Usage: %lu/%lu\nFiles:", (ulong)usedBytes, (ulong)totalBytes);
-    while (file)
+    sendResponse(CD_SUCCESS);
+}
+
+void Processor::cmdBundle(uint32_t now, const char* cmd)
+{
+    // bundle | bundle upload size [crc16] | bundle erase
+    cmd = Utils::skipWs(cmd);
+    if (cmd == nullptr || *cmd == '\0')
     {
-        const char* name = file.name();
-        if (strlen(name) + 10 > _messageBufferRef.remain)
+        if (!Bundle::available())
         {
-            flushSendBuffer();
+            sendResponse(CD_FILE_NOT_FOUND);
+            return;
+        }
+        sendResponse(CD_SUCCESS, true);
+        sendBody("Bundle Usage: %lu/%lu\nFiles:", (ulong)Bundle::size(), (ulong)Bundle::capacity());
+        for (int i = 0; i < Bundle::count(); i++)
+        {
+            const BUNDLE_ENTRY* e = Bundle::entry(i);
+            char line[64];
+            snprintf(line, sizeof(line), "%s %lu %lu", e->name, (ulong)e->size, (ulong)Bundle::duration(i));
+            reserveBody(strlen(line) + 1);
+            sendBody("%s", line);
         }
-        sendBody("%s %lu", name, (ulong)file.size());
-        file = root.openNextFile();
+        sendEnd();
+        return;
     }
-    sendEnd();
+    const char* ptr;
+    bool upload = false;
+    if ((ptr = Utils::is_symbol_ptr("upload", cmd)) != nullptr)
+    {
+        upload = true;
+        ptr = Utils::parseUInt(ptr, &_uploadFileSize);
+        if (ptr == nullptr)
+        {
+            sendResponse(CD_BAD_COMMAND_FORMAT);
+            return;
+        }
+        _uploadCheckCrc = false;
+        ptr = Utils::skipWs(ptr);
+        if (ptr != nullptr)
+        {
+            uint32_t crc;
+            ptr = Utils::parseHex(ptr, &crc);
+            if (ptr == nullptr || Utils::skipWs(ptr) != nullptr || crc > 0xFFFF)
+            {
+                sendResponse(CD_BAD_COMMAND_FORMAT);
+                return;
+            }
+            _uploadExpectedCrc = (uint16_t)crc;
+            _uploadCheckCrc = true;
+        }
+    }
+    else if ((ptr = Utils::is_symbol_ptr("erase", cmd)) == nullptr || *ptr != '\0')
+    {
+        sendResponse(CD_BAD_PARAMETER);
+        return;
+    }
+    if (!Bundle::available())
+    {
+        sendResponse(CD_FILE_NOT_FOUND);
+        return;
+    }
+    if (upload && _uploadFileSize > Bundle::capacity())
+    {
+        sendResponse(CD_STORAGE_FULL);
+        return;
+    }
+    // バンドルのデータを読んでいる再生とキャッシュを先に外す
+    // 待機中のデコードもマップしたフラッシュを読んでいるので、再生タスクで止めてから外す
+    stopQueue();
+    stopAudio();
+    AudioTask::mixStop();
+    AudioTask::cancelDecode();
+    SoundCache::removeBundle();
+    if (SoundCache::bundleInUse())
+    {
+        sendResponse(CD_FILE_IN_USE);
+        return;
+    }
+    if (!upload)
+    {
+        Bundle::abort();
+        sendResponse(CD_SUCCESS);
+        return;
+    }
+    if (!Bundle::begin(_uploadFileSize))
+    {
+        sendResponse(CD_FILE_IO_ERROR);
+        return;
+    }
+    _uploadBundle = true;
+    _fileUploadStatus = CD_SUCCESS;
+    _uploadCrc = 0xFFFF;
+    _receiveFileSize = 0;
+    _state = FILE_UPLOAD;
+    _lastUploadTime = 0;
+    _uploadTimer = TimerWheel::reschedule(now, _uploadTimer, DATA_CHUNK_TIMEOUT, onUploadTimer);
+    _lastAvailable = 0;
+    sendResponse(CD_SUCCESS, false, ", Upload Start. size=%u", _uploadFileSize);
 }
 
-void Processor::onWifiConnect(uint32_t now)
+void Processor::onWifiConnect(uint32_t now, const uint8_t* bssid, uint8_t channel)
 {
     if (_wifiStatus != WIFI_CONNECTED)
     {
+        _wifiConnectTime = now - _wifiConnectStart;
+        // 次の起動で直接つなぐために、変わっていればメインループで保存する
+        if (channel != _wifiChannel || memcmp(bssid, _wifiBssid, sizeof(_wifiBssid)) != 0)
+        {
+            memcpy(_wifiBssid, bssid, sizeof(_wifiBssid));
+            _wifiChannel = channel;
+            _wifiApChanged = true;
+        }
         if (_wifiStatus == WIFI_CONNECTING)
         {
             esp_wifi_set_ps(WIFI_PS_MIN_MODEM);
         }
         _wifiStatus = WIFI_CONNECTED;
+        _wifiRetryCount = 0;
         _wifiNotifyPending = true;
     }
 }
 
 void Processor::onWifiDisconnect(uint32_t now, uint8_t reason)
 {
+    // 使わないために止めた場合は、止めたときの切断を切断として扱わない
+    if (_wifiStatus == WIFI_CLOSE)
+        return;
     if (_wifiStatus != WIFI_DISCONNECTED)
     {
         _wifiStatus = WIFI_DISCONNECTED;
@@ -662,8 +2046,15 @@ void Processor::onWifiDisconnect(uint32_t now, uint8_t reason)
     }
 }
 
+void Processor::addTransport(Transport* transport)
+{
+    if (_transportCount < TRANSPORT_COUNT)
+        _transports[_transportCount++] = transport;
+}
+
 bool Processor::onTransportConnect(uint32_t now, Transport* transport)
 {
+    Trace::record(TRACE_CONNECT, transport->getType());
     _serialDisconnectTime = 0;
     if (_currentTransport == transport)
         return true;
@@ -689,6 +2080,7 @@ bool Processor::onTransportConnect(uint32_t now, Transport* transport)
 
 void Processor::onTransportDisconnect(uint32_t now, Transport* transport)
 {
+    Trace::record(TRACE_DISCONNECT, transport->getType());
     if (_currentTransport == transport)
     {
         _currentTransport = nullptr;
@@ -701,6 +2093,8 @@ void Processor::onSerialConnect(uint32_t now, Transport* transport)
     if (_serialDisconnectTime != 0)
     {
         _serialDisconnectTime = 0;
+        TimerWheel::cancel(_serialDisconnectTimer);
+        _serialDisconnectTimer = 0;
         return;
     }
     onTransportConnect(now, transport);
@@ -709,6 +2103,19 @@ void Processor::onSerialConnect(uint32_t now, Transport* transport)
 void Processor::onSerialDisconnect(uint32_t now, Transport* transport)
 {
     _serialDisconnectTime = now;
+    _serialDisconnectTimer = TimerWheel::reschedule(now, _serialDisconnectTimer, SERIAL_DISCONNECT_GRACE, onSerialDisconnectTimer);
+}
+
+// 切断の後、SERIAL_DISCONNECT_GRACEの間に再接続されなければ接続を閉じる
+void Processor::onSerialDisconnectTimer(uint32_t now, uint32_t arg)
+{
+    Processor* self = _instance;
+    self->_serialDisconnectTimer = 0;
+    if (self->_serialDisconnectTime == 0)
+        return;
+    self->_serialDisconnectTime = 0;
+    if (self->_currentTransport != nullptr && self->_currentTransport->getType() == SERIAL_TRANSPORT)
+        self->onTransportDisconnect(now, self->_currentTransport);
 }
 
 void Processor::commandProcess(uint32_t now, const char* line)
@@ -719,6 +2126,11 @@ void Processor::commandProcess(uint32_t now, const char* line)
         cmdAbout(now);
         return;
     }
+    // コマンド名の先頭4文字を記録する
+    uint32_t verb = 0;
+    for (int i = 0; i < 4 && cmp[i] != '\0' && cmp[i] != ' '; i++)
+        verb |= (uint32_t)(uint8_t)cmp[i] << (i * 8);
+    Trace::record(TRACE_COMMAND, strlen(line), verb);
     const char* ptr = Utils::is_symbol_ptr("ping", cmp);
     if (ptr)
     {
@@ -749,6 +2161,18 @@ void Processor::commandProcess(uint32_t now, const char* line)
         cmdLedOff(now, ptr);
         return;
     }
+    ptr = Utils::is_symbol_ptr("led-config", cmp);
+    if (ptr)
+    {
+        cmdLedConfig(now, ptr);
+        return;
+    }
+    ptr = Utils::is_symbol_ptr("led-brightness", cmp);
+    if (ptr)
+    {
+        cmdLedBrightness(now, ptr);
+        return;
+    }
     ptr = Utils::is_symbol_ptr("play", cmp);
     if (ptr)
     {
@@ -761,6 +2185,54 @@ void Processor::commandProcess(uint32_t now, const char* line)
         cmdStop(now, ptr);
         return;
     }
+    ptr = Utils::is_symbol_ptr("queue", cmp);
+    if (ptr)
+    {
+        cmdQueue(now, ptr);
+        return;
+    }
+    ptr = Utils::is_symbol_ptr("stats", cmp);
+    if (ptr)
+    {
+        cmdStats(now, ptr);
+        return;
+    }
+    ptr = Utils::is_symbol_ptr("transport", cmp);
+    if (ptr)
+    {
+        cmdTransport(now, ptr);
+        return;
+    }
+    ptr = Utils::is_symbol_ptr("trace", cmp);
+    if (ptr)
+    {
+        cmdTrace(now, ptr);
+        return;
+    }
+    ptr = Utils::is_symbol_ptr("voices", cmp);
+    if (ptr)
+    {
+        cmdVoices(now, ptr);
+        return;
+    }
+    ptr = Utils::is_symbol_ptr("bundle", cmp);
+    if (ptr)
+    {
+        cmdBundle(now, ptr);
+        return;
+    }
+    ptr = Utils::is_symbol_ptr("stream", cmp);
+    if (ptr)
+    {
+        cmdStream(now, ptr);
+        return;
+    }
+    ptr = Utils::is_symbol_ptr("tone", cmp);
+    if (ptr)
+    {
+        cmdTone(now, ptr);
+        return;
+    }
     ptr = Utils::is_symbol_ptr("volume", cmp);
     if (ptr)
     {
@@ -785,6 +2257,30 @@ void Processor::commandProcess(uint32_t now, const char* line)
         cmdList(now, ptr);
         return;
     }
+    ptr = Utils::is_symbol_ptr("have", cmp);
+    if (ptr)
+    {
+        cmdHave(now, ptr);
+        return;
+    }
+    ptr = Utils::is_symbol_ptr("link", cmp);
+    if (ptr)
+    {
+        cmdLink(now, ptr);
+        return;
+    }
+    ptr = Utils::is_symbol_ptr("cache", cmp);
+    if (ptr)
+    {
+        cmdCache(now, ptr);
+        return;
+    }
+    ptr = Utils::is_symbol_ptr("http-cache", cmp);
+    if (ptr)
+    {
+        cmdHttpCache(now, ptr);
+        return;
+    }
     sendResponse(CD_UNKNOWN_COMMAND);
 }
 
@@ -814,6 +2310,7 @@ size_t Processor::uploadProcess(uint32_t now)
         readSize = remain;
     }
     _receiveFileSize += readSize;
+    Trace::record(TRACE_UPLOAD, readSize, _receiveFileSize);
     const byte* buffer = readReceiveBuffer(readSize);
     if (buffer == nullptr)
     {
@@ -821,9 +2318,32 @@ size_t Processor::uploadProcess(uint32_t now)
         _fileUploadStatus = CD_ERROR;
         return 0;
     }
+    _uploadCrc = Utils::crc16(buffer, readSize, _uploadCrc);
+    if (_uploadBundle)
+    {
+        // バンドルはフラッシュへそのまま順に書き込む
+        if (_fileUploadStatus == CD_SUCCESS && !Bundle::write(buffer, readSize))
+            _fileUploadStatus = CD_FILE_IO_ERROR;
+        if (_receiveFileSize == _uploadFileSize)
+        {
+            finishBundleUpload();
+            _state = COMMAND_LISTEN;
+            _lastUploadTime = 0;
+            TimerWheel::cancel(_uploadTimer);
+            _uploadTimer = 0;
+        }
+        return readSize;
+    }
+    mbedtls_sha256_update_ret(&_uploadHash, buffer, readSize);
     if (_uploadFile && _fileUploadStatus == CD_SUCCESS)
     {
-        if (_uploadFile.write(buffer, readSize) != readSize)
+        // 再生できない形式と分かった時点で書き込みをやめる(残りのデータは読み捨てる)
+        if (!_uploadScanner.feed(buffer, readSize))
+        {
+            _uploadFile.close();
+            _fileUploadStatus = CD_UNSUPPORTED_FORMAT;
+        }
+        else if (_uploadFile.write(buffer, readSize) != readSize)
         {
             _uploadFile.close();
             _fileUploadStatus = CD_FILE_IO_ERROR;
@@ -834,19 +2354,120 @@ size_t Processor::uploadProcess(uint32_t now)
         bool success = false;
         if (_uploadFile && _fileUploadStatus == CD_SUCCESS)
         {
+            size_t written = _uploadFile.size();
             _uploadFile.close();
-            success = true;
+            if (written != _uploadFileSize)
+                _fileUploadStatus = CD_FILE_IO_ERROR;
+            else if (_uploadCheckCrc && _uploadCrc != _uploadExpectedCrc)
+                _fileUploadStatus = CD_CHECKSUM_ERROR;
+            else if (!_uploadScanner.finish())
+                _fileUploadStatus = CD_UNSUPPORTED_FORMAT;
+            else
+                success = true;
         }
+        if (success)
+        {
+            success = commitUpload();
+            if (!success)
+                _fileUploadStatus = CD_FILE_IO_ERROR;
+        }
+        if (!success)
+            LittleFS.remove(UPLOAD_TEMP_PATH);
+        Manifest::release();
         if (success)
             sendResponse(CD_SUCCESS, false, ", Upload Complete. size=%u", _receiveFileSize);
+        else if (_fileUploadStatus == CD_UNSUPPORTED_FORMAT)
+            sendResponse(_fileUploadStatus, false, ", %s", _uploadScanner.error());
+        else if (_fileUploadStatus == CD_CHECKSUM_ERROR)
+            sendResponse(_fileUploadStatus, false, ", crc=%04x", _uploadCrc);
         else
             sendResponse(_fileUploadStatus);
         _state = COMMAND_LISTEN;
         _lastUploadTime = 0;
+        TimerWheel::cancel(_uploadTimer);
+        _uploadTimer = 0;
     }
     return readSize;
 }
 
+// 確認の済んだ一時ファイルを_uploadFileNameに置き換える
+// 同じ内容のファイルがあれば一時ファイルは捨てて別名にする
+bool Processor::commitUpload()
+{
+    uint8_t hash[MANIFEST_HASH_SIZE];
+    mbedtls_sha256_finish_ret(&_uploadHash, hash);
+    const MANIFEST_ENTRY* same = Manifest::findHash(hash);
+    const char* current = Manifest::path(_uploadFileName);
+    if (same != nullptr && current != nullptr && strcmp(current, same->name) == 0)
+    {
+        LittleFS.remove(UPLOAD_TEMP_PATH);
+        return true;
+    }
+    char target[32];
+    if (same != nullptr)
+        strcpy(target, same->name);
+
+    stopAudio(_uploadFileName);
+    if (!Manifest::unlink(_uploadFileName))
+    {
+        // 元の内容は別名へ移ったか、別名を外しただけ
+        SoundCache::remove(_uploadFileName);
+    }
+    else if (same != nullptr && Manifest::exists(_uploadFileName))
+    {
+        SoundCache::remove(_uploadFileName);
+        if (!deleteSound(_uploadFileName))
+            return false;
+    }
+    if (same != nullptr)
+    {
+        LittleFS.remove(UPLOAD_TEMP_PATH);
+        return Manifest::link(_uploadFileName, target);
+    }
+    if (!LittleFS.rename(UPLOAD_TEMP_PATH, _uploadFileName))
+        return false;
+    _uploadScanner.save(_uploadFileName);
+    Envelope::remove(_uploadFileName);
+    Manifest::refresh(_uploadFileName, hash);
+    SoundCache::remove(_uploadFileName);
+    SoundCache::request(_uploadFileName);
+    // 最初の再生から'~'のパターンが使えるように、空き時間に包絡線を作っておく
+    SoundCache::wantEnvelope(_uploadFileName);
+    return true;
+}
+
+void Processor::finishBundleUpload()
+{
+    if (_fileUploadStatus == CD_SUCCESS && _uploadCheckCrc && _uploadCrc != _uploadExpectedCrc)
+        _fileUploadStatus = CD_CHECKSUM_ERROR;
+    if (_fileUploadStatus != CD_SUCCESS)
+        Bundle::abort();
+    else if (!Bundle::commit())
+        _fileUploadStatus = CD_UNSUPPORTED_FORMAT;
+    if (_fileUploadStatus == CD_SUCCESS)
+        sendResponse(CD_SUCCESS, false, ", Bundle Complete. files=%d", Bundle::count());
+    else if (_fileUploadStatus == CD_UNSUPPORTED_FORMAT)
+        sendResponse(_fileUploadStatus, false, ", bad bundle");
+    else if (_fileUploadStatus == CD_CHECKSUM_ERROR)
+        sendResponse(_fileUploadStatus, false, ", crc=%04x", _uploadCrc);
+    else
+        sendResponse(_fileUploadStatus);
+}
+
+// ファイルとインデックスを消して一覧から外す
+bool Processor::deleteSound(const char* name)
+{
+    Mp3Index::remove(name);
+    Envelope::remove(name);
+    if (!LittleFS.remove(name))
+    {
+        Manifest::refresh(name);
+        return false;
+    }
+    Manifest::remove(name);
+    return true;
+}
+
 size_t Processor::writeReceiveBuffer(const byte* data, size_t size)
 {
     byte* ptr = _receiveBufferWritePtr;
@@ -856,6 +2477,8 @@ size_t Processor::writeReceiveBuffer(const byte* data, size_t size)
     _receiveBufferWritePtr += writeSize;
     if (writeSize < size)
     {
+        if (_currentTransport != nullptr)
+            _currentTransport->countOverflow();
         sendNotify(CD_OVERFLOW);
     }
     return writeSize;
@@ -926,11 +2549,20 @@ size_t Processor::receiveBufferAvailable() const
 
 void Processor::cancelProcess()
 {
-    _state = COMMAND_LISTEN;
-    if (_uploadFile)
+    if (_state == FILE_UPLOAD && _uploadBundle)
     {
-        _uploadFile.close();
+        Bundle::abort();
+    }
+    else if (_state == FILE_UPLOAD)
+    {
+        // 書きかけの一時ファイルを消すだけで、元のファイルはそのまま残る
+        if (_uploadFile)
+            _uploadFile.close();
+        LittleFS.remove(UPLOAD_TEMP_PATH);
+        Manifest::release();
     }
+    // BLEの切断からも呼ばれるので、タイマーは取り消さずに期限で状態を見て何もしない
+    _state = COMMAND_LISTEN;
     _lastUploadTime = 0;
     _receiveBufferWritePtr = _receiveBuffer;
     _receiveBufferReadPtr = _receiveBuffer;
@@ -947,6 +2579,30 @@ void Processor::onTransportDataArrive(uint32_t now, Transport* transport, const
     writeReceiveBuffer(data, size);
 }
 
+// 最初のデータが届くまでは待ち続け、届いてからはDATA_CHUNK_TIMEOUT途切れたら中止する
+// 受信時刻は受信側のタスクが書き換えるので、期限が来たときに確かめて残りの時間で登録し直す
+void Processor::onUploadTimer(uint32_t now, uint32_t arg)
+{
+    Processor* self = _instance;
+    self->_uploadTimer = 0;
+    if (self->_state != FILE_UPLOAD)
+        return;
+    uint32_t last = self->_lastUploadTime;
+    uint32_t delay = DATA_CHUNK_TIMEOUT;
+    if (last != 0)
+    {
+        uint32_t elapsed = now - last;
+        if (elapsed > DATA_CHUNK_TIMEOUT)
+        {
+            self->cancelProcess();
+            self->sendNotify(CD_TIMEOUT);
+            return;
+        }
+        delay = DATA_CHUNK_TIMEOUT + 1 - elapsed;
+    }
+    self->_uploadTimer = TimerWheel::schedule(now, delay, onUploadTimer);
+}
+
 void Processor::dataProcess(uint32_t now)
 {
     while (!receiveBufferIsEmpty())
@@ -970,13 +2626,38 @@ void Processor::dataProcess(uint32_t now)
 
 void Processor::timeProcess(uint32_t now)
 {
-    if (_wifiStatus == WIFI_CONNECTING)
+    HttpCache::process(AudioTask::isRunning() ? _playFileName : "");
+    // つながっていた接続が切れたら、最初の間隔からつなぎ直す
+    if (_wifiRetryEnabled && _wifiStatus == WIFI_DISCONNECTED && !TimerWheel::pending(_wifiRetryTimer))
+    {
+        _wifiConnectStart = now;
+        scheduleWifiRetry(now);
+    }
+    // 起こしたWi-FiのIPアドレスが決まったら、待たせていた再生を始める
+    if (TimerWheel::pending(_wifiPendingPlay.timer) && _wifiStatus == WIFI_CONNECTED && WiFi.status() == WL_CONNECTED)
+        startPendingPlay();
+    if (_wifiApChanged)
+    {
+        _wifiApChanged = false;
+        if (_wifiSsid[0] != 0)
+            saveWifiSettings();
+    }
+    if (AudioTask::isRebuffering() != _streamPaused)
     {
-        if (now - _lastWifiConnectTime > 1000)
+        if (_state == COMMAND_LISTEN && _currentTransport != nullptr && _serialDisconnectTime == 0)
         {
-            WiFi.disconnect();
-            WiFi.reconnect();
-            _lastWifiConnectTime = now;
+            _streamPaused = !_streamPaused;
+            sendNotify(_streamPaused ? CD_STREAM_REBUFFERING : CD_STREAM_RESUMED, true);
+            sendBody("underrun=%lu rebuffer=%lu", (ulong)AudioTask::underruns(), (ulong)AudioTask::rebuffers());
+            sendEnd();
+        }
+    }
+    if (_queueNotifyPending)
+    {
+        if (_state == COMMAND_LISTEN && _currentTransport != nullptr && _serialDisconnectTime == 0)
+        {
+            sendNotify(CD_QUEUE_FINISHED);
+            _queueNotifyPending = false;
         }
     }
     if (_wifiNotifyPending)
@@ -985,23 +2666,37 @@ void Processor::timeProcess(uint32_t now)
         {
             if (_wifiStatus == WIFI_CONNECTED)
             {
-                sendNotify(CD_WIFI_CONNECTED);
+                sendNotify(CD_WIFI_CONNECTED, true);
+                sendBody("time=%lu channel=%u", (ulong)_wifiConnectTime, _wifiChannel);
+                sendEnd();
                 _wifiNotifyPending = false;
             }
             else if (_wifiStatus == WIFI_DISCONNECTED)
             {
+                int code;
                 switch (_wifiDisconnectReason)
                 {
                 case WIFI_REASON_AUTH_EXPIRE:
                 case WIFI_REASON_ASSOC_EXPIRE:
                 case WIFI_REASON_4WAY_HANDSHAKE_TIMEOUT:
-                    sendNotify(CD_WIFI_AUTH_FAIL);
+                    code = CD_WIFI_AUTH_FAIL;
                     break;
                 case WIFI_REASON_NO_AP_FOUND:
-                    sendNotify(CD_WIFI_SSID_NOT_FOUND);
+                    code = CD_WIFI_SSID_NOT_FOUND;
                     break;
                 default:
-                    sendNotify(CD_WIFI_DISCONNECTED);
+                    code = CD_WIFI_DISCONNECTED;
+                }
+                // 通知は状態が変わったときだけで、つなぎ直すたびには送らない
+                if (TimerWheel::pending(_wifiRetryTimer))
+                {
+                    sendNotify(code, true);
+                    sendBody("attempt=%u next=%lu", _wifiRetryCount, (ulong)TimerWheel::remain(now, _wifiRetryTimer));
+                    sendEnd();
+                }
+                else
+                {
+                    sendNotify(code);
                 }
                 _wifiNotifyPending = false;
             }
@@ -1009,42 +2704,96 @@ void Processor::timeProcess(uint32_t now)
     }
 }
 
-void Processor::process(uint32_t now)
+void Processor::governorProcess(uint32_t now)
+{
+    CPU_LOAD load;
+    load.decoding = AudioTask::isRunning();
+    load.streaming = AudioTask::isStreaming();
+    load.bitRate = AudioTask::bitRate();
+    load.mixing = Mixer::isActive();
+    load.converting = SoundCache::hasPending();
+    load.uploading = _state == FILE_UPLOAD;
+    load.receiveFill = (uint8_t)(receiveBufferAvailable() * 100 / RECEIVE_BUFFER_SIZE);
+    CpuGovernor::update(now, &load);
+}
+
+// "~"で始まるLEDパターンのために、再生中の音の音量をLedSequencerへ渡す
+// Audioで再生中の音を優先し、なければ最後にミキサで鳴らした音を使う
+void Processor::envelopeProcess()
 {
-    audio.loop();
-    if (!audio.isRunning() && _cpuClockHigh)
+    if (!LedSequencer::following())
+        return;
+    char name[sizeof(_playFileName)];
+    uint32_t position = 0;
+    if (AudioTask::isRunning() && _playFileName[0] == '/')
     {
-        setCpuFrequencyMhz(160);
-        _cpuClockHigh = false;
+        strcpy(name, _playFileName);
+        position = Mixer::streamTime();
     }
-    if (_state == FILE_UPLOAD)
+    else if (!Mixer::latest(name, sizeof(name), &position))
     {
-        if (_lastUploadTime != 0 && now - _lastUploadTime > DATA_CHUNK_TIMEOUT)
-        {
-            cancelProcess();
-            sendNotify(CD_TIMEOUT);
-            return;
-        }
+        Envelope::follow(nullptr);
+        LedSequencer::setLevel(0);
+        return;
     }
+    if (!Envelope::follow(name))
+        SoundCache::wantEnvelope(name);
+    LedSequencer::setLevel(Envelope::level(position));
+}
+
+void Processor::process(uint32_t now)
+{
+    queueProcess();
+    if (CpuGovernor::due(now))
+        governorProcess(now);
+    TimerWheel::process(now);
+    uint32_t start = micros();
+    uint32_t cycles = Profiler::start();
     if (!receiveBufferIsEmpty())
     {
         dataProcess(now);
+        Profiler::record(PROFILE_DATA, cycles);
+        CpuGovernor::addBusy(micros() - start);
     }
     else
     {
         timeProcess(now);
+        Profiler::record(PROFILE_TIME, cycles);
     }
 
-    LedSequencer::update(now);
-    if (_serialDisconnectTime != 0)
+    start = micros();
+    envelopeProcess();
+    cycles = Profiler::start();
+    bool updated = LedSequencer::update(now);
+    Profiler::record(PROFILE_LED, cycles);
+    if (updated)
+        CpuGovernor::addBusy(micros() - start);
+}
+
+// 次にprocess()を呼ぶまで待ってよい時間(ms)
+// 受信や接続などはイベントで起こされるので、ここでは時間で決まる仕事だけを見る
+uint32_t Processor::waitTime(uint32_t now)
+{
+    if (_state == FILE_UPLOAD)
     {
-        if (_currentTransport != nullptr && _currentTransport->getType() == SERIAL_TRANSPORT)
-        {
-            if (now - _serialDisconnectTime > 1000)
-            {
-                _serialDisconnectTime = 0;
-                onTransportDisconnect(now, _currentTransport);
-            }
-        }
+        // 受信済みのデータで次の書き込みができるなら待たない
+        size_t remain = _uploadFileSize - _receiveFileSize;
+        size_t chunk = remain < RECEIVE_BUFFER_SIZE ? remain : RECEIVE_BUFFER_SIZE;
+        if (receiveBufferAvailable() >= chunk)
+            return 0;
     }
+    uint32_t wait = EVENT_LOOP_MAX_WAIT;
+    if (AudioTask::isRunning() || Mixer::isActive() || _queueActive || _streamPaused)
+        wait = EVENT_LOOP_ACTIVE_INTERVAL;
+    uint32_t t = LedSequencer::nextUpdate(now);
+    if (t < wait)
+        wait = t;
+    t = CpuGovernor::next(now);
+    if (t < wait)
+        wait = t;
+    // アップロードの中断やWi-Fiの再接続などの期限はタイマーホイールにまとめてある
+    t = TimerWheel::next(now);
+    if (t < wait)
+        wait = t;
+    return wait;
 }
@@ -7,9 +7,12 @@
 
 #include <Arduino.h>
 #include <WiFi.h>
-#include <Audio.h>
+#include <FS.h>
+#include <mbedtls/sha256.h>
 #include "config.h"
 #include "led_sequencer.h"
+#include "mp3_index.h"
+#include "timer_wheel.h"
 #include "utils.h"
 
 enum ProcessorState {
@@ -25,11 +28,16 @@ enum WiFiStatus
 	WIFI_CONNECTED,
 	WIFI_DISCONNECTED
 };
+typedef struct _DELAYED_PLAY {
+	TimerId		timer;
+	char		name[80];
+	uint8_t		gain;
+} DELAYED_PLAY;
+
 class Transport;
 class Processor {
 private:
 	static Processor *_instance;
-	bool _cpuClockHigh;
 	byte _receiveBuffer[RECEIVE_BUFFER_SIZE+RECEIVE_BUFFER_OVERFLOW_SIZE]{};
 	byte* _receiveBufferReadPtr = nullptr;
 	byte* _receiveBufferWritePtr = nullptr;
@@ -40,28 +48,88 @@ private:
 	WiFiStatus _wifiStatus;
 	uint8_t _wifiDisconnectReason;
 	bool _wifiNotifyPending;
-	uint32_t _lastWifiConnectTime;
+	TimerId _wifiRetryTimer;
+	bool _wifiRetryEnabled;
+	uint8_t _wifiRetryCount;
+	char _wifiSsid[SSID_MAX_LENGTH];
+	char _wifiPassword[PASSWORD_MAX_LENGTH];
+	uint8_t _wifiBssid[6];
+	uint8_t _wifiChannel;			// 0 = 前回のアクセスポイントが分からない
+	bool _wifiFastConnect;			// 前回のBSSIDとチャンネルを指定して接続中
+	volatile bool _wifiApChanged;
+	uint32_t _wifiConnectStart;
+	volatile uint32_t _wifiConnectTime;	// 接続にかかった時間(ms)
+	bool _wifiEventRegistered;
+	TimerId _wifiIdleTimer;
+	uint32_t _wifiLastUse;
+	DELAYED_PLAY _wifiPendingPlay;		// Wi-Fiを起こしてから再生する
+	uint32_t _wifiSleeps;
+	uint32_t _wifiHeapOn;				// 止める直前の空きヒープ
+	uint32_t _wifiHeapOff;				// 止めた直後の空きヒープ
 
 	uint _uploadFileSize;
 	uint _receiveFileSize;
 	File _uploadFile;
+	char _uploadFileName[32]{};
+	Mp3Scanner _uploadScanner;
+	uint16_t _uploadCrc;
+	mbedtls_sha256_context _uploadHash;
+	bool _uploadBundle;
+	uint16_t _uploadExpectedCrc;
+	bool _uploadCheckCrc;
 	int _fileUploadStatus;
 	uint32_t _lastUploadTime;
+	TimerId _uploadTimer;
 	size_t _lastAvailable;
 
 	char _playFileName[80]{};
+	bool _queueActive;
+	bool _queueStarted;
+	bool _queueNotifyPending;
+	uint32_t _queueVoice;
+	bool _streamPaused;
 
 	uint32_t _serialDisconnectTime;
+	TimerId _serialDisconnectTimer;
+	TimerId _ledTimer[MAX_SLOT_COUNT];
+	DELAYED_PLAY _delayedPlay[DELAYED_PLAY_ENTRIES];
 	bool _firstConnect;
 
 	Transport * _currentTransport = nullptr;
+	Transport * _transports[TRANSPORT_COUNT]{};
+	int _transportCount = 0;
 
 	void stopAudio(const char *soundName=nullptr);
+	void beginAudio();
+	int playSound(const char *name, uint8_t gain, uint32_t *voice);
+	void stopQueue();
+	void prerollQueue();
+	void queueProcess();
+	static const char *parseSoundName(const char *cmd, char *name, size_t len);
+	static const char *parseGain(const char *cmd, uint8_t *gain);
+	static const char *soundPath(const char *name);
+	static const char *parseDelay(const char *cmd, uint32_t *delay);
+	void cancelDelayedPlay();
+	void cancelLedTimers();
+
+	static void onUploadTimer(uint32_t now, uint32_t arg);
+	static void onWifiRetryTimer(uint32_t now, uint32_t arg);
+	static void onWifiIdleTimer(uint32_t now, uint32_t arg);
+	static void onWifiWakeTimer(uint32_t now, uint32_t arg);
+	static void onSerialDisconnectTimer(uint32_t now, uint32_t arg);
+	static void onLedTimer(uint32_t now, uint32_t arg);
+	static void onDelayedPlayTimer(uint32_t now, uint32_t arg);
 
 	static const char * getWifiStatusMessage(wl_status_t s);
 	static void onWiFiEvent(WiFiEvent_t event, WiFiEventInfo_t info);
 	void wifiDisconnect();
-	void wifiConnect(const char* ssid, const char *passwd);
+	void wifiConnect(uint32_t now);
+	void wifiSleep();
+	bool deferNetworkPlay(uint32_t now, const char *name, uint8_t gain);
+	void startPendingPlay();
+	void loadWifiSettings();
+	void saveWifiSettings();
+	void scheduleWifiRetry(uint32_t now);
 
 	void cmdAbout(uint32_t now);
 	void cmdPing(uint32_t now, const char*ptr);
@@ -69,12 +137,26 @@ private:
 	void cmdWifi(uint32_t now, const char*ptr);
 	void cmdLedOn(uint32_t now, const char*ptr);
 	void cmdLedOff(uint32_t now, const char*ptr);
+	void cmdLedConfig(uint32_t now, const char*ptr);
+	void cmdLedBrightness(uint32_t now, const char*ptr);
 	void cmdPlay(uint32_t now, const char*cmd);
 	void cmdStop(uint32_t now, const char *cmd);
 	void cmdVolume(uint32_t now, const char*cmd);
+	void cmdVoices(uint32_t now, const char*cmd);
+	void cmdTone(uint32_t now, const char*cmd);
+	void cmdStats(uint32_t now, const char*cmd);
+	void cmdQueue(uint32_t now, const char*cmd);
 	void cmdUpload(uint32_t now, const char*cmd);
 	void cmdRemove(uint32_t now, const char*cmd);
 	void cmdList(uint32_t now, const char *cmd);
+	void cmdHave(uint32_t now, const char *cmd);
+	void cmdLink(uint32_t now, const char *cmd);
+	void cmdCache(uint32_t now, const char *cmd);
+	void cmdHttpCache(uint32_t now, const char *cmd);
+	void cmdStream(uint32_t now, const char *cmd);
+	void cmdBundle(uint32_t now, const char *cmd);
+	void cmdTransport(uint32_t now, const char *cmd);
+	void cmdTrace(uint32_t now, const char *cmd);
 
 	size_t writeReceiveBuffer(const byte* data, size_t size);
 	const char *readLineReceiveBuffer();
@@ -85,8 +167,13 @@ private:
 	void cancelProcess();
 	void commandProcess(uint32_t now, const char *line);;
 	size_t uploadProcess(uint32_t now);
+	bool commitUpload();
+	void finishBundleUpload();
+	bool deleteSound(const char *name);
 	void dataProcess(uint32_t now);
 	void timeProcess(uint32_t now);
+	void governorProcess(uint32_t now);
+	void envelopeProcess();
 
 	void sendNotify(int code, bool hasBody = false);
 	void sendResponse(int code, bool hasBody = false);
@@ -94,6 +181,7 @@ private:
 	void sendBody(const char *format, ...);
 	void sendEnd();
 	void flushSendBuffer();
+	void reserveBody(size_t len);
 	void sendMessage(const char *message);
 
 public:
@@ -102,16 +190,18 @@ public:
 	static const char *getMessageFromCode(int code);
 	void init();
 
+	void addTransport(Transport *transport);
 	bool onTransportConnect(uint32_t now, Transport *transport);
 	void onTransportDisconnect(uint32_t now, Transport *transport);
 	void onSerialConnect(uint32_t now, Transport *transport);
 	void onSerialDisconnect(uint32_t now, Transport *transport);
 	void onTransportDataArrive(uint32_t now, Transport *transport, const byte *data, size_t size);
 
-	void onWifiConnect(uint32_t now);
+	void onWifiConnect(uint32_t now, const uint8_t *bssid, uint8_t channel);
 	void onWifiDisconnect(uint32_t now, uint8_t reason);
 
 	void process(uint32_t now);
+	uint32_t waitTime(uint32_t now);
 };
 
 #endif //SLAPPYBELL_FIRMWARE_PROCESSOR_H
\ No newline at end of file
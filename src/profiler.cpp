@@ -0,0 +1,78 @@
+//
+// Created by agent on 2026/10/19.
+//
+
+#include <Arduino.h>
+
+#include "config.h"
+#include "profiler.h"
+
+PROFILE_CYCLES Profiler::_cycles[PROFILE_STAGES][PROFILE_CLOCKS];
+uint32_t Profiler::_histogram[PROFILE_STAGES][PROFILE_BUCKETS];
+uint32_t Profiler::_clockMhz[PROFILE_CLOCKS];
+int Profiler::_clock = 0;
+uint32_t Profiler::_mhz = 240;
+
+// クロックを変えたときに呼ぶ 記録はクロックごとに分けておく
+void Profiler::setFrequency(uint32_t mhz) {
+	_mhz = mhz;
+	for (int i = 0; i < PROFILE_CLOCKS; i++) {
+		if (_clockMhz[i] == mhz || _clockMhz[i] == 0) {
+			_clockMhz[i] = mhz;
+			_clock = i;
+			return;
+		}
+	}
+	// 区別できるクロックの数を超えたら、最後の区分を空けて使い直す
+	_clock = PROFILE_CLOCKS - 1;
+	for (int i = 0; i < PROFILE_STAGES; i++)
+		memset(&_cycles[i][_clock], 0, sizeof(PROFILE_CYCLES));
+	_clockMhz[_clock] = mhz;
+}
+
+// start()からのサイクル数を、今のクロックの区分に足す
+// ヒストグラムの区間を決める32bitの割り算のほかは加算と比較だけ
+void Profiler::record(ProfileStage stage, uint32_t start) {
+	uint32_t cycles = ESP.getCycleCount() - start;
+	PROFILE_CYCLES *c = &_cycles[stage][_clock];
+	if (c->count == 0 || cycles < c->min)
+		c->min = cycles;
+	if (cycles > c->max)
+		c->max = cycles;
+	c->total += cycles;
+	c->count++;
+	uint32_t us = cycles / _mhz;
+	int bucket = us == 0 ? 0 : 32 - __builtin_clz(us);
+	if (bucket >= PROFILE_BUCKETS)
+		bucket = PROFILE_BUCKETS - 1;
+	_histogram[stage][bucket]++;
+}
+
+// クロックごとの記録をnsにしてまとめる
+void Profiler::stats(ProfileStage stage, PROFILE_STATS *stats) {
+	memset(stats, 0, sizeof(PROFILE_STATS));
+	for (int i = 0; i < PROFILE_CLOCKS; i++) {
+		const PROFILE_CYCLES *c = &_cycles[stage][i];
+		if (c->count == 0 || _clockMhz[i] == 0)
+			continue;
+		uint32_t min = (uint32_t)((uint64_t)c->min * 1000 / _clockMhz[i]);
+		uint32_t max = (uint32_t)((uint64_t)c->max * 1000 / _clockMhz[i]);
+		if (stats->count == 0 || min < stats->min)
+			stats->min = min;
+		if (max > stats->max)
+			stats->max = max;
+		stats->total += c->total * 1000 / _clockMhz[i];
+		stats->count += c->count;
+	}
+	memcpy(stats->histogram, _histogram[stage], sizeof(stats->histogram));
+}
+
+const char *Profiler::name(ProfileStage stage) {
+	static const char *names[PROFILE_STAGES] = { "audio", "data", "time", "led", "show" };
+	return names[stage];
+}
+
+void Profiler::reset() {
+	memset(_cycles, 0, sizeof(_cycles));
+	memset(_histogram, 0, sizeof(_histogram));
+}
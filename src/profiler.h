@@ -0,0 +1,56 @@
+//
+// Created by agent on 2026/10/19.
+//
+
+#ifndef SLAPPYBELL_FIRMWARE_PROFILER_H
+#define SLAPPYBELL_FIRMWARE_PROFILER_H
+
+#include <Arduino.h>
+#include "config.h"
+
+enum ProfileStage {
+	PROFILE_AUDIO,		// AudioTaskのaudio.loop()
+	PROFILE_DATA,		// Processor::dataProcess()
+	PROFILE_TIME,		// Processor::timeProcess()
+	PROFILE_LED,		// LedSequencer::update() (表示を更新した場合はpixels.show()を含む)
+	PROFILE_SHOW,		// pixels.show()
+	PROFILE_STAGES,
+};
+
+typedef struct _PROFILE_STATS {
+	uint32_t	count;
+	uint32_t	min;		// ns
+	uint32_t	max;		// ns
+	uint64_t	total;		// ns
+	uint32_t	histogram[PROFILE_BUCKETS];	// [0]は1us未満、[n]は2^(n-1)us以上2^n us未満
+} PROFILE_STATS;
+
+// 1つのクロックで記録したサイクル数
+typedef struct _PROFILE_CYCLES {
+	uint32_t	count;
+	uint32_t	min;
+	uint32_t	max;
+	uint64_t	total;
+} PROFILE_CYCLES;
+
+// 処理ごとの所要時間をサイクルカウンタで測る
+// 記録はサイクル数のままクロックごとに足すだけなので、常に有効にしておける
+// 時間への換算はstats()で読み出すときに行う
+// 区間ごとに書き込むタスクは1つだけで、読み出し側は多少ずれた値を見てもよい
+class Profiler {
+private:
+	static PROFILE_CYCLES _cycles[PROFILE_STAGES][PROFILE_CLOCKS];
+	static uint32_t _histogram[PROFILE_STAGES][PROFILE_BUCKETS];
+	static uint32_t _clockMhz[PROFILE_CLOCKS];
+	static int _clock;
+	static uint32_t _mhz;
+public:
+	static void setFrequency(uint32_t mhz);
+	static uint32_t start() { return ESP.getCycleCount(); }
+	static void record(ProfileStage stage, uint32_t start);
+	static void stats(ProfileStage stage, PROFILE_STATS *stats);
+	static const char *name(ProfileStage stage);
+	static void reset();
+};
+
+#endif //SLAPPYBELL_FIRMWARE_PROFILER_H
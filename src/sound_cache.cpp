@@ -0,0 +1,825 @@
+//
+// Created by agent on 2026/10/19.
+//
+
+#include <Arduino.h>
+#include <FS.h>
+#include <FSImpl.h>
+#include <LittleFS.h>
+#include <Preferences.h>
+#include <freertos/semphr.h>
+
+#include "bundle.h"
+#include "config.h"
+#include "mp3_index.h"
+#include "sound_cache.h"
+#include "status_code.h"
+#include "utils.h"
+
+SOUND_CACHE_ENTRY SoundCache::_entry[SOUND_CACHE_ENTRIES];
+size_t SoundCache::_capacity = 0;
+size_t SoundCache::_used = 0;
+uint32_t SoundCache::_playSequence = 0;
+uint32_t SoundCache::_hits = 0;
+uint32_t SoundCache::_misses = 0;
+bool SoundCache::_pcmEnabled = false;
+PcmDecoder SoundCache::_decoder;
+SOUND_CACHE_ENTRY *SoundCache::_decoding = nullptr;
+bool SoundCache::_decodingPcm = false;
+volatile bool SoundCache::_cancelPending = false;
+EnvelopeBuilder SoundCache::_envelope;
+char SoundCache::_request[SOUND_CACHE_REQUESTS][32];
+int SoundCache::_requestCount = 0;
+char SoundCache::_envelopeRequest[SOUND_CACHE_REQUESTS][32];
+int SoundCache::_envelopeRequestCount = 0;
+const uint8_t *SoundCache::_fileData = nullptr;
+bool SoundCache::_fileOwned = false;
+char SoundCache::_fileName[32];
+
+// メインループと再生タスクの両方から呼ばれるので、公開メソッドは排他して実行する
+// ファイルの読み書きの間は排他しない(待たされる側の処理が止まるため)
+static SemaphoreHandle_t cacheLock = nullptr;
+
+class CacheLock {
+public:
+	CacheLock() { xSemaphoreTakeRecursive(cacheLock, portMAX_DELAY); }
+	~CacheLock() { xSemaphoreGiveRecursive(cacheLock); }
+};
+
+// キャッシュ上のデータを読み出すだけの読み取り専用ファイル
+class SoundCacheFileImpl : public fs::FileImpl {
+private:
+	SOUND_CACHE_ENTRY *_e;
+	const uint8_t *_data;
+	size_t _size;
+	size_t _pos;
+	char _path[32];
+public:
+	explicit SoundCacheFileImpl(SOUND_CACHE_ENTRY *e) : _e(e), _data(e->data), _size(e->size), _pos(0) {
+		strncpy(_path, e->name, sizeof(_path));
+		_path[sizeof(_path)-1] = 0;
+	}
+	~SoundCacheFileImpl() override { close(); }
+	size_t write(const uint8_t *buf, size_t size) override { return 0; }
+	size_t read(uint8_t* buf, size_t size) override {
+		if (_e == nullptr || _pos >= _size)
+			return 0;
+		if (size > _size - _pos)
+			size = _size - _pos;
+		memcpy(buf, _data + _pos, size);
+		_pos += size;
+		return size;
+	}
+	void flush() override {}
+	bool seek(uint32_t pos, SeekMode mode) override {
+		size_t p;
+		switch (mode) {
+		case SeekSet: p = pos; break;
+		case SeekCur: p = _pos + pos; break;
+		case SeekEnd: p = _size + pos; break;
+		default: return false;
+		}
+		if (p > _size)
+			return false;
+		_pos = p;
+		return true;
+	}
+	size_t position() const override { return _pos; }
+	size_t size() const override { return _size; }
+	bool setBufferSize(size_t size) { return true; }
+	void close() override {
+		if (_e != nullptr) {
+			SoundCache::close(_e);
+			_e = nullptr;
+		}
+	}
+	time_t getLastWrite() override { return 0; }
+	const char* path() const override { return _path; }
+	const char* name() const override { return _path + 1; }
+	boolean isDirectory(void) override { return false; }
+	fs::FileImplPtr openNextFile(const char* mode) override { return fs::FileImplPtr(); }
+	boolean seekDir(long position) { return false; }
+	String getNextFileName(void) { return String(""); }
+	String getNextFileName(bool *isDir) { return String(""); }
+	void rewindDirectory(void) override {}
+	operator bool() override { return _e != nullptr; }
+};
+
+class SoundCacheFSImpl : public fs::FSImpl {
+public:
+	fs::FileImplPtr open(const char* path, const char* mode, const bool create) override {
+		if (mode != nullptr && mode[0] != 'r')
+			return fs::FileImplPtr();
+		SOUND_CACHE_ENTRY *e = SoundCache::open(path);
+		if (e == nullptr)
+			return fs::FileImplPtr();
+		return fs::FileImplPtr(new SoundCacheFileImpl(e));
+	}
+	bool exists(const char* path) override {
+		SOUND_CACHE_ENTRY *e = SoundCache::open(path);
+		if (e == nullptr)
+			return false;
+		SoundCache::close(e);
+		return true;
+	}
+	bool rename(const char* pathFrom, const char* pathTo) override { return false; }
+	bool remove(const char* path) override { return false; }
+	bool mkdir(const char *path) override { return false; }
+	bool rmdir(const char *path) override { return false; }
+};
+
+static fs::FS soundCacheFS(fs::FSImplPtr(new SoundCacheFSImpl()));
+
+void SoundCache::init() {
+	cacheLock = xSemaphoreCreateRecursiveMutex();
+	for (int i = 0; i < SOUND_CACHE_ENTRIES; i++) {
+		_entry[i].name[0] = 0;
+		_entry[i].data = nullptr;
+		_entry[i].size = 0;
+		_entry[i].mapped = false;
+		_entry[i].pcm = SOUND_PCM_NONE;
+		_entry[i].envelope = SOUND_ENV_NONE;
+		_entry[i].playCount = 0;
+		_entry[i].lastPlay = 0;
+		_entry[i].openCount = 0;
+		_entry[i].pinned = false;
+		_entry[i].loading = false;
+		_entry[i].removed = false;
+	}
+	_used = 0;
+	_capacity = 0;
+	_requestCount = 0;
+	_envelopeRequestCount = 0;
+	if (!psramFound())
+		return;
+	_capacity = ESP.getFreePsram() / 2;
+	if (_capacity > SOUND_CACHE_SIZE)
+		_capacity = SOUND_CACHE_SIZE;
+
+	// 固定指定されたファイルを先に読み込む
+	char pins[SOUND_CACHE_ENTRIES * 32];
+	pins[0] = 0;
+	Preferences prefs;
+	if (prefs.begin(PREFERENCES_NAMESPACE, true)) {
+		if (prefs.isKey("cache-pins"))
+			prefs.getString("cache-pins", pins, sizeof(pins));
+		_pcmEnabled = prefs.getBool("cache-pcm", false);
+		prefs.end();
+	}
+	char *p = pins;
+	while (*p == '/') {
+		char path[32];
+		size_t n = 0;
+		path[n++] = *p++;
+		while (*p && *p != '/' && n < sizeof(path) - 1)
+			path[n++] = *p++;
+		path[n] = 0;
+		if (load(path)) {
+			SOUND_CACHE_ENTRY *e = _find(path);
+			e->pinned = true;
+		}
+	}
+
+	// 残りの容量に収まる分だけ他のファイルも読み込む
+	File root = LittleFS.open("/");
+	File file = root.openNextFile();
+	while (file) {
+		if (!file.isDirectory() && _used + file.size() <= _capacity) {
+			char path[32];
+			snprintf(path, sizeof(path), "/%s", file.name());
+			file.close();
+			if (_find(path) == nullptr)
+				load(path);
+		}
+		file = root.openNextFile();
+	}
+}
+
+fs::FS &SoundCache::fs() {
+	return soundCacheFS;
+}
+
+SOUND_CACHE_ENTRY *SoundCache::_find(const char *path) {
+	for (int i = 0; i < SOUND_CACHE_ENTRIES; i++) {
+		// 使用中に削除されたエントリは、閉じられるまで残っているが見えないようにする
+		if (_entry[i].data != nullptr && !_entry[i].removed && strcmp(_entry[i].name, path) == 0)
+			return &_entry[i];
+	}
+	return nullptr;
+}
+
+bool SoundCache::_evictOne(const SOUND_CACHE_ENTRY *except) {
+	SOUND_CACHE_ENTRY *victim = nullptr;
+	for (int i = 0; i < SOUND_CACHE_ENTRIES; i++) {
+		SOUND_CACHE_ENTRY *e = &_entry[i];
+		if (e->data == nullptr || e == except || e->pinned || e->openCount > 0)
+			continue;
+		// 再生回数が少なく、最後に再生されたのが古いものから追い出す
+		if (victim == nullptr || e->playCount < victim->playCount ||
+			(e->playCount == victim->playCount && e->lastPlay < victim->lastPlay))
+			victim = e;
+	}
+	if (victim == nullptr)
+		return false;
+	_release(victim);
+	return true;
+}
+
+bool SoundCache::_makeRoom(size_t size, const SOUND_CACHE_ENTRY *except) {
+	if (size > _capacity)
+		return false;
+	while (_used + size > _capacity) {
+		if (!_evictOne(except))
+			return false;
+	}
+	return true;
+}
+
+SOUND_CACHE_ENTRY *SoundCache::_freeSlot() {
+	while (true) {
+		for (int i = 0; i < SOUND_CACHE_ENTRIES; i++) {
+			if (_entry[i].data == nullptr)
+				return &_entry[i];
+		}
+		if (!_evictOne(nullptr))
+			return nullptr;
+	}
+}
+
+SOUND_CACHE_ENTRY *SoundCache::_reserve(size_t size) {
+	if (size == 0 || !_makeRoom(size, nullptr))
+		return nullptr;
+	SOUND_CACHE_ENTRY *slot = _freeSlot();
+	if (slot == nullptr)
+		return nullptr;
+	slot->data = (uint8_t*)ps_malloc(size);
+	if (slot->data == nullptr)
+		return nullptr;
+	slot->size = size;
+	slot->mapped = false;
+	_used += size;
+	return slot;
+}
+
+// バンドルのファイルは読み込まず、マップしたフラッシュを指すだけにする
+SOUND_CACHE_ENTRY *SoundCache::_mapBundle(const char *path) {
+	const BUNDLE_ENTRY *b = Bundle::find(path);
+	if (b == nullptr || b->size == 0)
+		return nullptr;
+	SOUND_CACHE_ENTRY *slot = _freeSlot();
+	if (slot == nullptr)
+		return nullptr;
+	slot->data = (uint8_t*)Bundle::data(b);
+	slot->size = b->size;
+	slot->mapped = true;
+	return slot;
+}
+
+void SoundCache::_release(SOUND_CACHE_ENTRY *e) {
+	if (e->data == nullptr)
+		return;
+	if (!e->mapped) {
+		free(e->data);
+		_used -= e->size;
+	}
+	e->name[0] = 0;
+	e->data = nullptr;
+	e->size = 0;
+	e->mapped = false;
+	e->pcm = SOUND_PCM_NONE;
+	e->envelope = SOUND_ENV_NONE;
+	e->playCount = 0;
+	e->lastPlay = 0;
+	e->pinned = false;
+	e->loading = false;
+	e->removed = false;
+}
+
+// 再生中やデコード中のエントリは、最後に閉じたときに解放する
+void SoundCache::_discard(SOUND_CACHE_ENTRY *e) {
+	if (e->openCount > 0) {
+		e->removed = true;
+		e->pinned = false;
+	} else {
+		_release(e);
+	}
+}
+
+// Preferencesへの書き込みは排他の外で行う
+void SoundCache::_savePins() {
+	char pins[SOUND_CACHE_ENTRIES * 32];
+	STR_BUFFER buffer;
+	Utils::init_buffer(&buffer, pins, sizeof(pins));
+	{
+		CacheLock lock;
+		for (int i = 0; i < SOUND_CACHE_ENTRIES; i++) {
+			if (_entry[i].data != nullptr && !_entry[i].removed && _entry[i].pinned)
+				Utils::strcat_buffer(&buffer, _entry[i].name);
+		}
+	}
+	Preferences prefs;
+	if (prefs.begin(PREFERENCES_NAMESPACE, false)) {
+		prefs.putString("cache-pins", pins);
+		prefs.end();
+	}
+}
+
+bool SoundCache::lookup(const char *path) {
+	CacheLock lock;
+	if (!enabled())
+		return false;
+	SOUND_CACHE_ENTRY *e = _find(path);
+	if (e == nullptr || e->loading) {
+		_misses++;
+		return false;
+	}
+	_hits++;
+	e->playCount++;
+	e->lastPlay = ++_playSequence;
+	return true;
+}
+
+// ファイルの読み込みは排他の外で行い、領域の確保と結果の反映だけを排他する
+// 読み込み中のエントリは自分で開いておき、追い出しや再生に使われないようにする
+bool SoundCache::load(const char *path) {
+	if (!enabled())
+		return false;
+	// 内蔵ストレージにない名前はバンドルから探す
+	File file = LittleFS.open(path, "r");
+	size_t size = file ? file.size() : 0;
+	bool envelope = Envelope::exists(path);
+	SOUND_CACHE_ENTRY *e;
+	{
+		CacheLock lock;
+		bool pinned = false;
+		uint32_t playCount = 0;
+		e = _find(path);
+		if (e != nullptr) {
+			if (e->openCount > 0)
+				return false;
+			pinned = e->pinned;
+			playCount = e->playCount;
+			_release(e);
+		}
+		e = file ? _reserve(size) : _mapBundle(path);
+		if (e == nullptr)
+			return false;
+		strncpy(e->name, path, sizeof(e->name));
+		e->name[sizeof(e->name)-1] = 0;
+		e->playCount = playCount + 1;
+		e->lastPlay = ++_playSequence;
+		e->pinned = pinned;
+		e->pcm = _pcmEnabled ? SOUND_PCM_PENDING : SOUND_PCM_NONE;
+		e->envelope = envelope ? SOUND_ENV_READY : SOUND_ENV_NONE;
+		e->removed = false;
+		e->loading = !e->mapped;
+		e->openCount = e->loading ? 1 : 0;
+	}
+	if (e->mapped)
+		return true;
+	bool success = file.read(e->data, size) == size;
+	file.close();
+	CacheLock lock;
+	e->loading = false;
+	e->openCount--;
+	if (!success || e->removed) {
+		_release(e);
+		return false;
+	}
+	return true;
+}
+
+// 読み込みを再生タスクに任せる
+// メインループでLittleFSを読むと、その間コマンドやLEDの処理が止まるため
+bool SoundCache::request(const char *path) {
+	CacheLock lock;
+	if (!enabled())
+		return false;
+	if (_find(path) != nullptr)
+		return true;
+	for (int i = 0; i < _requestCount; i++) {
+		if (strcmp(_request[i], path) == 0)
+			return true;
+	}
+	if (_requestCount >= SOUND_CACHE_REQUESTS)
+		return false;
+	strncpy(_request[_requestCount], path, sizeof(_request[0]));
+	_request[_requestCount][sizeof(_request[0])-1] = 0;
+	_requestCount++;
+	return true;
+}
+
+void SoundCache::_dropRequest(const char *path) {
+	for (int i = 0; i < _requestCount; i++) {
+		if (strcmp(_request[i], path) == 0) {
+			memmove(_request[i], _request[i + 1], (_requestCount - i - 1) * sizeof(_request[0]));
+			_requestCount--;
+			return;
+		}
+	}
+}
+
+void SoundCache::remove(const char *path) {
+	bool pinned;
+	{
+		CacheLock lock;
+		_dropRequest(path);
+		SOUND_CACHE_ENTRY *e = _find(path);
+		if (e == nullptr)
+			return;
+		pinned = e->pinned;
+		_discard(e);
+	}
+	if (pinned)
+		_savePins();
+}
+
+// バンドルを書き換える前に、バンドルから作ったエントリをすべて外す
+// 固定指定は残すので、新しいバンドルに同じ名前があれば次に読み込んだときに戻る
+void SoundCache::removeBundle() {
+	CacheLock lock;
+	for (int i = 0; i < SOUND_CACHE_ENTRIES; i++) {
+		SOUND_CACHE_ENTRY *e = &_entry[i];
+		if (e->data != nullptr && !e->removed && (e->mapped || Bundle::find(e->name) != nullptr))
+			_discard(e);
+	}
+}
+
+// バンドルのフラッシュを指したまま開かれているエントリがあれば、マップを外してはいけない
+bool SoundCache::bundleInUse() {
+	CacheLock lock;
+	for (int i = 0; i < SOUND_CACHE_ENTRIES; i++) {
+		const SOUND_CACHE_ENTRY *e = &_entry[i];
+		if (e->data != nullptr && e->mapped && e->openCount > 0)
+			return true;
+	}
+	return false;
+}
+
+int SoundCache::pin(const char *path, bool pin) {
+	if (!enabled())
+		return CD_STORAGE_FULL;
+	if (pin && !contains(path)) {
+		if (!LittleFS.exists(path) && Bundle::find(path) == nullptr)
+			return CD_FILE_NOT_FOUND;
+		if (!load(path))
+			return CD_STORAGE_FULL;
+	}
+	{
+		CacheLock lock;
+		SOUND_CACHE_ENTRY *e = _find(path);
+		if (pin) {
+			if (e == nullptr)
+				return CD_STORAGE_FULL;
+			if (e->pinned)
+				return CD_SUCCESS;
+			e->pinned = true;
+		} else {
+			if (e == nullptr || !e->pinned)
+				return CD_FILE_NOT_FOUND;
+			e->pinned = false;
+		}
+	}
+	_savePins();
+	return CD_SUCCESS;
+}
+
+const SOUND_CACHE_ENTRY *SoundCache::entry(int index) {
+	if (index < 0 || index >= SOUND_CACHE_ENTRIES)
+		return nullptr;
+	const SOUND_CACHE_ENTRY *e = &_entry[index];
+	if (e->data == nullptr || e->loading || e->removed)
+		return nullptr;
+	return e;
+}
+
+SOUND_CACHE_ENTRY *SoundCache::open(const char *path) {
+	CacheLock lock;
+	SOUND_CACHE_ENTRY *e = _find(path);
+	if (e == nullptr || e->loading)
+		return nullptr;
+	e->openCount++;
+	return e;
+}
+
+void SoundCache::close(SOUND_CACHE_ENTRY *e) {
+	CacheLock lock;
+	if (e->openCount > 0)
+		e->openCount--;
+	if (e->openCount == 0 && e->removed)
+		_release(e);
+}
+
+void SoundCache::setPcm(bool enable) {
+	{
+		CacheLock lock;
+		if (_pcmEnabled == enable)
+			return;
+		_pcmEnabled = enable;
+		// デコードは再生タスクのprocess()で止める
+		_cancelPending = true;
+		for (int i = 0; i < SOUND_CACHE_ENTRIES; i++) {
+			SOUND_CACHE_ENTRY *e = &_entry[i];
+			if (e->data == nullptr || e->removed)
+				continue;
+			if (enable) {
+				if (e->pcm == SOUND_PCM_NONE || e->pcm == SOUND_PCM_FAILED)
+					e->pcm = SOUND_PCM_PENDING;
+			} else if (e->pcm != SOUND_PCM_READY) {
+				e->pcm = SOUND_PCM_NONE;
+			}
+		}
+	}
+	// PCMにしたエントリはmp3を読み込み直す
+	for (int i = 0; i < SOUND_CACHE_ENTRIES && !enable; i++) {
+		char path[32];
+		{
+			CacheLock lock;
+			SOUND_CACHE_ENTRY *e = &_entry[i];
+			if (e->data == nullptr || e->removed || e->pcm != SOUND_PCM_READY)
+				continue;
+			strcpy(path, e->name);
+		}
+		load(path);
+	}
+	Preferences prefs;
+	if (prefs.begin(PREFERENCES_NAMESPACE, false)) {
+		prefs.putBool("cache-pcm", enable);
+		prefs.end();
+	}
+}
+
+bool SoundCache::isPcm(const char *path) {
+	CacheLock lock;
+	SOUND_CACHE_ENTRY *e = _find(path);
+	return e != nullptr && e->pcm == SOUND_PCM_READY;
+}
+
+bool SoundCache::contains(const char *path) {
+	CacheLock lock;
+	return _find(path) != nullptr;
+}
+
+// アップロードしたときと、'~'のパターンで再生したのに包絡線がない場合に呼ぶ
+// 包絡線は再生が終わった後の空き時間に作る
+// キャッシュにない音は、その時にファイルを読んで作る
+void SoundCache::wantEnvelope(const char *path) {
+	CacheLock lock;
+	SOUND_CACHE_ENTRY *e = _find(path);
+	if (e != nullptr) {
+		if (e->envelope == SOUND_ENV_NONE)
+			e->envelope = SOUND_ENV_WANTED;
+		return;
+	}
+	for (int i = 0; i < _envelopeRequestCount; i++) {
+		if (strcmp(_envelopeRequest[i], path) == 0)
+			return;
+	}
+	if (_envelopeRequestCount >= SOUND_CACHE_REQUESTS)
+		return;
+	strncpy(_envelopeRequest[_envelopeRequestCount], path, sizeof(_envelopeRequest[0]));
+	_envelopeRequest[_envelopeRequestCount][sizeof(_envelopeRequest[0])-1] = 0;
+	_envelopeRequestCount++;
+}
+
+bool SoundCache::hasPending() {
+	CacheLock lock;
+	return _requestCount > 0 || _envelopeRequestCount > 0 || _decoding != nullptr || _fileData != nullptr ||
+		_nextDecode() != nullptr;
+}
+
+SOUND_CACHE_ENTRY *SoundCache::_nextDecode() {
+	SOUND_CACHE_ENTRY *next = nullptr;
+	for (int i = 0; i < SOUND_CACHE_ENTRIES; i++) {
+		SOUND_CACHE_ENTRY *e = &_entry[i];
+		if (e->data == nullptr || e->loading || e->removed)
+			continue;
+		if (!(_pcmEnabled && e->pcm == SOUND_PCM_PENDING) && e->envelope != SOUND_ENV_WANTED)
+			continue;
+		if (next == nullptr || (e->pinned && !next->pinned) ||
+			(e->pinned == next->pinned && e->playCount > next->playCount))
+			next = e;
+	}
+	return next;
+}
+
+// Audioが停止している間に、頼まれたファイルを読み込み、未デコードのエントリを少しずつPCMに変換する
+// 包絡線を頼まれたエントリも同じようにデコードし、包絡線だけを求める
+// キャッシュにない音の包絡線は、_startFileEnvelope()でファイルからデコードする
+// 再生タスクからだけ呼ばれる デコード中のエントリは開いておき、排他はデコーダの外だけにする
+void SoundCache::process() {
+	char path[32];
+	path[0] = 0;
+	{
+		CacheLock lock;
+		if (_requestCount > 0) {
+			strcpy(path, _request[0]);
+			_dropRequest(path);
+		}
+	}
+	if (path[0] != 0) {
+		load(path);
+		return;
+	}
+	if (_cancelPending) {
+		_cancelPending = false;
+		cancelDecode();
+	}
+	if (_decoding == nullptr && _fileData == nullptr) {
+		if (!_startFileEnvelope())
+			_startDecode();
+		return;
+	}
+	PcmDecodeResult result = _decoder.step(PCM_DECODE_FRAMES);
+	if (result == PCM_DECODE_CONTINUE)
+		return;
+	if (_fileData != nullptr) {
+		_finishFileEnvelope(result == PCM_DECODE_DONE);
+		return;
+	}
+	if (result == PCM_DECODE_DONE) {
+		_finishDecode();
+		return;
+	}
+	{
+		CacheLock lock;
+		if (_decodingPcm)
+			_decoding->pcm = SOUND_PCM_FAILED;
+		if (_decoding->envelope == SOUND_ENV_WANTED)
+			_decoding->envelope = SOUND_ENV_FAILED;
+	}
+	cancelDecode();
+}
+
+void SoundCache::_startDecode() {
+	SOUND_CACHE_ENTRY *next;
+	bool ready;
+	bool pcm;
+	bool envelope;
+	{
+		CacheLock lock;
+		next = _nextDecode();
+		if (next == nullptr)
+			return;
+		next->openCount++;
+		ready = next->pcm == SOUND_PCM_READY;
+		pcm = _pcmEnabled && next->pcm == SOUND_PCM_PENDING;
+		envelope = next->envelope == SOUND_ENV_WANTED;
+	}
+	if (ready) {
+		_buildEnvelope(next);
+		close(next);
+		return;
+	}
+	// 変換後に収まらないことがインデックスから分かる場合はデコードしない
+	if (pcm && Mp3Index::pcmSize(next->name) > PCM_CACHE_MAX_SIZE) {
+		CacheLock lock;
+		next->pcm = SOUND_PCM_FAILED;
+		close(next);
+		return;
+	}
+	if (!_decoder.begin(next->data, next->size, pcm ? PCM_CACHE_MAX_SIZE : PCM_FRAME_SIZE, pcm,
+		envelope ? &_envelope : nullptr)) {
+		CacheLock lock;
+		if (pcm)
+			next->pcm = SOUND_PCM_FAILED;
+		if (envelope)
+			next->envelope = SOUND_ENV_FAILED;
+		close(next);
+		return;
+	}
+	_decoding = next;
+	_decodingPcm = pcm;
+}
+
+// 頼まれた包絡線のうち、キャッシュにある音はエントリに印を付けて_startDecode()に任せる
+// キャッシュにない音は、内蔵ストレージのファイルをPSRAMへ一時的に読み込むか、
+// バンドルのフラッシュをそのまま読んで、包絡線だけを求める
+bool SoundCache::_startFileEnvelope() {
+	char path[32];
+	path[0] = 0;
+	{
+		CacheLock lock;
+		while (_envelopeRequestCount > 0 && path[0] == 0) {
+			strcpy(path, _envelopeRequest[0]);
+			_envelopeRequestCount--;
+			memmove(_envelopeRequest[0], _envelopeRequest[1], _envelopeRequestCount * sizeof(_envelopeRequest[0]));
+			SOUND_CACHE_ENTRY *e = _find(path);
+			if (e != nullptr) {
+				if (e->envelope == SOUND_ENV_NONE)
+					e->envelope = SOUND_ENV_WANTED;
+				path[0] = 0;
+			}
+		}
+	}
+	if (path[0] == 0)
+		return false;
+	const uint8_t *data = nullptr;
+	size_t size = 0;
+	bool owned = false;
+	File file = LittleFS.open(path, "r");
+	if (file) {
+		size = file.size();
+		uint8_t *buf = size <= ENVELOPE_FILE_MAX_SIZE ? (uint8_t*)ps_malloc(size) : nullptr;
+		if (buf != nullptr && file.read(buf, size) != size) {
+			free(buf);
+			buf = nullptr;
+		}
+		file.close();
+		data = buf;
+		owned = true;
+	} else {
+		const BUNDLE_ENTRY *b = Bundle::find(path);
+		if (b != nullptr) {
+			data = Bundle::data(b);
+			size = b->size;
+		}
+	}
+	if (data == nullptr)
+		return true;
+	if (!_decoder.begin(data, size, PCM_FRAME_SIZE, false, &_envelope)) {
+		if (owned)
+			free((void*)data);
+		return true;
+	}
+	strcpy(_fileName, path);
+	_fileData = data;
+	_fileOwned = owned;
+	return true;
+}
+
+void SoundCache::_finishFileEnvelope(bool success) {
+	_decoder.cancel();
+	if (_fileOwned)
+		free((void*)_fileData);
+	_fileData = nullptr;
+	// デコードしている間に消されたファイルの包絡線は残さない
+	if (success && (LittleFS.exists(_fileName) || Bundle::find(_fileName) != nullptr))
+		_envelope.save(_fileName);
+}
+
+// PCMに変換済みのエントリは、デコードせずにそのまま包絡線を求める
+void SoundCache::_buildEnvelope(SOUND_CACHE_ENTRY *e) {
+	const uint8_t *h = e->data;
+	uint32_t rate = h[24] | (h[25] << 8) | ((uint32_t)h[26] << 16) | ((uint32_t)h[27] << 24);
+	_envelope.begin();
+	_envelope.add((const int16_t*)(e->data + WAV_HEADER_SIZE), (int)((e->size - WAV_HEADER_SIZE) / sizeof(int16_t)), rate);
+	bool saved = _envelope.save(e->name);
+	CacheLock lock;
+	e->envelope = saved ? SOUND_ENV_READY : SOUND_ENV_FAILED;
+}
+
+void SoundCache::_finishDecode() {
+	SOUND_CACHE_ENTRY *e = _decoding;
+	_decoding = nullptr;
+	bool envelope = e->envelope == SOUND_ENV_WANTED;
+	bool saved = envelope && _envelope.save(e->name);
+	size_t size = 0;
+	uint8_t *wav = nullptr;
+	if (_decodingPcm)
+		wav = _decoder.release(&size);
+	else
+		_decoder.cancel();
+	{
+		CacheLock lock;
+		if (envelope)
+			e->envelope = saved ? SOUND_ENV_READY : SOUND_ENV_FAILED;
+		if (_decodingPcm) {
+			// バンドルを指していたエントリは、ここで初めてPSRAMを使う
+			// 自分の分を除いて開かれていれば、再生中なので置き換えない
+			size_t current = e->mapped ? 0 : e->size;
+			if (wav == nullptr || e->removed || e->openCount > 1 ||
+				(size > current && !_makeRoom(size - current, e))) {
+				free(wav);
+				e->pcm = SOUND_PCM_FAILED;
+			} else {
+				if (!e->mapped)
+					free(e->data);
+				_used = _used - current + size;
+				e->data = wav;
+				e->size = size;
+				e->mapped = false;
+				e->pcm = SOUND_PCM_READY;
+			}
+		}
+	}
+	close(e);
+}
+
+// 再生タスクから呼ぶ 他のタスクからはsetPcm()のように_cancelPendingで頼む
+void SoundCache::cancelDecode() {
+	if (_fileData != nullptr) {
+		// 再生のために止めた場合は、次の空き時間に作り直す
+		char path[32];
+		strcpy(path, _fileName);
+		_finishFileEnvelope(false);
+		wantEnvelope(path);
+		return;
+	}
+	if (_decoding == nullptr)
+		return;
+	_decoder.cancel();
+	SOUND_CACHE_ENTRY *e = _decoding;
+	_decoding = nullptr;
+	close(e);
+}
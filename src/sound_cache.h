@@ -0,0 +1,117 @@
+//
+// Created by agent on 2026/10/19.
+//
+
+#ifndef SLAPPYBELL_FIRMWARE_SOUND_CACHE_H
+#define SLAPPYBELL_FIRMWARE_SOUND_CACHE_H
+
+#include <Arduino.h>
+#include <FS.h>
+#include "config.h"
+#include "envelope.h"
+#include "pcm_decoder.h"
+
+enum SoundPcmState {
+	SOUND_PCM_NONE,
+	SOUND_PCM_PENDING,
+	SOUND_PCM_READY,
+	SOUND_PCM_FAILED,
+};
+
+enum SoundEnvelopeState {
+	SOUND_ENV_NONE,
+	SOUND_ENV_WANTED,		// '~'のパターンで再生されたか、アップロードされた(次の空き時間に作る)
+	SOUND_ENV_READY,
+	SOUND_ENV_FAILED,
+};
+
+typedef struct _SOUND_CACHE_ENTRY {
+	char		name[32];		// "/sound1.mp3"
+	uint8_t*	data;			// PSRAM (pcm == SOUND_PCM_READYの場合はWAV)
+	size_t		size;
+	bool		mapped;			// dataはバンドルのフラッシュを指す(PSRAMを使わない)
+	SoundPcmState pcm;
+	SoundEnvelopeState envelope;	// 包絡線ファイルの有無
+	uint32_t	playCount;
+	uint32_t	lastPlay;
+	int			openCount;		// 再生中のファイル数(0以外は追い出し禁止)
+	bool		pinned;
+	bool		loading;		// 読み込み中(まだ再生に使えない)
+	bool		removed;		// 使用中に削除された(閉じたときに解放する)
+} SOUND_CACHE_ENTRY;
+
+// LittleFSに保存された通知音をPSRAMに常駐させるキャッシュ
+// バンドルの通知音はコピーせず、マップしたフラッシュをそのまま登録する
+// Audio::connecttoFS()にはfs()が返すファイルシステムを渡す
+// 再生タスクからも使われるため、公開メソッドは内部で排他する
+// LittleFSの読み書きとデコードは排他の外で行い、結果の反映だけを排他する
+class SoundCache {
+private:
+	static SOUND_CACHE_ENTRY _entry[SOUND_CACHE_ENTRIES];
+	static size_t _capacity;
+	static size_t _used;
+	static uint32_t _playSequence;
+	static uint32_t _hits;
+	static uint32_t _misses;
+	static bool _pcmEnabled;
+	static PcmDecoder _decoder;
+	static SOUND_CACHE_ENTRY *_decoding;
+	static bool _decodingPcm;
+	static volatile bool _cancelPending;
+	static EnvelopeBuilder _envelope;
+	static char _request[SOUND_CACHE_REQUESTS][32];
+	static int _requestCount;
+	static char _envelopeRequest[SOUND_CACHE_REQUESTS][32];	// キャッシュにない音の包絡線
+	static int _envelopeRequestCount;
+	static const uint8_t *_fileData;		// キャッシュにない音をデコード中(PSRAMまたはバンドル)
+	static bool _fileOwned;					// _fileDataはPSRAMに読み込んだもの
+	static char _fileName[32];
+
+	static SOUND_CACHE_ENTRY *_find(const char *path);
+	static bool _evictOne(const SOUND_CACHE_ENTRY *except);
+	static bool _makeRoom(size_t size, const SOUND_CACHE_ENTRY *except);
+	static SOUND_CACHE_ENTRY *_freeSlot();
+	static SOUND_CACHE_ENTRY *_reserve(size_t size);
+	static SOUND_CACHE_ENTRY *_mapBundle(const char *path);
+	static void _dropRequest(const char *path);
+	static SOUND_CACHE_ENTRY *_nextDecode();
+	static void _finishDecode();
+	static void _buildEnvelope(SOUND_CACHE_ENTRY *e);
+	static void _startDecode();
+	static bool _startFileEnvelope();
+	static void _finishFileEnvelope(bool success);
+	static void _release(SOUND_CACHE_ENTRY *entry);
+	static void _discard(SOUND_CACHE_ENTRY *entry);
+	static void _savePins();
+public:
+	static void init();
+	static fs::FS &fs();
+	static bool enabled() { return _capacity > 0; }
+	static size_t capacity() { return _capacity; }
+	static size_t used() { return _used; }
+	static uint32_t hits() { return _hits; }
+	static uint32_t misses() { return _misses; }
+
+	static bool contains(const char *path);
+	static bool lookup(const char *path);
+	static bool load(const char *path);
+	static bool request(const char *path);
+	static void remove(const char *path);
+	static void removeBundle();
+	static bool bundleInUse();
+	static int pin(const char *path, bool pin);
+	static void wantEnvelope(const char *path);
+	static const SOUND_CACHE_ENTRY *entry(int index);
+
+	static bool pcmEnabled() { return _pcmEnabled; }
+	static void setPcm(bool enable);
+	static bool isPcm(const char *path);
+	static bool hasPending();
+	static void process();
+	static void cancelDecode();
+
+	static SOUND_CACHE_ENTRY *open(const char *path);
+	static void close(SOUND_CACHE_ENTRY *entry);
+};
+
+#endif //SLAPPYBELL_FIRMWARE_SOUND_CACHE_H
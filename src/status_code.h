@@ -30,6 +30,8 @@
 #define RC_NEED_PARAMETER			"24 Need command parameter"
 #define CD_BAD_PARAMETER			 25
 #define RC_BAD_PARAMETER			"25 Bad command parameter"
+#define CD_QUEUE_FULL				 26
+#define RC_QUEUE_FULL				"26 Play queue full"
 #define CD_STORAGE_FULL				 30
 #define RC_STORAGE_FULL				"30 Storage full"
 #define CD_FILE_IO_ERROR			 31
@@ -38,6 +40,14 @@
 #define RC_NO_WIFI_CONNECTION		"32 No Wi-Fi connection"
 #define CD_WIFI_CONNECT_FAILED		 33
 #define RC_WIFI_CONNECT_FAILED		"33 Wi-Fi connect failed"
+#define CD_UNSUPPORTED_FORMAT		 34
+#define RC_UNSUPPORTED_FORMAT		"34 Unsupported mp3 format"
+#define CD_CHECKSUM_ERROR			 35
+#define RC_CHECKSUM_ERROR			"35 Checksum error"
+#define CD_TIMER_FULL				 36
+#define RC_TIMER_FULL				"36 Too many timers"
+#define CD_FILE_IN_USE				 37
+#define RC_FILE_IN_USE				"37 File in use"
 #define CD_WIFI_CONNECTED			 50
 #define RC_WIFI_CONNECTED			"50 Wi-Fi connected"
 #define CD_WIFI_SSID_NOT_FOUND		 51
@@ -50,6 +60,14 @@
 #define RC_TIMEOUT		            "54 Timeout error"
 #define CD_OVERFLOW					 55
 #define RC_OVERFLOW		            "55 Receive buffer overflow"
+#define CD_QUEUE_FINISHED			 56
+#define RC_QUEUE_FINISHED		    "56 Play queue finished"
+#define CD_STREAM_REBUFFERING		 57
+#define RC_STREAM_REBUFFERING	    "57 Stream rebuffering"
+#define CD_STREAM_RESUMED			 58
+#define RC_STREAM_RESUMED		    "58 Stream resumed"
+#define CD_QUEUE_SKIPPED			 59
+#define RC_QUEUE_SKIPPED		    "59 Play queue item skipped"
 #define CD_ERROR					 90
 #define RC_ERROR					"90 Error"
 
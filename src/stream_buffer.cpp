@@ -0,0 +1,292 @@
+//
+// Created by agent on 2026/10/19.
+//
+
+#include <Arduino.h>
+#include <FS.h>
+#include <FSImpl.h>
+#include <HTTPClient.h>
+#include <LittleFS.h>
+#include <Preferences.h>
+
+#include "config.h"
+#include "event_loop.h"
+#include "http_cache.h"
+#include "mp3_index.h"
+#include "stream_buffer.h"
+
+uint8_t *StreamBuffer::_data = nullptr;
+volatile uint32_t StreamBuffer::_size = 0;
+volatile uint32_t StreamBuffer::_received = 0;
+volatile uint32_t StreamBuffer::_position = 0;
+volatile StreamBufferState StreamBuffer::_state = STREAM_IDLE;
+volatile uint32_t StreamBuffer::_bitRate = 0;
+volatile bool StreamBuffer::_cancel = false;
+bool StreamBuffer::_store = false;
+bool StreamBuffer::_taskRunning = false;
+SemaphoreHandle_t StreamBuffer::_lock = nullptr;
+char StreamBuffer::_url[HTTP_CACHE_URL_LENGTH];
+bool StreamBuffer::_enabled = true;
+uint16_t StreamBuffer::_prebuffer = STREAM_PREBUFFER_MS;
+StreamEstimator StreamBuffer::_estimator;
+volatile uint32_t StreamBuffer::_throughput = 0;
+volatile uint32_t StreamBuffer::_jitter = 0;
+
+// 受信済みの範囲だけを読み出すファイル
+// まだ届いていない位置では0バイトを返し、Audio側はデータが来るまで待つ
+class StreamBufferFileImpl : public fs::FileImpl {
+private:
+	size_t _pos;
+	bool _open;
+public:
+	StreamBufferFileImpl() : _pos(0), _open(true) {}
+	~StreamBufferFileImpl() override { close(); }
+	size_t write(const uint8_t *buf, size_t size) override { return 0; }
+	size_t read(uint8_t* buf, size_t size) override {
+		if (!_open)
+			return 0;
+		size_t n = StreamBuffer::read(_pos, buf, size);
+		_pos += n;
+		return n;
+	}
+	void flush() override {}
+	bool seek(uint32_t pos, SeekMode mode) override {
+		size_t p;
+		switch (mode) {
+		case SeekSet: p = pos; break;
+		case SeekCur: p = _pos + pos; break;
+		case SeekEnd: p = StreamBuffer::size() + pos; break;
+		default: return false;
+		}
+		if (p > StreamBuffer::size())
+			return false;
+		_pos = p;
+		return true;
+	}
+	size_t position() const override { return _pos; }
+	size_t size() const override { return StreamBuffer::size(); }
+	bool setBufferSize(size_t size) { return true; }
+	void close() override { _open = false; }
+	time_t getLastWrite() override { return 0; }
+	const char* path() const override { return STREAM_BUFFER_PATH; }
+	const char* name() const override { return STREAM_BUFFER_PATH + 1; }
+	boolean isDirectory(void) override { return false; }
+	fs::FileImplPtr openNextFile(const char* mode) override { return fs::FileImplPtr(); }
+	boolean seekDir(long position) { return false; }
+	String getNextFileName(void) { return String(""); }
+	String getNextFileName(bool *isDir) { return String(""); }
+	void rewindDirectory(void) override {}
+	operator bool() override { return _open; }
+};
+
+class StreamBufferFSImpl : public fs::FSImpl {
+public:
+	fs::FileImplPtr open(const char* path, const char* mode, const bool create) override {
+		if (mode != nullptr && mode[0] != 'r')
+			return fs::FileImplPtr();
+		if (!exists(path))
+			return fs::FileImplPtr();
+		return fs::FileImplPtr(new StreamBufferFileImpl());
+	}
+	bool exists(const char* path) override {
+		StreamBufferState state = StreamBuffer::state();
+		return strcmp(path, STREAM_BUFFER_PATH) == 0 && (state == STREAM_RECEIVING || state == STREAM_COMPLETE);
+	}
+	bool rename(const char* pathFrom, const char* pathTo) override { return false; }
+	bool remove(const char* path) override { return false; }
+	bool mkdir(const char *path) override { return false; }
+	bool rmdir(const char *path) override { return false; }
+};
+
+static fs::FS streamBufferFS(fs::FSImplPtr(new StreamBufferFSImpl()));
+
+void StreamBuffer::init() {
+	_lock = xSemaphoreCreateMutex();
+	Preferences prefs;
+	if (prefs.begin(PREFERENCES_NAMESPACE, true)) {
+		_enabled = prefs.getBool("stream-buf", true);
+		_prebuffer = prefs.getUShort("stream-pre", STREAM_PREBUFFER_MS);
+		prefs.end();
+	}
+}
+
+void StreamBuffer::_saveSettings() {
+	Preferences prefs;
+	if (prefs.begin(PREFERENCES_NAMESPACE, false)) {
+		prefs.putBool("stream-buf", _enabled);
+		prefs.putUShort("stream-pre", _prebuffer);
+		prefs.end();
+	}
+}
+
+void StreamBuffer::setEnabled(bool enable) {
+	if (_enabled == enable)
+		return;
+	_enabled = enable;
+	_saveSettings();
+}
+
+void StreamBuffer::setPrebuffer(uint16_t ms) {
+	if (_prebuffer == ms)
+		return;
+	_prebuffer = ms;
+	_saveSettings();
+}
+
+fs::FS &StreamBuffer::fs() {
+	return streamBufferFS;
+}
+
+void StreamBuffer::_free() {
+	if (_data != nullptr) {
+		free(_data);
+		_data = nullptr;
+	}
+	_size = 0;
+	_received = 0;
+	_position = 0;
+	_state = STREAM_IDLE;
+}
+
+// storeはHttpCache::beginStore()で保存の準備ができている場合にtrue
+bool StreamBuffer::begin(const char *url, bool store) {
+	xSemaphoreTake(_lock, portMAX_DELAY);
+	// 前の受信タスクが接続待ちで止まっている間は使えない
+	bool started = false;
+	if (!_taskRunning) {
+		_free();
+		strncpy(_url, url, sizeof(_url));
+		_url[sizeof(_url)-1] = 0;
+		_bitRate = 0;
+		_cancel = false;
+		_store = store;
+		_state = STREAM_CONNECTING;
+		_taskRunning = xTaskCreate(_task, "stream", 6144, nullptr, 2, nullptr) == pdPASS;
+		if (!_taskRunning)
+			_state = STREAM_IDLE;
+		started = _taskRunning;
+	}
+	xSemaphoreGive(_lock);
+	if (!started && store)
+		HttpCache::endStore(0, nullptr, nullptr);
+	return started;
+}
+
+// 受信中ならタスクに後始末を任せる
+void StreamBuffer::end() {
+	xSemaphoreTake(_lock, portMAX_DELAY);
+	_cancel = true;
+	if (!_taskRunning)
+		_free();
+	xSemaphoreGive(_lock);
+}
+
+void StreamBuffer::_task(void *arg) {
+	HTTPClient http;
+	http.setReuse(false);
+	http.setConnectTimeout(HTTP_CACHE_TIMEOUT);
+	http.setTimeout(HTTP_CACHE_TIMEOUT);
+	bool success = false;
+	uint32_t stored = 0;
+	char etag[HTTP_CACHE_ETAG_LENGTH] = "";
+	char lastModified[HTTP_CACHE_DATE_LENGTH] = "";
+	if (http.begin(_url)) {
+		const char *keys[] = { "ETag", "Last-Modified" };
+		if (_store)
+			http.collectHeaders(keys, 2);
+		int code = http.GET();
+		int length = http.getSize();
+		// 長さの分からないストリームはAudioに直接任せる
+		if (code == HTTP_CODE_OK && length > 0 && length <= STREAM_BUFFER_MAX_SIZE && !_cancel)
+			_data = (uint8_t*)ps_malloc(length);
+		if (_data != nullptr) {
+			_size = length;
+			_state = STREAM_RECEIVING;
+			// 同じ受信をキャッシュのファイルにも書き込み、別に接続し直さない
+			File file;
+			if (_store && length <= HTTP_CACHE_MAX_FILE_SIZE)
+				file = LittleFS.open(HTTP_CACHE_TEMP, "w");
+			bool writing = file;
+			WiFiClient *stream = http.getStreamPtr();
+			Mp3Scanner scanner;
+			uint32_t lastRead = millis();
+			_estimator.begin(lastRead);
+			while (!_cancel && _received < _size && (http.connected() || stream->available() > 0)) {
+				size_t n = stream->available();
+				uint32_t now = millis();
+				if (n == 0) {
+					if (now - lastRead > HTTP_CACHE_TIMEOUT)
+						break;
+					vTaskDelay(1);
+					continue;
+				}
+				if (n > _size - _received)
+					n = _size - _received;
+				n = stream->readBytes(_data + _received, n);
+				if (_bitRate == 0 && scanner.feed(_data + _received, n))
+					_bitRate = scanner.info().bitRate;
+				if (writing && file.write(_data + _received, n) != n)
+					writing = false;
+				_received += n;
+				lastRead = now;
+				_estimator.add(now, n);
+				_throughput = _estimator.throughput();
+				_jitter = _estimator.jitter();
+			}
+			success = _received == _size;
+			if (file) {
+				file.close();
+				if (writing && success && !_cancel) {
+					stored = _size;
+					strncpy(etag, http.header("ETag").c_str(), sizeof(etag) - 1);
+					strncpy(lastModified, http.header("Last-Modified").c_str(), sizeof(lastModified) - 1);
+				}
+			}
+		}
+		http.end();
+	}
+	if (_store)
+		HttpCache::endStore(stored, etag, lastModified);
+	xSemaphoreTake(_lock, portMAX_DELAY);
+	_taskRunning = false;
+	if (_cancel)
+		_free();
+	else
+		_state = success ? STREAM_COMPLETE : STREAM_FAILED;
+	xSemaphoreGive(_lock);
+	EventLoop::post(EVENT_TASK);
+	vTaskDelete(nullptr);
+}
+
+size_t StreamBuffer::read(uint32_t position, uint8_t *buf, size_t size) {
+	uint32_t received = _received;
+	if (_data == nullptr || position >= received)
+		return 0;
+	if (size > received - position)
+		size = received - position;
+	memcpy(buf, _data + position, size);
+	_position = position + size;
+	return size;
+}
+
+uint32_t StreamBuffer::ahead() {
+	uint32_t received = _received;
+	uint32_t position = _position;
+	return received > position ? received - position : 0;
+}
+
+uint32_t StreamBuffer::target() {
+	uint32_t byteRate = (_bitRate != 0 ? _bitRate : STREAM_DEFAULT_BITRATE) / 8;
+	uint32_t remain = _size > _position ? _size - _position : 0;
+	return StreamEstimator::target(byteRate, _prebuffer, _jitter, _throughput, remain);
+}
+
+uint32_t StreamBuffer::lowWater() {
+	uint32_t byteRate = (_bitRate != 0 ? _bitRate : STREAM_DEFAULT_BITRATE) / 8;
+	return byteRate * STREAM_LOW_WATER_MS / 1000;
+}
+
+bool StreamBuffer::ready() {
+	StreamBufferState state = _state;
+	return state == STREAM_COMPLETE || (state == STREAM_RECEIVING && ahead() >= target());
+}
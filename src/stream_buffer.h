@@ -0,0 +1,72 @@
+//
+// Created by agent on 2026/10/19.
+//
+
+#ifndef SLAPPYBELL_FIRMWARE_STREAM_BUFFER_H
+#define SLAPPYBELL_FIRMWARE_STREAM_BUFFER_H
+
+#include <Arduino.h>
+#include <FS.h>
+#include <freertos/semphr.h>
+#include "config.h"
+#include "stream_estimator.h"
+
+enum StreamBufferState {
+	STREAM_IDLE,
+	STREAM_CONNECTING,
+	STREAM_RECEIVING,
+	STREAM_COMPLETE,
+	STREAM_FAILED,
+};
+
+// http://のmp3をPSRAMへ受信しながら、Audio::connecttoFS()で再生できるようにする
+// 再生を始めるまでに溜める量は、これまでに観測した受信速度と途切れた時間から決める
+// Audio::connecttoFS()にはfs()が返すファイルシステムとSTREAM_BUFFER_PATHを渡す
+class StreamBuffer {
+private:
+	static uint8_t *_data;
+	static volatile uint32_t _size;
+	static volatile uint32_t _received;
+	static volatile uint32_t _position;		// 再生側が読み出した位置
+	static volatile StreamBufferState _state;
+	static volatile uint32_t _bitRate;
+	static volatile bool _cancel;
+	static bool _store;			// 受信した内容をダウンロードキャッシュにも保存する
+	static bool _taskRunning;
+	static SemaphoreHandle_t _lock;
+	static char _url[HTTP_CACHE_URL_LENGTH];
+
+	static bool _enabled;
+	static uint16_t _prebuffer;
+	static StreamEstimator _estimator;		// 受信タスクだけが使う
+	static volatile uint32_t _throughput;
+	static volatile uint32_t _jitter;
+
+	static void _task(void *arg);
+	static void _free();
+	static void _saveSettings();
+public:
+	static void init();
+	static bool enabled() { return _enabled; }
+	static void setEnabled(bool enable);
+	static uint16_t prebuffer() { return _prebuffer; }
+	static void setPrebuffer(uint16_t ms);
+
+	static bool begin(const char *url, bool store = false);
+	static void end();
+	static StreamBufferState state() { return _state; }
+	static const char *url() { return _url; }
+	static uint32_t size() { return _size; }
+	static uint32_t received() { return _received; }
+	static uint32_t ahead();
+	static uint32_t target();
+	static uint32_t lowWater();
+	static bool ready();
+	static uint32_t throughput() { return _throughput; }
+	static uint32_t jitter() { return _jitter; }
+
+	static size_t read(uint32_t position, uint8_t *buf, size_t size);
+	static fs::FS &fs();
+};
+
+#endif //SLAPPYBELL_FIRMWARE_STREAM_BUFFER_H
@@ -0,0 +1,60 @@
+//
+// Created by agent on 2026/10/19.
+//
+
+#include "config.h"
+#include "stream_estimator.h"
+
+StreamEstimator::StreamEstimator() {
+	_throughput = 0;
+	_jitter = 0;
+	begin(0);
+}
+
+// 受信を始めるときに呼ぶ
+void StreamEstimator::begin(uint32_t now) {
+	_lastRead = now;
+	_windowStart = now;
+	_windowBytes = 0;
+	_decayTime = 0;
+}
+
+// bytesを受信するたびに呼ぶ
+void StreamEstimator::add(uint32_t now, uint32_t bytes) {
+	// 受信が途切れた時間の最大値を覚えておき、経過時間に応じて減衰させる
+	// 読み出しの回数によらず、同じ時間がたてば同じだけ減る
+	uint32_t gap = now - _lastRead;
+	_lastRead = now;
+	_decayTime += gap;
+	while (_decayTime >= STREAM_JITTER_DECAY_STEP && _jitter > 0) {
+		_decayTime -= STREAM_JITTER_DECAY_STEP;
+		_jitter -= (_jitter + 15) / 16;
+	}
+	if (gap >= _jitter) {
+		_jitter = gap;
+		_decayTime = 0;
+	}
+	_windowBytes += bytes;
+	if (now - _windowStart >= STREAM_MEASURE_INTERVAL) {
+		uint32_t rate = (uint32_t)((uint64_t)_windowBytes * 1000 / (now - _windowStart));
+		_throughput = _throughput == 0 ? rate : (_throughput * 3 + rate) / 4;
+		_windowStart = now;
+		_windowBytes = 0;
+	}
+}
+
+// remainバイトを残して再生を始める(または再開する)までに溜める量
+uint32_t StreamEstimator::target(uint32_t byteRate, uint32_t prebuffer, uint32_t jitter, uint32_t throughput,
+	uint32_t remain) {
+	// 指定の長さに加えて、受信が途切れる時間の2倍を溜める
+	uint32_t bytes = (uint32_t)((uint64_t)byteRate * (prebuffer + jitter * 2) / 1000);
+	// 受信が再生より遅い場合は、最後まで追いつかれない量を溜める
+	// 溜め直しの閾値と途切れの分を上乗せして、終わり際に一時停止しないようにする
+	if (throughput > 0 && throughput < byteRate) {
+		uint32_t deficit = remain - (uint32_t)((uint64_t)remain * throughput / byteRate);
+		deficit += (uint32_t)((uint64_t)byteRate * (STREAM_LOW_WATER_MS + jitter * 2) / 1000);
+		if (deficit > bytes)
+			bytes = deficit;
+	}
+	return bytes < remain ? bytes : remain;
+}
@@ -0,0 +1,33 @@
+//
+// Created by agent on 2026/10/19.
+//
+
+#ifndef SLAPPYBELL_FIRMWARE_STREAM_ESTIMATOR_H
+#define SLAPPYBELL_FIRMWARE_STREAM_ESTIMATOR_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "config.h"
+
+// 受信速度と受信が途切れた時間を観測し、再生前に溜める量を決める
+// Arduinoに依存しないので、遅いサーバの場合をホストのテストで確かめられる
+// 観測した値は次の受信にも引き継ぐ
+class StreamEstimator {
+private:
+	uint32_t _lastRead;
+	uint32_t _windowStart;
+	uint32_t _windowBytes;
+	uint32_t _decayTime;		// 最後に減衰させてからの時間(ms)
+	uint32_t _throughput;		// バイト/秒
+	uint32_t _jitter;			// ms
+public:
+	StreamEstimator();
+	void begin(uint32_t now);
+	void add(uint32_t now, uint32_t bytes);
+	uint32_t throughput() const { return _throughput; }
+	uint32_t jitter() const { return _jitter; }
+	static uint32_t target(uint32_t byteRate, uint32_t prebuffer, uint32_t jitter, uint32_t throughput,
+		uint32_t remain);
+};
+
+#endif //SLAPPYBELL_FIRMWARE_STREAM_ESTIMATOR_H
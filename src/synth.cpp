@@ -0,0 +1,198 @@
+//
+// Created by agent on 2026/10/19.
+//
+
+#include <Arduino.h>
+
+#include "config.h"
+#include "synth.h"
+#include "utils.h"
+
+SYNTH_VOICE Synth::_voice[SYNTH_VOICES];
+uint32_t Synth::_sequence = 0;
+
+// 4オクターブ目の音階の周波数(1/100Hz)
+static const uint32_t noteFrequency[12] = {
+	26163, 27718, 29366, 31113, 32963, 34923, 36999, 39200, 41530, 44000, 46616, 49388
+};
+
+void Synth::init() {
+	SynthCore::init();
+	for (int i = 0; i < SYNTH_VOICES; i++)
+		_voice[i].active = false;
+}
+
+void Synth::defaults(SYNTH_SEQUENCE *sequence) {
+	sequence->wave = SYNTH_SINE;
+	sequence->attack = 5;
+	sequence->decay = 100;
+	sequence->sustain = 70;
+	sequence->release = 60;
+	sequence->gain = 100;
+	sequence->count = 0;
+}
+
+// sine | square | triangle | saw
+const char *Synth::parseWave(const char *ptr, SynthWave *wave) {
+	static const char *names[] = { "sine", "square", "triangle", "saw" };
+	const char *p = Utils::skipWs(ptr);
+	if (p == nullptr)
+		return ptr;
+	for (int i = 0; i < 4; i++) {
+		const char *end = Utils::is_symbol_ptr(names[i], p);
+		if (end != nullptr) {
+			*wave = (SynthWave)i;
+			return end;
+		}
+	}
+	return ptr;
+}
+
+// adsr=<attack>,<decay>,<sustain>,<release>
+const char *Synth::parseEnvelope(const char *ptr, SYNTH_SEQUENCE *sequence) {
+	const char *p = Utils::skipWs(ptr);
+	if (p == nullptr)
+		return ptr;
+	p = Utils::strcmp_ptr("adsr=", p);
+	if (p == nullptr)
+		return ptr;
+	uint value[4];
+	for (int i = 0; i < 4; i++) {
+		if (i > 0 && *p++ != ',')
+			return nullptr;
+		if (*p == ' ')
+			return nullptr;
+		p = Utils::parseUInt(p, &value[i]);
+		if (p == nullptr)
+			return nullptr;
+	}
+	if (value[0] > SYNTH_MAX_NOTE_TIME || value[1] > SYNTH_MAX_NOTE_TIME ||
+		value[2] > 100 || value[3] > SYNTH_MAX_NOTE_TIME)
+		return nullptr;
+	sequence->attack = value[0];
+	sequence->decay = value[1];
+	sequence->sustain = value[2];
+	sequence->release = value[3];
+	return p;
+}
+
+// 440 | A4 | C#5 | Bb3 | -
+const char *Synth::_parsePitch(const char *ptr, uint32_t *frequency) {
+	if (*ptr == '-') {
+		*frequency = 0;
+		return ptr + 1;
+	}
+	if ('0' <= *ptr && *ptr <= '9') {
+		uint hz;
+		ptr = Utils::parseUInt(ptr, &hz);
+		if (ptr == nullptr || hz < 20 || hz > 20000)
+			return nullptr;
+		*frequency = hz * 100;
+		return ptr;
+	}
+	static const int8_t semitone[7] = { 9, 11, 0, 2, 4, 5, 7 };	// A-G
+	char c = *ptr++;
+	if ('a' <= c && c <= 'g')
+		c -= 'a' - 'A';
+	if (c < 'A' || c > 'G')
+		return nullptr;
+	int n = semitone[c - 'A'];
+	if (*ptr == '#') {
+		n++;
+		ptr++;
+	} else if (*ptr == 'b') {
+		n--;
+		ptr++;
+	}
+	if (*ptr < '0' || *ptr > '8')
+		return nullptr;
+	int octave = *ptr++ - '0';
+	if (n < 0) {
+		n += 12;
+		octave--;
+	} else if (n >= 12) {
+		n -= 12;
+		octave++;
+	}
+	if (octave < 0 || octave > 8)
+		return nullptr;
+	uint32_t f = noteFrequency[n];
+	if (octave >= 4)
+		f <<= octave - 4;
+	else
+		f = (f + (1 << (3 - octave))) >> (4 - octave);
+	*frequency = f;
+	return ptr;
+}
+
+// <pitch>[:<ms>],<pitch>[:<ms>],...
+const char *Synth::parseNotes(const char *ptr, SYNTH_SEQUENCE *sequence) {
+	ptr = Utils::skipWs(ptr);
+	if (ptr == nullptr)
+		return nullptr;
+	int count = 0;
+	while (true) {
+		if (count >= SYNTH_MAX_NOTES)
+			return nullptr;
+		SYNTH_NOTE *note = &sequence->note[count++];
+		ptr = _parsePitch(ptr, &note->frequency);
+		if (ptr == nullptr)
+			return nullptr;
+		note->time = SYNTH_DEFAULT_NOTE_TIME;
+		if (*ptr == ':') {
+			uint time;
+			if (*++ptr == ' ')
+				return nullptr;
+			ptr = Utils::parseUInt(ptr, &time);
+			if (ptr == nullptr || time == 0 || time > SYNTH_MAX_NOTE_TIME)
+				return nullptr;
+			note->time = time;
+		}
+		if (*ptr != ',')
+			break;
+		ptr++;
+	}
+	if (*ptr != ' ' && *ptr != '\0')
+		return nullptr;
+	sequence->count = count;
+	return ptr;
+}
+
+void Synth::play(const SYNTH_SEQUENCE *sequence) {
+	// 空きがなければ一番古いボイスを止めて使う
+	SYNTH_VOICE *v = nullptr;
+	for (int i = 0; i < SYNTH_VOICES; i++) {
+		SYNTH_VOICE *c = &_voice[i];
+		if (!c->active) {
+			v = c;
+			break;
+		}
+		if (v == nullptr || c->started < v->started)
+			v = c;
+	}
+	SynthCore::start(v, sequence);
+	v->started = ++_sequence;
+}
+
+void Synth::stop() {
+	for (int i = 0; i < SYNTH_VOICES; i++)
+		_voice[i].active = false;
+}
+
+bool Synth::isActive() {
+	for (int i = 0; i < SYNTH_VOICES; i++) {
+		if (_voice[i].active)
+			return true;
+	}
+	return false;
+}
+
+// 1サンプル分の出力(モノラル)
+int32_t Synth::next(uint32_t rate) {
+	int32_t acc = 0;
+	for (int i = 0; i < SYNTH_VOICES; i++) {
+		if (_voice[i].active)
+			acc += SynthCore::next(&_voice[i], rate);
+	}
+	return acc;
+}
@@ -0,0 +1,32 @@
+//
+// Created by agent on 2026/10/19.
+//
+
+#ifndef SLAPPYBELL_FIRMWARE_SYNTH_H
+#define SLAPPYBELL_FIRMWARE_SYNTH_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "synth_core.h"
+
+// mp3を使わずに通知音を作るシンセサイザ
+// ボイスの音はSynthCoreで計算し、ミキサのボイスと一緒に出力する
+class Synth {
+private:
+	static SYNTH_VOICE _voice[SYNTH_VOICES];
+	static uint32_t _sequence;
+
+	static const char *_parsePitch(const char *ptr, uint32_t *frequency);
+public:
+	static void init();
+	static void defaults(SYNTH_SEQUENCE *sequence);
+	static const char *parseWave(const char *ptr, SynthWave *wave);
+	static const char *parseEnvelope(const char *ptr, SYNTH_SEQUENCE *sequence);
+	static const char *parseNotes(const char *ptr, SYNTH_SEQUENCE *sequence);
+	static void play(const SYNTH_SEQUENCE *sequence);
+	static void stop();
+	static bool isActive();
+	static int32_t next(uint32_t rate);
+};
+
+#endif //SLAPPYBELL_FIRMWARE_SYNTH_H
@@ -0,0 +1,151 @@
+//
+// Created by agent on 2026/10/19.
+//
+
+#include <math.h>
+#include <string.h>
+
+#include "config.h"
+#include "synth_core.h"
+
+#define SYNTH_LEVEL_FULL	(1UL << 24)
+
+int16_t SynthCore::_sine[257];
+
+void SynthCore::init() {
+	// 補間のために最後に先頭と同じ値を置く
+	for (int i = 0; i <= 256; i++)
+		_sine[i] = (int16_t)(sinf(2.0 * M_PI * i / 256) * 32767.0f);
+}
+
+// 音符がなければ鳴らさない(activeはfalseのまま)
+void SynthCore::start(SYNTH_VOICE *v, const SYNTH_SEQUENCE *sequence) {
+	v->active = false;
+	memcpy(&v->sequence, sequence, sizeof(SYNTH_SEQUENCE));
+	if (v->sequence.count == 0)
+		return;
+	// 最初の音符は出力のサンプリング周波数が分かってから始める
+	v->index = 0;
+	v->rate = 0;
+	v->phase = 0;
+	v->step = 0;
+	v->remain = 0;
+	v->gate = 0;
+	v->level = 0;
+	v->delta = 0;
+	v->sustainLevel = (uint32_t)((uint64_t)SYNTH_LEVEL_FULL * v->sequence.sustain / 100);
+	v->gain = (uint16_t)(v->sequence.gain * 256 / 100);
+	v->stage = SYNTH_IDLE;
+	v->active = true;
+}
+
+uint32_t SynthCore::_samples(uint32_t ms, uint32_t rate) {
+	return (uint32_t)((uint64_t)ms * rate / 1000);
+}
+
+void SynthCore::_startNote(SYNTH_VOICE *v) {
+	if (v->index >= v->sequence.count) {
+		v->active = false;
+		return;
+	}
+	const SYNTH_NOTE *note = &v->sequence.note[v->index];
+	v->remain = _samples(note->time, v->rate);
+	if (v->remain == 0)
+		v->remain = 1;
+	uint32_t release = _samples(v->sequence.release, v->rate);
+	// リリースも音符の長さに含めて、次の音符までに鳴り終える
+	v->gate = v->remain > release ? v->remain - release : v->remain / 2;
+	if (note->frequency == 0) {
+		v->gate = 0;
+		v->stage = v->level > 0 ? SYNTH_SUSTAIN : SYNTH_IDLE;
+		return;
+	}
+	v->step = (uint32_t)(((uint64_t)note->frequency << 32) / ((uint64_t)v->rate * 100));
+	uint32_t attack = _samples(v->sequence.attack, v->rate);
+	v->delta = (SYNTH_LEVEL_FULL - v->level) / (attack > 0 ? attack : 1);
+	v->stage = SYNTH_ATTACK;
+}
+
+int32_t SynthCore::_oscillator(const SYNTH_VOICE *v) {
+	uint32_t phase = v->phase;
+	switch (v->sequence.wave) {
+	case SYNTH_SQUARE:
+		return phase < 0x80000000 ? 16384 : -16384;
+	case SYNTH_TRIANGLE: {
+		int32_t t = (int32_t)(phase >> 15);
+		return t < 65536 ? t - 32768 : 98303 - t;
+	}
+	case SYNTH_SAW:
+		return ((int32_t)(phase >> 16) - 32768) >> 1;
+	default: {
+		// 上位8bitで表を引き、次の16bitで直線補間する
+		uint32_t index = phase >> 24;
+		int32_t frac = (int32_t)((phase >> 8) & 0xFFFF);
+		int32_t a = _sine[index];
+		int32_t b = _sine[index + 1];
+		return a + (((b - a) * frac) >> 16);
+	}
+	}
+}
+
+void SynthCore::_envelope(SYNTH_VOICE *v) {
+	if (v->gate > 0) {
+		v->gate--;
+	} else if (v->stage != SYNTH_IDLE && v->stage != SYNTH_RELEASE) {
+		// 音符の残りで0まで下げる
+		v->stage = SYNTH_RELEASE;
+		v->delta = v->level / v->remain;
+		if (v->delta == 0)
+			v->delta = 1;
+	}
+	switch (v->stage) {
+	case SYNTH_ATTACK:
+		if (SYNTH_LEVEL_FULL - v->level <= v->delta) {
+			v->level = SYNTH_LEVEL_FULL;
+			uint32_t decay = _samples(v->sequence.decay, v->rate);
+			v->delta = (SYNTH_LEVEL_FULL - v->sustainLevel) / (decay > 0 ? decay : 1);
+			v->stage = SYNTH_DECAY;
+		} else {
+			v->level += v->delta;
+		}
+		break;
+	case SYNTH_DECAY:
+		if (v->level - v->sustainLevel <= v->delta) {
+			v->level = v->sustainLevel;
+			v->stage = SYNTH_SUSTAIN;
+		} else {
+			v->level -= v->delta;
+		}
+		break;
+	case SYNTH_RELEASE:
+		v->level = v->level > v->delta ? v->level - v->delta : 0;
+		break;
+	default:
+		break;
+	}
+	if (--v->remain == 0)
+		v->index++;
+}
+
+// 1サンプル分の出力 最後の音符が終わるとactiveをfalseにする
+int32_t SynthCore::next(SYNTH_VOICE *v, uint32_t rate) {
+	if (v->rate != rate) {
+		// 途中で出力の周波数が変わったら音程だけ合わせ直す
+		if (v->rate != 0 && v->remain > 0)
+			v->step = (uint32_t)((uint64_t)v->step * v->rate / rate);
+		v->rate = rate;
+	}
+	if (v->remain == 0) {
+		_startNote(v);
+		if (!v->active)
+			return 0;
+	}
+	int32_t s = 0;
+	if (v->level > 0) {
+		s = (_oscillator(v) * (int32_t)(v->level >> 9)) >> 15;
+		s = (s * v->gain) >> 8;
+	}
+	v->phase += v->step;
+	_envelope(v);
+	return s;
+}
@@ -0,0 +1,76 @@
+//
+// Created by agent on 2026/10/19.
+//
+
+#ifndef SLAPPYBELL_FIRMWARE_SYNTH_CORE_H
+#define SLAPPYBELL_FIRMWARE_SYNTH_CORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "config.h"
+
+enum SynthWave {
+	SYNTH_SINE,
+	SYNTH_SQUARE,
+	SYNTH_TRIANGLE,
+	SYNTH_SAW,
+};
+
+enum SynthStage {
+	SYNTH_IDLE,
+	SYNTH_ATTACK,
+	SYNTH_DECAY,
+	SYNTH_SUSTAIN,
+	SYNTH_RELEASE,
+};
+
+typedef struct _SYNTH_NOTE {
+	uint32_t	frequency;	// 1/100Hz (0 = 休符)
+	uint16_t	time;		// ms
+} SYNTH_NOTE;
+
+typedef struct _SYNTH_SEQUENCE {
+	SynthWave	wave;
+	uint16_t	attack;		// ms
+	uint16_t	decay;		// ms
+	uint8_t		sustain;	// %
+	uint16_t	release;	// ms
+	uint8_t		gain;		// 0-100
+	uint8_t		count;
+	SYNTH_NOTE	note[SYNTH_MAX_NOTES];
+} SYNTH_SEQUENCE;
+
+typedef struct _SYNTH_VOICE {
+	SYNTH_SEQUENCE	sequence;
+	uint8_t			index;		// 鳴らしている音符
+	uint32_t		rate;
+	uint32_t		phase;		// 1周期 = 2^32
+	uint32_t		step;
+	uint32_t		remain;		// 音符の残りサンプル数
+	uint32_t		gate;		// リリースまでのサンプル数
+	uint32_t		level;		// エンベロープ 1.0 = 1<<24
+	uint32_t		delta;		// 1サンプルあたりのlevelの変化
+	uint32_t		sustainLevel;
+	uint16_t		gain;		// 256 = 1.0
+	SynthStage		stage;
+	uint32_t		started;
+	bool			active;
+} SYNTH_VOICE;
+
+// 1つのボイスのオシレータとADSRエンベロープを固定小数点で計算する
+// Arduinoに依存しないので、ホストのテストでも同じ波形を作れる
+class SynthCore {
+private:
+	static int16_t _sine[257];
+
+	static void _startNote(SYNTH_VOICE *v);
+	static int32_t _oscillator(const SYNTH_VOICE *v);
+	static void _envelope(SYNTH_VOICE *v);
+	static uint32_t _samples(uint32_t ms, uint32_t rate);
+public:
+	static void init();
+	static void start(SYNTH_VOICE *v, const SYNTH_SEQUENCE *sequence);
+	static int32_t next(SYNTH_VOICE *v, uint32_t rate);
+};
+
+#endif //SLAPPYBELL_FIRMWARE_SYNTH_CORE_H
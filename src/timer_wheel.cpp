@@ -0,0 +1,177 @@
+//
+// Created by agent on 2026/10/19.
+//
+
+#include "config.h"
+#include "timer_wheel.h"
+
+#define TIMER_WHEEL_MASK	(TIMER_WHEEL_SLOTS - 1)
+
+static_assert(TIMER_WHEEL_ENTRIES <= 255, "TimerId keeps the entry index in 8 bits");
+
+TIMER_ENTRY TimerWheel::_entry[TIMER_WHEEL_ENTRIES];
+TIMER_ENTRY *TimerWheel::_slot[TIMER_WHEEL_SLOTS];
+TIMER_ENTRY *TimerWheel::_free = nullptr;
+uint32_t TimerWheel::_tick = 0;
+uint32_t TimerWheel::_base = 0;
+int TimerWheel::_active = 0;
+uint32_t TimerWheel::_nextDue = 0;
+bool TimerWheel::_nextValid = true;
+
+void TimerWheel::init(uint32_t now) {
+	for (int i = 0; i < TIMER_WHEEL_SLOTS; i++)
+		_slot[i] = nullptr;
+	_free = nullptr;
+	for (int i = TIMER_WHEEL_ENTRIES - 1; i >= 0; i--) {
+		TIMER_ENTRY *e = &_entry[i];
+		e->slot = -1;
+		e->generation = 0;
+		e->prev = nullptr;
+		e->next = _free;
+		_free = e;
+	}
+	_tick = 0;
+	_base = now;
+	_active = 0;
+	_nextValid = true;
+}
+
+void TimerWheel::_link(TIMER_ENTRY *e) {
+	// 処理済みの位置に入れると1周遅れるので、過ぎた期限は次に調べる位置へ置く
+	int32_t ahead = (int32_t)(e->due - _base);
+	uint32_t tick = _tick + (ahead > 0 ? (uint32_t)ahead / TIMER_WHEEL_TICK : 0);
+	e->slot = (int16_t)(tick & TIMER_WHEEL_MASK);
+	e->prev = nullptr;
+	e->next = _slot[e->slot];
+	if (e->next != nullptr)
+		e->next->prev = e;
+	_slot[e->slot] = e;
+	// 一番近い期限が分かっていれば、登録のたびに更新しておく
+	if (_active == 0) {
+		_nextDue = e->due;
+		_nextValid = true;
+	} else if (_nextValid && (int32_t)(e->due - _nextDue) < 0) {
+		_nextDue = e->due;
+	}
+	_active++;
+}
+
+void TimerWheel::_unlink(TIMER_ENTRY *e) {
+	if (e->prev != nullptr)
+		e->prev->next = e->next;
+	else
+		_slot[e->slot] = e->next;
+	if (e->next != nullptr)
+		e->next->prev = e->prev;
+	// 一番近い期限のタイマーが外れたら、次にnext()を呼んだときに探し直す
+	if (e->due == _nextDue)
+		_nextValid = false;
+	// 世代を進めて、古いTimerIdでは見つからないようにする
+	e->slot = -1;
+	e->generation = (e->generation + 1) & 0xFFFFFF;
+	e->prev = nullptr;
+	e->next = _free;
+	_free = e;
+	_active--;
+}
+
+TIMER_ENTRY *TimerWheel::_find(TimerId id) {
+	uint32_t index = id & 0xFF;
+	if (index == 0 || index > TIMER_WHEEL_ENTRIES)
+		return nullptr;
+	TIMER_ENTRY *e = &_entry[index - 1];
+	if (e->slot < 0 || e->generation != id >> 8)
+		return nullptr;
+	return e;
+}
+
+// 空きがなければ0を返す
+TimerId TimerWheel::schedule(uint32_t now, uint32_t delay, TimerCallback callback, uint32_t arg) {
+	TIMER_ENTRY *e = _free;
+	if (e == nullptr || callback == nullptr)
+		return 0;
+	_free = e->next;
+	// 0msでも次の呼び出しまで待たせ、process()の中で登録し直したものが繰り返し呼ばれないようにする
+	e->due = now + (delay > 0 ? delay : 1);
+	e->callback = callback;
+	e->arg = arg;
+	_link(e);
+	return (e->generation << 8) | (uint32_t)(e - _entry + 1);
+}
+
+TimerId TimerWheel::reschedule(uint32_t now, TimerId id, uint32_t delay, TimerCallback callback, uint32_t arg) {
+	cancel(id);
+	return schedule(now, delay, callback, arg);
+}
+
+bool TimerWheel::cancel(TimerId id) {
+	TIMER_ENTRY *e = _find(id);
+	if (e == nullptr)
+		return false;
+	_unlink(e);
+	return true;
+}
+
+uint32_t TimerWheel::remain(uint32_t now, TimerId id) {
+	TIMER_ENTRY *e = _find(id);
+	if (e == nullptr || (int32_t)(e->due - now) <= 0)
+		return 0;
+	return e->due - now;
+}
+
+// 前回から進んだ位置のリストを調べ、期限の来たタイマーを呼び出す
+// 今の位置は期限前のものが残るので、次回もう一度調べる
+void TimerWheel::process(uint32_t now) {
+	int32_t elapsed = (int32_t)(now - _base);
+	uint32_t ticks = elapsed > 0 ? (uint32_t)elapsed / TIMER_WHEEL_TICK : 0;
+	if (_active == 0) {
+		_tick += ticks;
+		_base += ticks * TIMER_WHEEL_TICK;
+		return;
+	}
+	uint32_t last = _tick + ticks;
+	uint32_t steps = ticks + 1;
+	if (steps > TIMER_WHEEL_SLOTS)
+		steps = TIMER_WHEEL_SLOTS;
+	uint32_t tick = last - steps + 1;
+	for (uint32_t i = 0; i < steps; i++, tick++) {
+		int slot = tick & TIMER_WHEEL_MASK;
+		TIMER_ENTRY *e = _slot[slot];
+		while (e != nullptr) {
+			if ((int32_t)(now - e->due) < 0) {
+				e = e->next;
+				continue;
+			}
+			TimerCallback callback = e->callback;
+			uint32_t arg = e->arg;
+			_unlink(e);
+			// 呼び出し先で登録や取り消しをしてもよいように、リストの先頭から調べ直す
+			callback(now, arg);
+			e = _slot[slot];
+		}
+	}
+	_tick = last;
+	_base += ticks * TIMER_WHEEL_TICK;
+}
+
+// 次の期限までの時間(ms) タイマーがなければUINT32_MAX
+// 一番近い期限を覚えておき、そのタイマーが外れたときだけ使用中のタイマーを探し直す
+uint32_t TimerWheel::next(uint32_t now) {
+	if (_active == 0)
+		return UINT32_MAX;
+	if (!_nextValid) {
+		bool found = false;
+		for (int i = 0; i < TIMER_WHEEL_ENTRIES; i++) {
+			TIMER_ENTRY *e = &_entry[i];
+			if (e->slot < 0)
+				continue;
+			if (!found || (int32_t)(e->due - _nextDue) < 0)
+				_nextDue = e->due;
+			found = true;
+		}
+		_nextValid = true;
+	}
+	if ((int32_t)(_nextDue - now) <= 0)
+		return 0;
+	return _nextDue - now;
+}
@@ -0,0 +1,59 @@
+//
+// Created by agent on 2026/10/19.
+//
+
+#ifndef SLAPPYBELL_FIRMWARE_TIMER_WHEEL_H
+#define SLAPPYBELL_FIRMWARE_TIMER_WHEEL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "config.h"
+
+typedef void (*TimerCallback)(uint32_t now, uint32_t arg);
+
+// 0は無効なタイマー
+// 下位8bitが表の位置、上位は使い回しを見分ける世代
+typedef uint32_t TimerId;
+
+typedef struct _TIMER_ENTRY {
+	struct _TIMER_ENTRY	*prev;
+	struct _TIMER_ENTRY	*next;
+	uint32_t		due;		// ms
+	TimerCallback	callback;
+	uint32_t		arg;
+	uint32_t		generation;
+	int16_t			slot;		// -1 = 未使用
+} TIMER_ENTRY;
+
+// 期限付きの仕事をまとめて扱うハッシュ式タイマーホイール
+// 期限をTIMER_WHEEL_TICK単位に丸めた位置のリストへ繋ぎ、登録と取り消しはO(1)で行う
+// 1周より先の期限は同じリストで待ち、期限が来た周に呼び出す
+// 位置はmillis()を割らずに、前回からの経過時間で進めるので、millis()が一周しても狂わない
+// メインループからだけ使う(他のタスクから呼んではいけない)
+class TimerWheel {
+private:
+	static TIMER_ENTRY _entry[TIMER_WHEEL_ENTRIES];
+	static TIMER_ENTRY *_slot[TIMER_WHEEL_SLOTS];
+	static TIMER_ENTRY *_free;
+	static uint32_t _tick;			// 次に調べる位置(TIMER_WHEEL_TICK単位で単調に増える)
+	static uint32_t _base;			// _tickが始まった時刻(ms)
+	static int _active;
+	static uint32_t _nextDue;		// 一番近い期限(ms)
+	static bool _nextValid;
+
+	static void _link(TIMER_ENTRY *e);
+	static void _unlink(TIMER_ENTRY *e);
+	static TIMER_ENTRY *_find(TimerId id);
+public:
+	static void init(uint32_t now);
+	static TimerId schedule(uint32_t now, uint32_t delay, TimerCallback callback, uint32_t arg = 0);
+	static TimerId reschedule(uint32_t now, TimerId id, uint32_t delay, TimerCallback callback, uint32_t arg = 0);
+	static bool cancel(TimerId id);
+	static bool pending(TimerId id) { return _find(id) != nullptr; }
+	static uint32_t remain(uint32_t now, TimerId id);
+	static void process(uint32_t now);
+	static uint32_t next(uint32_t now);
+	static int active() { return _active; }
+};
+
+#endif //SLAPPYBELL_FIRMWARE_TIMER_WHEEL_H
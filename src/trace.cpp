@@ -0,0 +1,30 @@
+//
+// Created by agent on 2026/10/19.
+//
+
+#include <Arduino.h>
+
+#include "config.h"
+#include "trace.h"
+
+TRACE_RECORD Trace::_ring[TRACE_ENTRIES];
+volatile uint32_t Trace::_head = 0;
+
+// 通し番号sequenceからcount個を取り出す
+// 取り出す間に上書きされた記録は、数を変えないようにeventを0にして返す
+void Trace::copy(uint32_t sequence, TRACE_RECORD *records, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		uint32_t s = sequence + i;
+		memcpy(&records[i], &_ring[s & (TRACE_ENTRIES - 1)], sizeof(TRACE_RECORD));
+		if (_head - s > TRACE_ENTRIES)
+			records[i].event = 0;
+	}
+}
+
+// 他のタスクが書き込んでいる途中でも呼ばれるので、リングは消さずに先頭を戻し、
+// 残っている記録はeventを0にして古いものとわかるようにする
+void Trace::clear() {
+	__atomic_store_n(&_head, 0, __ATOMIC_RELAXED);
+	for (size_t i = 0; i < TRACE_ENTRIES; i++)
+		_ring[i].event = TRACE_NONE;
+}
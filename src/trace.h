@@ -0,0 +1,61 @@
+//
+// Created by agent on 2026/10/19.
+//
+
+#ifndef SLAPPYBELL_FIRMWARE_TRACE_H
+#define SLAPPYBELL_FIRMWARE_TRACE_H
+
+#include <Arduino.h>
+#include "config.h"
+
+// 記録する出来事 (値はダンプの形式の一部なので変えない)
+enum TraceEvent {
+	TRACE_NONE			= 0,	// 読み出す間に上書きされた
+	TRACE_BOOT			= 1,
+	TRACE_COMMAND		= 2,	// arg16 = 行の長さ, arg32 = コマンド名の先頭4文字
+	TRACE_RESPONSE		= 3,	// arg16 = ステータスコード
+	TRACE_NOTIFY		= 4,	// arg16 = ステータスコード
+	TRACE_UPLOAD		= 5,	// arg16 = 書き込んだ大きさ, arg32 = 受信済みの大きさ
+	TRACE_CONNECT		= 6,	// arg16 = TransportType
+	TRACE_DISCONNECT	= 7,	// arg16 = TransportType
+	TRACE_RECEIVE		= 8,	// arg16 = TransportType, arg32 = バイト数
+	TRACE_WIFI			= 9,	// arg16 = WiFiEvent_t, arg32 = 接続: チャンネル, 切断: 理由
+	TRACE_AUDIO_START	= 10,	// arg16 = 再生の種類, arg32 = 開始できたら1
+	TRACE_AUDIO_STOP	= 11,	// arg16 = 0:停止の指示 1:再生の終了
+};
+
+// リトルエンディアンでそのままダンプする
+typedef struct _TRACE_RECORD {
+	uint32_t	tick;		// FreeRTOSのtick (ms)
+	uint32_t	cycles;		// 記録したコアのサイクルカウンタ
+	uint8_t		event;
+	uint8_t		core;
+	uint16_t	arg16;
+	uint32_t	arg32;
+} TRACE_RECORD;
+
+// 障害の後から経緯を調べるための出来事の記録
+// 固定長のリングへ上書きしながら書き込み、位置の確保だけを不可分に行うので、
+// BLEやWi-Fiのコールバックなど、どのタスクからでもロックなしで記録できる
+// 書き込み中の記録を読んだ場合、その記録は壊れていることがある
+class Trace {
+private:
+	static TRACE_RECORD _ring[TRACE_ENTRIES];
+	static volatile uint32_t _head;		// 次に書き込む通し番号
+public:
+	static inline void record(TraceEvent event, uint16_t arg16 = 0, uint32_t arg32 = 0) {
+		uint32_t index = __atomic_fetch_add(&_head, 1, __ATOMIC_RELAXED);
+		TRACE_RECORD *r = &_ring[index & (TRACE_ENTRIES - 1)];
+		r->tick = xTaskGetTickCount();
+		r->cycles = ESP.getCycleCount();
+		r->event = (uint8_t)event;
+		r->core = (uint8_t)xPortGetCoreID();
+		r->arg16 = arg16;
+		r->arg32 = arg32;
+	}
+	static uint32_t head() { return _head; }
+	static void copy(uint32_t sequence, TRACE_RECORD *records, size_t count);
+	static void clear();
+};
+
+#endif //SLAPPYBELL_FIRMWARE_TRACE_H
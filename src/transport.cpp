@@ -33,6 +33,58 @@ size_t Transport::printf(const char *format, ...) {
 	return len;
 }
 
+// 他のタスクが数えている途中でも、カウンタごとに不可分に0にする
+void Transport::resetStats() {
+	__atomic_store_n(&_stats.bytesIn, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&_stats.bytesOut, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&_stats.receives, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&_stats.sends, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&_stats.overflows, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&_stats.indications, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&_stats.indicationErrors, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&_stats.rttCount, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&_stats.rttMin, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&_stats.rttMax, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&_stats.rttTotal, (uint64_t)0, __ATOMIC_RELAXED);
+	for (int i = 0; i < TRANSPORT_SIZE_BUCKETS; i++)
+		__atomic_store_n(&_stats.sizeHistogram[i], 0, __ATOMIC_RELAXED);
+}
+
+// BLEのタスクから呼ばれる
+void Transport::countReceive(size_t len) {
+	__atomic_fetch_add(&_stats.receives, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&_stats.bytesIn, (uint32_t)len, __ATOMIC_RELAXED);
+	int bucket = len <= 1 ? 0 : 31 - __builtin_clz((uint32_t)len);
+	if (bucket >= TRANSPORT_SIZE_BUCKETS)
+		bucket = TRANSPORT_SIZE_BUCKETS - 1;
+	__atomic_fetch_add(&_stats.sizeHistogram[bucket], 1, __ATOMIC_RELAXED);
+}
+
+// メインループと、受信中に溢れを通知するBLEのタスクの両方から呼ばれる
+void Transport::countSend(size_t len) {
+	__atomic_fetch_add(&_stats.sends, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&_stats.bytesOut, (uint32_t)len, __ATOMIC_RELAXED);
+}
+
+// BLEのタスクから呼ばれる
+// 最小と最大はリセットと重なっても壊れた値にならないよう、比べてから置き換える
+void Transport::countRoundTrip(uint32_t us) {
+	uint32_t count = __atomic_fetch_add(&_stats.rttCount, 1, __ATOMIC_RELAXED);
+	uint32_t min = __atomic_load_n(&_stats.rttMin, __ATOMIC_RELAXED);
+	if (count == 0) {
+		__atomic_store_n(&_stats.rttMin, us, __ATOMIC_RELAXED);
+	} else {
+		while (us < min &&
+			!__atomic_compare_exchange_n(&_stats.rttMin, &min, us, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			;
+	}
+	uint32_t max = __atomic_load_n(&_stats.rttMax, __ATOMIC_RELAXED);
+	while (us > max &&
+		!__atomic_compare_exchange_n(&_stats.rttMax, &max, us, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+	__atomic_fetch_add(&_stats.rttTotal, (uint64_t)us, __ATOMIC_RELAXED);
+}
+
 size_t Transport::send(const char *text) {
 	return send((uint8_t*)text, strlen(text));
 }
@@ -11,22 +11,51 @@ enum TransportType {
 	BLE_TRANSPORT
 };
 
+// 通信の状態を調べるためのカウンタ
+// 受信側はBLEのタスクが書き込む。送信側はメインループのほか、受信中に溢れを通知するときは
+// BLEのタスクからも書き込まれるので、すべてのカウンタとリセットを__atomicで行う
+typedef struct _TRANSPORT_STATS {
+	uint32_t	bytesIn;
+	uint32_t	bytesOut;
+	uint32_t	receives;			// BLEの書き込み、USBシリアルの読み出しの回数
+	uint32_t	sends;
+	uint32_t	overflows;			// 受信バッファに入りきらずに捨てた回数
+	uint32_t	indications;
+	uint32_t	indicationErrors;
+	uint32_t	rttCount;			// indicateから確認応答までの時間
+	uint32_t	rttMin;				// us
+	uint32_t	rttMax;				// us
+	uint64_t	rttTotal;			// us
+	uint32_t	sizeHistogram[TRANSPORT_SIZE_BUCKETS];	// [0]は1バイト、[n]は2^n以上2^(n+1)未満
+} TRANSPORT_STATS;
+
 class Processor;
 
 class Transport {
 protected:
 	TransportType type;
 	Processor* processor;
-	Transport(TransportType type, Processor* processor) : type(type),processor(processor) {}
+	TRANSPORT_STATS _stats;
+	Transport(TransportType type, Processor* processor) : type(type),processor(processor) { resetStats(); }
 	virtual ~Transport() = default;
+	void countReceive(size_t len);
+	void countSend(size_t len);
+	void countRoundTrip(uint32_t us);
+	void countIndication() { __atomic_fetch_add(&_stats.indications, 1, __ATOMIC_RELAXED); }
+	void countIndicationError() { __atomic_fetch_add(&_stats.indicationErrors, 1, __ATOMIC_RELAXED); }
 public:
 	TransportType getType() { return type; }
+	const char *name() { return type == BLE_TRANSPORT ? "ble" : "serial"; }
+	const TRANSPORT_STATS *stats() const { return &_stats; }
+	void countOverflow() { __atomic_fetch_add(&_stats.overflows, 1, __ATOMIC_RELAXED); }
+	void resetStats();
 	virtual bool init() = 0;
 	virtual void close() = 0;
 	virtual size_t available() = 0;
 	virtual size_t read(uint8_t* data, size_t len) = 0;
 	virtual size_t send(const uint8_t* data, size_t len) = 0;
 	virtual void flush() = 0;
+	virtual size_t packetSize() { return MESSAGE_BUFFER_SIZE; }
 	size_t send(const char* text);
 	size_t printf(const char * format, ...);
 };
@@ -4,7 +4,9 @@
 
 #include "transport_ble.h"
 #include "NimBLEDevice.h"
+#include "event_loop.h"
 #include "processor.h"
+#include "trace.h"
 #include "esp_bt_main.h"           // Bluetoothスタックのヘッダ
 #include "esp_bt_device.h"
 BleTransport::BleTransport(Processor *processor) : Transport(BLE_TRANSPORT, processor)
@@ -16,6 +18,7 @@ BleTransport::BleTransport(Processor *processor) : Transport(BLE_TRANSPORT, proc
 	_ctrlRx = nullptr;
 	_connHandle = 0;
 	_indicateReady = true;
+	_indicateTime = 0;
 
 	_connectCallback = nullptr;
 	_disconnectCallback = nullptr;
@@ -101,16 +104,24 @@ size_t BleTransport::send(const uint8_t *data, size_t len) {
 	for (uint offset = 0; offset < len; offset += chunkSize)
 	{
 		if (!waitSendingComplete())
+		{
+			countSend(offset);
 			return offset;
+		}
 		_indicateReady = false;
 		size_t sendSize = len - offset;
 		if (sendSize > chunkSize) sendSize = chunkSize;
 		_ctrlTx->setValue(data + offset, sendSize);
+		_indicateTime = micros();
+		// 失敗したindicateはonStatus()に通知されるので、エラーはそちらで数える
 		if (!_ctrlTx->indicate())
 		{
+			countSend(offset);
 			return offset;
 		}
+		countIndication();
 	}
+	countSend(len);
 	return len;
 }
 
@@ -149,12 +160,14 @@ void BleTransport::onConnect(NimBLEServer *pServer, NimBLEConnInfo &connInfo) {
 			close();
 		}
 	}
+	EventLoop::post(EVENT_BLE);
 }
 
 void BleTransport::onDisconnect(NimBLEServer *pServer, NimBLEConnInfo &connInfo, int reason) {
 	if (_disconnectCallback != nullptr)
 		_disconnectCallback(this);
 	startAdv();
+	EventLoop::post(EVENT_BLE);
 }
 
 void BleTransport::onWrite(NimBLECharacteristic *pCharacteristic, NimBLEConnInfo &connInfo) {
@@ -163,7 +176,10 @@ void BleTransport::onWrite(NimBLECharacteristic *pCharacteristic, NimBLEConnInfo
 		NimBLEAttValue value = pCharacteristic->getValue();
 		size_t len = value.size();
 		if (len == 0) return;
+		countReceive(len);
+		Trace::record(TRACE_RECEIVE, BLE_TRANSPORT, len);
 		processor->onTransportDataArrive(millis(), this, value.data(), len);
+		EventLoop::post(EVENT_BLE);
 	}
 }
 
@@ -173,8 +189,13 @@ void BleTransport::onStatus(NimBLECharacteristic* pCharacteristic, NimBLEConnInf
 	{
 		if (code == BLE_HS_EDONE)
 		{
+			countRoundTrip(micros() - _indicateTime);
 			_indicateReady = true;
 		}
+		else
+		{
+			countIndicationError();
+		}
 	}
 }
 
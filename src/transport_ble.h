@@ -24,6 +24,7 @@ private:
 	NimBLECharacteristic* _ctrlRx;
 	uint16_t _connHandle;
 	volatile bool _indicateReady;
+	volatile uint32_t _indicateTime;	// us
 
 	bool (*_connectCallback)(Transport* transport);
 	void (*_disconnectCallback)(Transport* transport);
@@ -42,6 +43,7 @@ public:
 	size_t read(uint8_t *data, size_t len) override;
 	size_t send(const uint8_t *data, size_t len) override;
 	void flush() override;
+	size_t packetSize() override { return _mtuSize > 3 ? _mtuSize - 3 : 20; }
 	void startAdv();
 	void stopAvd();
 	void setConnectCallback(bool (*cb)(Transport* transport));
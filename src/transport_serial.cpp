@@ -3,6 +3,20 @@
 //
 
 #include "transport_serial.h"
+#include "event_loop.h"
+
+// 受信と接続状態の変化でメインループを起こす
+#if ARDUINO_USB_CDC_ON_BOOT
+static void onSerialEvent(void *arg, esp_event_base_t base, int32_t id, void *data)
+{
+	EventLoop::post(EVENT_SERIAL);
+}
+#else
+static void onSerialReceive()
+{
+	EventLoop::post(EVENT_SERIAL);
+}
+#endif
 
 SerialTransport::SerialTransport(Processor* processor) : Transport(SERIAL_TRANSPORT,processor) {
 }
@@ -12,6 +26,13 @@ SerialTransport::~SerialTransport() = default;
 bool SerialTransport::init()
 {
 	Serial.begin(115200);
+#if ARDUINO_USB_CDC_ON_BOOT && !ARDUINO_USB_MODE
+	Serial.onEvent(ARDUINO_USB_CDC_ANY_EVENT, onSerialEvent);
+#elif ARDUINO_USB_CDC_ON_BOOT
+	Serial.onEvent(ARDUINO_HW_CDC_ANY_EVENT, onSerialEvent);
+#else
+	Serial.onReceive(onSerialReceive);
+#endif
 	return true;
 }
 
@@ -27,12 +48,18 @@ size_t SerialTransport::available() {
 	return Serial.available();
 }
 
+// 受信済みの分だけを読み出す
 size_t SerialTransport::read(uint8_t *data, size_t len) {
-	return Serial.readBytes(data, len);
+	size_t n = Serial.read(data, len);
+	if (n > 0)
+		countReceive(n);
+	return n;
 }
 
 size_t SerialTransport::send(const uint8_t *data, size_t len) {
-	return Serial.write(data, len);
+	size_t n = Serial.write(data, len);
+	countSend(n);
+	return n;
 }
 
 void SerialTransport::flush()
@@ -264,10 +264,11 @@ const char *Utils::parseHex(const char *p, uint32_t *val) {
     return p;
 }
 
-uint16_t Utils::crc16(const uint8_t* buff, size_t size)
+// CRC-16/MODBUS 分割したデータは前回の結果をcrcに渡して続けて計算する
+uint16_t Utils::crc16(const uint8_t* buff, size_t size, uint16_t crc)
 {
     uint8_t* data = (uint8_t*)buff;
-    uint16_t result = 0xFFFF;
+    uint16_t result = crc;
 
     for (size_t i = 0; i < size; ++i)
     {
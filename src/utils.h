@@ -37,7 +37,7 @@ public:
 	static const char * parseHex4(const char *p, byte *val);
 	static const char * parseHexByte(const char *p, byte *val);
 	static const char * parseHex(const char*p, uint32_t *val);
-	static uint16_t crc16(const uint8_t* buff, size_t size);;
+	static uint16_t crc16(const uint8_t* buff, size_t size, uint16_t crc = 0xFFFF);
 };
 
 
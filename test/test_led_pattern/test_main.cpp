@@ -0,0 +1,162 @@
+//
+// Created by agent on 2026/10/19.
+//
+// LedPatternのテストと、1フレームの色計算と画素バッファへの書き込み時間の計測
+// pio test -e native -v で計測結果を表示する
+// 時間はホストでの参考値で、実機(ESP32-S3)の時間やpixels.show()の時間は含まないので合否には使わない
+
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+
+#include "led_pattern.h"
+
+static uint8_t identity[256];
+static uint8_t buffer[MAX_PIXEL_COUNT * 3];
+
+void setUp() {
+	for (int i = 0; i < 256; i++)
+		identity[i] = (uint8_t)i;
+	memset(buffer, 0, sizeof(buffer));
+}
+
+void tearDown() {
+}
+
+static void setSegment(LedPattern *pattern, int index, uint32_t rgb, uint32_t time, bool gradient) {
+	LED_SEQUENCE *seg = pattern->segment(index);
+	seg->R = (rgb >> 16) & 0xFF;
+	seg->G = (rgb >> 8) & 0xFF;
+	seg->B = rgb & 0xFF;
+	seg->time = time;
+	seg->gradient = gradient;
+}
+
+static void test_single_color() {
+	LedPattern pattern;
+	setSegment(&pattern, 0, 0x102030, 1000, false);
+	pattern.start(1, false);
+	TEST_ASSERT_TRUE(pattern.update(100, 0));
+	TEST_ASSERT_FALSE(pattern.update(5000, 0));
+	TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, pattern.nextChange(5000));
+	pattern.fill(buffer, 1, 2, identity);
+	// GRB順
+	const uint8_t expect[] = { 0, 0, 0, 0x20, 0x10, 0x30, 0x20, 0x10, 0x30, 0, 0, 0 };
+	TEST_ASSERT_EQUAL_UINT8_ARRAY(expect, buffer, sizeof(expect));
+}
+
+static void test_step() {
+	LedPattern pattern;
+	setSegment(&pattern, 0, 0xFF0000, 50, false);
+	setSegment(&pattern, 1, 0x0000FF, 50, false);
+	pattern.start(2, false);
+	TEST_ASSERT_TRUE(pattern.update(1000, 0));
+	TEST_ASSERT_EQUAL_UINT32(30, pattern.nextChange(1020));
+	TEST_ASSERT_FALSE(pattern.update(1049, 0));
+	TEST_ASSERT_TRUE(pattern.update(1050, 0));
+	pattern.fill(buffer, 0, 1, identity);
+	TEST_ASSERT_EQUAL_UINT8(0x00, buffer[1]);
+	TEST_ASSERT_EQUAL_UINT8(0xFF, buffer[2]);
+	TEST_ASSERT_TRUE(pattern.update(1100, 0));
+	pattern.fill(buffer, 0, 1, identity);
+	TEST_ASSERT_EQUAL_UINT8(0xFF, buffer[1]);
+}
+
+static void test_gradient() {
+	LedPattern pattern;
+	setSegment(&pattern, 0, 0x000000, 100, true);
+	setSegment(&pattern, 1, 0xC86400, 100, true);
+	pattern.start(2, false);
+	pattern.update(1000, 0);
+	TEST_ASSERT_EQUAL_UINT32(0, pattern.nextChange(1000));
+	TEST_ASSERT_TRUE(pattern.update(1050, 0));
+	pattern.fill(buffer, 0, 1, identity);
+	TEST_ASSERT_EQUAL_UINT8(50, buffer[0]);		// G
+	TEST_ASSERT_EQUAL_UINT8(100, buffer[1]);	// R
+	TEST_ASSERT_EQUAL_UINT8(0, buffer[2]);		// B
+	// 2つめのセグメントは最初の色へ戻る
+	pattern.update(1100, 0);
+	pattern.update(1125, 0);
+	pattern.fill(buffer, 0, 1, identity);
+	TEST_ASSERT_EQUAL_UINT8(75, buffer[0]);
+	TEST_ASSERT_EQUAL_UINT8(150, buffer[1]);
+}
+
+static void test_follow() {
+	LedPattern pattern;
+	setSegment(&pattern, 0, 0xFFFFFF, 1000, false);
+	pattern.start(1, true);
+	TEST_ASSERT_TRUE(pattern.following());
+	TEST_ASSERT_FALSE(pattern.update(10, 0));
+	TEST_ASSERT_TRUE(pattern.update(20, 127));
+	pattern.fill(buffer, 0, 1, identity);
+	TEST_ASSERT_EQUAL_UINT8(127, buffer[0]);
+	TEST_ASSERT_TRUE(pattern.update(30, 255));
+	pattern.fill(buffer, 0, 1, identity);
+	TEST_ASSERT_EQUAL_UINT8(255, buffer[0]);
+	TEST_ASSERT_TRUE(pattern.reset());
+	TEST_ASSERT_FALSE(pattern.following());
+	TEST_ASSERT_FALSE(pattern.reset());
+}
+
+static void test_output_table() {
+	uint8_t table[256];
+	for (int i = 0; i < 256; i++)
+		table[i] = (uint8_t)(i / 2);
+	LedPattern pattern;
+	setSegment(&pattern, 0, 0x804020, 1000, false);
+	pattern.start(1, false);
+	pattern.update(1, 0);
+	pattern.fill(buffer, 0, 1, table);
+	TEST_ASSERT_EQUAL_UINT8(0x20, buffer[0]);
+	TEST_ASSERT_EQUAL_UINT8(0x40, buffer[1]);
+	TEST_ASSERT_EQUAL_UINT8(0x10, buffer[2]);
+}
+
+// 1フレーム分(全スロットのupdate()と画素バッファへの書き込み)の時間を計測する
+// 全スロットをグラデーションにして毎フレーム色が変わる最悪の場合
+static void benchFrame(uint16_t pixelCount, int slotCount) {
+	static LedPattern pattern[MAX_SLOT_COUNT];
+	uint16_t slotPixels = pixelCount / slotCount;
+	for (int s = 0; s < slotCount; s++) {
+		for (int i = 0; i < MAX_LED_SEQUENCE_LENGTH; i++)
+			setSegment(&pattern[s], i, (i & 1) ? 0xFF8040 : 0x0040FF, 400 + s * 7, true);
+		pattern[s].start(MAX_LED_SEQUENCE_LENGTH, false);
+	}
+	const int frames = 20000;
+	uint32_t now = 1;
+	auto begin = std::chrono::steady_clock::now();
+	for (int f = 0; f < frames; f++) {
+		now += LED_FRAME_INTERVAL;
+		for (int s = 0; s < slotCount; s++) {
+			if (pattern[s].update(now, 0))
+				pattern[s].fill(buffer, s * slotPixels, slotPixels, identity);
+		}
+	}
+	auto end = std::chrono::steady_clock::now();
+	double us = std::chrono::duration<double, std::micro>(end - begin).count() / frames;
+	char message[80];
+	snprintf(message, sizeof(message), "pixels=%u slots=%d frame=%.3fus", pixelCount, slotCount, us);
+	TEST_MESSAGE(message);
+}
+
+static void test_benchmark() {
+	static const uint16_t pixelCounts[] = { SLOT_COUNT, 60, 150, MAX_PIXEL_COUNT };
+	for (size_t i = 0; i < sizeof(pixelCounts) / sizeof(pixelCounts[0]); i++) {
+		int slots = pixelCounts[i] < MAX_SLOT_COUNT ? pixelCounts[i] : SLOT_COUNT;
+		benchFrame(pixelCounts[i], slots);
+	}
+	benchFrame(MAX_PIXEL_COUNT, MAX_SLOT_COUNT);
+}
+
+int main(int argc, char **argv) {
+	UNITY_BEGIN();
+	RUN_TEST(test_single_color);
+	RUN_TEST(test_step);
+	RUN_TEST(test_gradient);
+	RUN_TEST(test_follow);
+	RUN_TEST(test_output_table);
+	RUN_TEST(test_benchmark);
+	return UNITY_END();
+}
@@ -0,0 +1,164 @@
+//
+// Created by agent on 2026/10/19.
+//
+// StreamEstimatorのテストと、遅いサーバから受信しながら再生する場合のシミュレーション
+// pio test -e native -v で各条件の再生開始までの時間と溜め直しの回数を表示する
+
+#include <unity.h>
+#include <stdio.h>
+
+#include "stream_estimator.h"
+
+#define TEST_BYTE_RATE	(128000 / 8)
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+typedef struct _SIMULATION {
+	uint32_t	startTime;		// 最初に再生を始めた時刻(ms)
+	uint32_t	finishTime;		// 再生が終わった時刻(ms)
+	int			rebuffers;		// 再生中に溜め直した回数
+	int			underruns;		// 溜め直す前に再生する分がなくなった回数
+} SIMULATION;
+
+// 1msごとに、サーバからの受信と再生(AudioTask::_bufferProcess()と同じ判断)を進める
+// サーバはperiod msごとにrate(バイト/秒)分をまとめて送り、stallEvery msごとにstall msだけ止まる
+static void simulate(StreamEstimator *estimator, uint32_t size, uint32_t rate, uint32_t period,
+	uint32_t stallEvery, uint32_t stall, SIMULATION *result) {
+	const uint32_t lowWater = TEST_BYTE_RATE * STREAM_LOW_WATER_MS / 1000;
+	uint32_t received = 0;
+	uint32_t position = 0;
+	uint32_t sent = 0;				// サーバが送った量(ms単位の端数を持ち越す)
+	bool playing = false;
+	result->startTime = 0;
+	result->finishTime = 0;
+	result->rebuffers = 0;
+	result->underruns = 0;
+	estimator->begin(0);
+	for (uint32_t now = 1; now < 10 * 60 * 1000 && position < size; now++) {
+		bool stalled = stallEvery > 0 && now % stallEvery < stall;
+		if (!stalled && now % period == 0 && received < size) {
+			uint32_t total = (uint32_t)((uint64_t)rate * now / 1000);
+			uint32_t n = total - sent;
+			sent = total;
+			if (n > size - received)
+				n = size - received;
+			received += n;
+			estimator->add(now, n);
+		}
+		uint32_t ahead = received - position;
+		if (playing) {
+			if (received < size && ahead < lowWater) {
+				playing = false;
+				result->rebuffers++;
+				continue;
+			}
+			uint32_t n = TEST_BYTE_RATE / 1000;
+			if (n > ahead) {
+				result->underruns++;
+				n = ahead;
+			}
+			position += n;
+			if (position >= size)
+				result->finishTime = now;
+		} else {
+			uint32_t target = StreamEstimator::target(TEST_BYTE_RATE, STREAM_PREBUFFER_MS, estimator->jitter(),
+				estimator->throughput(), size - position);
+			if (received == size || ahead >= target) {
+				playing = true;
+				if (result->startTime == 0)
+					result->startTime = now;
+			}
+		}
+	}
+	char message[120];
+	snprintf(message, sizeof(message), "rate=%lu stall=%lu/%lu start=%lums finish=%lums rebuffers=%d underruns=%d",
+		(unsigned long)rate, (unsigned long)stall, (unsigned long)stallEvery, (unsigned long)result->startTime,
+		(unsigned long)result->finishTime, result->rebuffers, result->underruns);
+	TEST_MESSAGE(message);
+}
+
+static void test_target_fast_server() {
+	// 十分速ければ指定の長さと途切れの2倍だけ溜める
+	uint32_t target = StreamEstimator::target(TEST_BYTE_RATE, 1000, 50, TEST_BYTE_RATE * 4, 1000000);
+	TEST_ASSERT_EQUAL_UINT32(TEST_BYTE_RATE * 1100 / 1000, target);
+	// 残りより多くは溜めない
+	TEST_ASSERT_EQUAL_UINT32(1000, StreamEstimator::target(TEST_BYTE_RATE, 1000, 50, TEST_BYTE_RATE * 4, 1000));
+}
+
+static void test_target_slow_server() {
+	// 受信が再生の半分の速さなら、残りの半分と溜め直しの閾値の分を溜める
+	uint32_t target = StreamEstimator::target(TEST_BYTE_RATE, 1000, 0, TEST_BYTE_RATE / 2, 400000);
+	TEST_ASSERT_EQUAL_UINT32(200000 + TEST_BYTE_RATE * STREAM_LOW_WATER_MS / 1000, target);
+}
+
+static void test_throughput() {
+	StreamEstimator estimator;
+	estimator.begin(0);
+	for (uint32_t now = 10; now <= 1000; now += 10)
+		estimator.add(now, 120);
+	TEST_ASSERT_UINT32_WITHIN(100, 12000, estimator.throughput());
+}
+
+// 途切れの減衰は読み出しの回数ではなく経過時間で決まる
+static void test_jitter_decay_by_time() {
+	StreamEstimator often;
+	StreamEstimator seldom;
+	often.begin(0);
+	seldom.begin(0);
+	often.add(800, 100);
+	seldom.add(800, 100);
+	TEST_ASSERT_EQUAL_UINT32(800, often.jitter());
+	for (uint32_t now = 801; now <= 2800; now++)
+		often.add(now, 10);
+	for (uint32_t now = 820; now <= 2800; now += 20)
+		seldom.add(now, 200);
+	TEST_ASSERT_EQUAL_UINT32(often.jitter(), seldom.jitter());
+	// 2秒で半分より小さくなり、0にはならない
+	TEST_ASSERT_TRUE(often.jitter() < 400);
+	TEST_ASSERT_TRUE(often.jitter() > 20);
+}
+
+static void test_fast_server() {
+	StreamEstimator estimator;
+	SIMULATION result;
+	simulate(&estimator, 400000, TEST_BYTE_RATE * 4, 20, 0, 0, &result);
+	TEST_ASSERT_EQUAL_INT(0, result.rebuffers);
+	TEST_ASSERT_EQUAL_INT(0, result.underruns);
+	TEST_ASSERT_TRUE(result.startTime < 500);
+}
+
+// 再生に必要な速度の3/4しか出ないサーバでも、最初に溜めた後は途切れない
+static void test_throttled_server() {
+	StreamEstimator estimator;
+	SIMULATION result;
+	simulate(&estimator, 400000, TEST_BYTE_RATE * 3 / 4, 50, 0, 0, &result);
+	TEST_ASSERT_EQUAL_INT(0, result.rebuffers);
+	TEST_ASSERT_EQUAL_INT(0, result.underruns);
+	// 全体を受信し終わるより前に再生を始める
+	TEST_ASSERT_TRUE(result.startTime < 400000 * 1000 / (TEST_BYTE_RATE * 3 / 4));
+}
+
+// 遅いうえに定期的に止まるサーバでは、止まった時間の分も溜める
+static void test_throttled_stalling_server() {
+	StreamEstimator estimator;
+	SIMULATION result;
+	simulate(&estimator, 400000, TEST_BYTE_RATE * 9 / 10, 50, 3000, 400, &result);
+	TEST_ASSERT_EQUAL_INT(0, result.underruns);
+	TEST_ASSERT_EQUAL_INT(0, result.rebuffers);
+}
+
+int main(int argc, char **argv) {
+	UNITY_BEGIN();
+	RUN_TEST(test_target_fast_server);
+	RUN_TEST(test_target_slow_server);
+	RUN_TEST(test_throughput);
+	RUN_TEST(test_jitter_decay_by_time);
+	RUN_TEST(test_fast_server);
+	RUN_TEST(test_throttled_server);
+	RUN_TEST(test_throttled_stalling_server);
+	return UNITY_END();
+}
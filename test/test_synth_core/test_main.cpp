@@ -0,0 +1,146 @@
+//
+// Created by agent on 2026/10/19.
+//
+// SynthCoreの出力を、実機と同じ固定小数点の計算で求めた既知のサンプル列と比べる
+// 計算を変えて波形が変わる場合は、意図した変更か確かめてから期待値を作り直す
+
+#include <unity.h>
+#include <string.h>
+
+#include "synth_core.h"
+
+#define TEST_RATE	8000
+
+// A4を3ms(24サンプル)、休符を1ms(8サンプル) adsr=1,1,50,1
+static const int16_t expectSine[32] = {
+	0, 1387, 5221, 10575, 16092, 20225, 21533, 18957,
+	12060, 963, -8860, -16318, -20750, -21985, -20318, -16422,
+	-11215, -5693, -772, 2856, 4814, 5080, 3966, 2038,
+	0, 0, 0, 0, 0, 0, 0, 0,
+};
+static const int16_t expectSquare[32] = {
+	0, 2048, 4096, 6144, 8192, 10240, 12288, 14336,
+	16384, 15360, -14336, -13312, -12288, -11264, -10240, -9216,
+	-8192, -7168, -6144, 5120, 4096, 3072, 2048, 1024,
+	0, 0, 0, 0, 0, 0, 0, 0,
+};
+static const int16_t expectTriangle[32] = {
+	0, -3195, -4588, -4179, -1967, 2047, 7863, 15482,
+	24903, 30105, 22937, 15441, 8847, 3153, -1639, -5530,
+	-8520, -10609, -11797, -8397, -4916, -2335, -656, 122,
+	0, 0, 0, 0, 0, 0, 0, 0,
+};
+static const int16_t expectSaw[32] = {
+	0, -1823, -3195, -4117, -4588, -4609, -4179, -3298,
+	-1967, -154, 1433, 2795, 3931, 4843, 5529, 5990,
+	6225, 6236, 6021, -4660, -3277, -2120, -1188, -482,
+	0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+void setUp() {
+	SynthCore::init();
+}
+
+void tearDown() {
+}
+
+static void makeSequence(SYNTH_SEQUENCE *sequence, SynthWave wave) {
+	memset(sequence, 0, sizeof(SYNTH_SEQUENCE));
+	sequence->wave = wave;
+	sequence->attack = 1;
+	sequence->decay = 1;
+	sequence->sustain = 50;
+	sequence->release = 1;
+	sequence->gain = 100;
+	sequence->count = 2;
+	sequence->note[0].frequency = 44000;
+	sequence->note[0].time = 3;
+	sequence->note[1].frequency = 0;
+	sequence->note[1].time = 1;
+}
+
+// 鳴り終わるまでのサンプル数を返す
+static int render(SynthWave wave, int16_t *buffer, int size) {
+	SYNTH_SEQUENCE sequence;
+	makeSequence(&sequence, wave);
+	SYNTH_VOICE v;
+	SynthCore::start(&v, &sequence);
+	int count = 0;
+	while (v.active && count < size) {
+		int32_t s = SynthCore::next(&v, TEST_RATE);
+		if (v.active)
+			buffer[count++] = (int16_t)s;
+	}
+	return count;
+}
+
+static void checkWave(SynthWave wave, const int16_t *expect) {
+	int16_t buffer[64];
+	TEST_ASSERT_EQUAL_INT(32, render(wave, buffer, 64));
+	TEST_ASSERT_EQUAL_INT16_ARRAY(expect, buffer, 32);
+}
+
+static void test_sine() {
+	checkWave(SYNTH_SINE, expectSine);
+}
+
+static void test_square() {
+	checkWave(SYNTH_SQUARE, expectSquare);
+}
+
+static void test_triangle() {
+	checkWave(SYNTH_TRIANGLE, expectTriangle);
+}
+
+static void test_saw() {
+	checkWave(SYNTH_SAW, expectSaw);
+}
+
+static void test_empty_sequence() {
+	SYNTH_SEQUENCE sequence;
+	makeSequence(&sequence, SYNTH_SINE);
+	sequence.count = 0;
+	SYNTH_VOICE v;
+	v.active = true;
+	SynthCore::start(&v, &sequence);
+	TEST_ASSERT_FALSE(v.active);
+}
+
+static void test_rest_only() {
+	SYNTH_SEQUENCE sequence;
+	makeSequence(&sequence, SYNTH_SQUARE);
+	sequence.count = 1;
+	sequence.note[0].frequency = 0;
+	sequence.note[0].time = 2;
+	SYNTH_VOICE v;
+	SynthCore::start(&v, &sequence);
+	for (int i = 0; i < 16; i++)
+		TEST_ASSERT_EQUAL_INT(0, SynthCore::next(&v, TEST_RATE));
+	TEST_ASSERT_TRUE(v.active);
+	SynthCore::next(&v, TEST_RATE);
+	TEST_ASSERT_FALSE(v.active);
+}
+
+// 出力の周波数が変わっても音程は同じままにする
+static void test_rate_change() {
+	SYNTH_SEQUENCE sequence;
+	makeSequence(&sequence, SYNTH_SINE);
+	SYNTH_VOICE v;
+	SynthCore::start(&v, &sequence);
+	SynthCore::next(&v, TEST_RATE);
+	uint32_t step = v.step;
+	SynthCore::next(&v, TEST_RATE * 2);
+	TEST_ASSERT_EQUAL_UINT32(step / 2, v.step);
+}
+
+int main(int argc, char **argv) {
+	UNITY_BEGIN();
+	RUN_TEST(test_sine);
+	RUN_TEST(test_square);
+	RUN_TEST(test_triangle);
+	RUN_TEST(test_saw);
+	RUN_TEST(test_empty_sequence);
+	RUN_TEST(test_rest_only);
+	RUN_TEST(test_rate_change);
+	return UNITY_END();
+}
@@ -0,0 +1,149 @@
+//
+// Created by agent on 2026/10/19.
+//
+// TimerWheelのテスト
+// millis()が一周する前後でも、期限どおりに呼び出されることを確かめる
+
+#include <unity.h>
+
+#include "timer_wheel.h"
+
+static uint32_t fired[8];
+static int firedCount;
+
+static void onTimer(uint32_t now, uint32_t arg) {
+	if (firedCount < 8)
+		fired[firedCount] = now;
+	firedCount++;
+}
+
+void setUp() {
+	firedCount = 0;
+}
+
+void tearDown() {
+}
+
+// startから1msずつ時刻を進めてprocess()を呼ぶ
+static void run(uint32_t start, uint32_t duration) {
+	for (uint32_t t = 0; t <= duration; t++)
+		TimerWheel::process(start + t);
+}
+
+static void test_fire_on_time() {
+	TimerWheel::init(1000);
+	TimerWheel::schedule(1000, 35, onTimer);
+	run(1000, 100);
+	TEST_ASSERT_EQUAL_INT(1, firedCount);
+	TEST_ASSERT_EQUAL_UINT32(1035, fired[0]);
+	TEST_ASSERT_EQUAL_INT(0, TimerWheel::active());
+}
+
+// 1周(2.56秒)より先の期限
+static void test_long_delay() {
+	TimerWheel::init(0);
+	TimerWheel::schedule(0, 6000, onTimer);
+	run(0, 7000);
+	TEST_ASSERT_EQUAL_INT(1, firedCount);
+	TEST_ASSERT_EQUAL_UINT32(6000, fired[0]);
+}
+
+// millis()が0に戻る前後
+static void test_millis_wrap() {
+	uint32_t start = 0xFFFFFFFFu - 1234;
+	TimerWheel::init(start);
+	TimerWheel::schedule(start, 1000, onTimer, 0);
+	TimerWheel::schedule(start, 2000, onTimer, 1);
+	TimerWheel::schedule(start, 3000, onTimer, 2);
+	run(start, 4000);
+	TEST_ASSERT_EQUAL_INT(3, firedCount);
+	TEST_ASSERT_EQUAL_UINT32(start + 1000, fired[0]);
+	TEST_ASSERT_EQUAL_UINT32(start + 2000, fired[1]);
+	TEST_ASSERT_EQUAL_UINT32(start + 3000, fired[2]);
+}
+
+// 一周した後に登録したタイマー
+static void test_schedule_after_wrap() {
+	uint32_t start = 0xFFFFFFFFu - 5;
+	TimerWheel::init(start);
+	run(start, 100);
+	uint32_t now = start + 100;
+	TimerWheel::schedule(now, 55, onTimer);
+	run(now, 200);
+	TEST_ASSERT_EQUAL_INT(1, firedCount);
+	TEST_ASSERT_EQUAL_UINT32(now + 55, fired[0]);
+}
+
+// 処理が遅れて何ティックも飛んだ場合
+static void test_late_process() {
+	TimerWheel::init(0xFFFFFF00u);
+	TimerWheel::schedule(0xFFFFFF00u, 300, onTimer);
+	TimerWheel::process(0xFFFFFF00u + 100);
+	TEST_ASSERT_EQUAL_INT(0, firedCount);
+	TimerWheel::process(0xFFFFFF00u + 900);
+	TEST_ASSERT_EQUAL_INT(1, firedCount);
+}
+
+static void test_next() {
+	TimerWheel::init(0xFFFFFFF0u);
+	uint32_t now = 0xFFFFFFF0u;
+	TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, TimerWheel::next(now));
+	TimerId a = TimerWheel::schedule(now, 500, onTimer);
+	TimerWheel::schedule(now, 100, onTimer);
+	TimerId c = TimerWheel::schedule(now, 5000, onTimer);
+	TEST_ASSERT_EQUAL_UINT32(100, TimerWheel::next(now));
+	TEST_ASSERT_EQUAL_UINT32(60, TimerWheel::next(now + 40));
+	run(now, 150);
+	TEST_ASSERT_EQUAL_INT(1, firedCount);
+	TEST_ASSERT_EQUAL_UINT32(350, TimerWheel::next(now + 150));
+	TimerWheel::cancel(a);
+	TEST_ASSERT_EQUAL_UINT32(4850, TimerWheel::next(now + 150));
+	TimerWheel::cancel(c);
+	TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, TimerWheel::next(now + 150));
+	TEST_ASSERT_EQUAL_UINT32(0, TimerWheel::remain(now, a));
+}
+
+// 表が埋まったら0を返し、空いたらまた登録できる
+static void test_pool_full() {
+	TimerWheel::init(0);
+	TimerId ids[TIMER_WHEEL_ENTRIES];
+	for (int i = 0; i < TIMER_WHEEL_ENTRIES; i++) {
+		ids[i] = TimerWheel::schedule(0, 1000 + i, onTimer);
+		TEST_ASSERT_TRUE(ids[i] != 0);
+	}
+	TEST_ASSERT_EQUAL_INT(TIMER_WHEEL_ENTRIES, TimerWheel::active());
+	TEST_ASSERT_EQUAL_UINT32(0, TimerWheel::schedule(0, 50, onTimer));
+	TEST_ASSERT_EQUAL_UINT32(0, TimerWheel::reschedule(0, 0, 50, onTimer));
+
+	// 取り消した位置を使い回しても、古いIDでは触れない
+	TEST_ASSERT_TRUE(TimerWheel::cancel(ids[3]));
+	TimerId id = TimerWheel::schedule(0, 50, onTimer);
+	TEST_ASSERT_TRUE(id != 0);
+	TEST_ASSERT_TRUE(id != ids[3]);
+	TEST_ASSERT_FALSE(TimerWheel::cancel(ids[3]));
+	run(0, 60);
+	TEST_ASSERT_EQUAL_INT(1, firedCount);
+	TEST_ASSERT_EQUAL_INT(TIMER_WHEEL_ENTRIES - 1, TimerWheel::active());
+}
+
+// LEDのTTLと遅延再生をすべて使っても、決まった用途のタイマーの分は残る
+static void test_system_reserve() {
+	TimerWheel::init(0);
+	for (int i = 0; i < MAX_SLOT_COUNT + DELAYED_PLAY_ENTRIES; i++)
+		TEST_ASSERT_TRUE(TimerWheel::schedule(0, 5000, onTimer, i) != 0);
+	for (int i = 0; i < TIMER_WHEEL_SYSTEM_TIMERS; i++)
+		TEST_ASSERT_TRUE(TimerWheel::schedule(0, 1000, onTimer) != 0);
+}
+
+int main(int argc, char **argv) {
+	UNITY_BEGIN();
+	RUN_TEST(test_fire_on_time);
+	RUN_TEST(test_long_delay);
+	RUN_TEST(test_millis_wrap);
+	RUN_TEST(test_schedule_after_wrap);
+	RUN_TEST(test_late_process);
+	RUN_TEST(test_next);
+	RUN_TEST(test_pool_full);
+	RUN_TEST(test_system_reserve);
+	return UNITY_END();
+}